@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "database.h"
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+
+struct ConnectionPoolConfig
+{
+	/**
+	 * Connections opened at pool creation and never evicted. Pool reopens
+	 * connections up to min_size when broken ones are dropped.
+	 */
+	uint32_t min_size = 0;
+
+	/**
+	 * Maximum number of opened connections
+	 */
+	uint32_t max_size = 8;
+
+	/**
+	 * Idle connections over min_size are closed after this delay
+	 */
+	std::chrono::milliseconds idle_timeout = std::chrono::minutes(5);
+
+	/**
+	 * Maximum time to wait for a connection when pool is exhausted
+	 */
+	std::chrono::milliseconds wait_timeout = std::chrono::seconds(5);
+
+	/**
+	 * Validate idle connections before lending them
+	 */
+	bool validate_on_borrow = true;
+};
+
+struct ConnectionPoolMetrics
+{
+	uint32_t size = 0;
+	uint32_t idle = 0;
+	uint32_t in_use = 0;
+	uint32_t waiting = 0;
+	uint64_t created = 0;
+	uint64_t destroyed = 0;
+	uint64_t borrowed = 0;
+	uint64_t timeouts = 0;
+	uint64_t validation_failures = 0;
+	uint64_t total_wait_us = 0;
+	uint64_t max_wait_us = 0;
+};
+
+/**
+ * Thread-safe connection pool.
+ *
+ * Client is a database client (DatabaseInterface implementation) created by the
+ * factory. Connections are lent through RAII leases and returned to the pool when
+ * the lease is destroyed. The pool must outlive its leases.
+ *
+ * @tparam Client pooled client type
+ */
+template<class Client>
+class ConnectionPool
+{
+public:
+	typedef std::function<std::unique_ptr<Client>()> Factory;
+
+	/**
+	 * Validator should throw a DatabaseException if connection is not usable
+	 */
+	typedef std::function<void(Client &)> Validator;
+
+	class Lease
+	{
+		friend class ConnectionPool;
+	public:
+		Lease(Lease &&other) noexcept :
+			m_pool(other.m_pool), m_client(std::move(other.m_client)),
+			m_valid(other.m_valid)
+		{
+			other.m_pool = nullptr;
+		}
+
+		Lease() = delete;
+		Lease(const Lease &other) = delete;
+		Lease &operator=(const Lease &other) = delete;
+
+		~Lease() { release(); }
+
+		Client *operator->() const { return m_client.get(); }
+		Client &operator*() const { return *m_client; }
+
+		/**
+		 * Flag connection as broken, it will be closed instead of returned to pool
+		 */
+		void invalidate() { m_valid = false; }
+
+		/**
+		 * Return connection to the pool before lease destruction
+		 */
+		void release()
+		{
+			if (m_pool && m_client) {
+				m_pool->release(std::move(m_client), m_valid);
+			}
+			m_pool = nullptr;
+		}
+
+	private:
+		Lease(ConnectionPool *pool, std::unique_ptr<Client> client) :
+			m_pool(pool), m_client(std::move(client))
+		{}
+
+		ConnectionPool *m_pool = nullptr;
+		std::unique_ptr<Client> m_client = nullptr;
+		bool m_valid = true;
+	};
+
+	/**
+	 * Create pool and open min_size connections
+	 *
+	 * @throws DatabaseException if a connection cannot be opened
+	 * @param factory connection factory
+	 * @param config
+	 * @param validator validation function, defaults to Client::check_connection
+	 */
+	explicit ConnectionPool(const Factory &factory,
+		const ConnectionPoolConfig &config = ConnectionPoolConfig(),
+		const Validator &validator = [](Client &c) { c.check_connection(); }) :
+		m_factory(factory), m_validator(validator), m_config(config)
+	{
+		assert(m_config.max_size > 0 && m_config.min_size <= m_config.max_size);
+
+		for (uint32_t i = 0; i < m_config.min_size; i++) {
+			m_idle.push_back({m_factory(), std::chrono::steady_clock::now()});
+			m_size++;
+			m_metrics.created++;
+		}
+	}
+
+	ConnectionPool() = delete;
+	ConnectionPool(const ConnectionPool &other) = delete;
+	ConnectionPool &operator=(const ConnectionPool &other) = delete;
+
+	~ConnectionPool()
+	{
+		// All leases should be returned before pool destruction
+		assert(m_size == m_idle.size());
+	}
+
+	/**
+	 * Borrow a connection, waiting at most config wait_timeout
+	 *
+	 * @throws DatabaseException on timeout or connection failure
+	 * @return connection lease
+	 */
+	Lease acquire() { return acquire(m_config.wait_timeout); }
+
+	/**
+	 * Borrow a connection, waiting at most timeout
+	 *
+	 * @throws DatabaseException on timeout or connection failure
+	 * @param timeout
+	 * @return connection lease
+	 */
+	Lease acquire(std::chrono::milliseconds timeout)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const auto deadline = start + timeout;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			if (!m_idle.empty()) {
+				// LIFO: reuse hot connections, let cold ones expire
+				std::unique_ptr<Client> client = std::move(m_idle.back().client);
+				m_idle.pop_back();
+
+				if (m_config.validate_on_borrow) {
+					lock.unlock();
+					bool valid = true;
+					try {
+						m_validator(*client);
+					}
+					catch (DatabaseException &) {
+						valid = false;
+						client.reset();
+					}
+					lock.lock();
+
+					if (!valid) {
+						m_size--;
+						m_metrics.destroyed++;
+						m_metrics.validation_failures++;
+						continue;
+					}
+				}
+
+				return lend(std::move(client), start);
+			}
+
+			if (m_size < m_config.max_size) {
+				// Reserve slot and connect outside of the lock
+				m_size++;
+				lock.unlock();
+				std::unique_ptr<Client> client;
+				try {
+					client = m_factory();
+				}
+				catch (...) {
+					lock.lock();
+					m_size--;
+					m_cv.notify_one();
+					throw;
+				}
+				lock.lock();
+				m_metrics.created++;
+				return lend(std::move(client), start);
+			}
+
+			m_metrics.waiting++;
+			bool available = m_cv.wait_until(lock, deadline, [this] {
+				return !m_idle.empty() || m_size < m_config.max_size;
+			});
+			m_metrics.waiting--;
+
+			if (!available) {
+				m_metrics.timeouts++;
+				throw DatabaseException("ConnectionPool: timed out waiting for a "
+					"connection (" + std::to_string(m_size) + " connections in use)");
+			}
+		}
+	}
+
+	/**
+	 * Close idle connections over min_size unused since idle_timeout, then reopen
+	 * connections up to min_size
+	 */
+	void evict_idle()
+	{
+		{
+			std::vector<std::unique_ptr<Client>> evicted;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				collect_idle(evicted);
+			}
+			// Connections are closed when evicted is destroyed, outside of the lock
+		}
+
+		refill();
+	}
+
+	ConnectionPoolMetrics get_metrics() const
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		ConnectionPoolMetrics metrics = m_metrics;
+		metrics.size = m_size;
+		metrics.idle = (uint32_t) m_idle.size();
+		metrics.in_use = m_size - metrics.idle;
+		return metrics;
+	}
+
+private:
+	struct IdleConnection
+	{
+		std::unique_ptr<Client> client;
+		std::chrono::steady_clock::time_point last_used;
+	};
+
+	/**
+	 * Must be called with m_mutex held
+	 */
+	Lease lend(std::unique_ptr<Client> client,
+		const std::chrono::steady_clock::time_point &wait_start)
+	{
+		const uint64_t wait_us = (uint64_t) std::chrono::duration_cast<
+			std::chrono::microseconds>(std::chrono::steady_clock::now() - wait_start).count();
+		m_metrics.borrowed++;
+		m_metrics.total_wait_us += wait_us;
+		if (wait_us > m_metrics.max_wait_us) {
+			m_metrics.max_wait_us = wait_us;
+		}
+
+		return Lease(this, std::move(client));
+	}
+
+	void release(std::unique_ptr<Client> client, bool valid)
+	{
+		std::vector<std::unique_ptr<Client>> evicted;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (valid) {
+				m_idle.push_back({std::move(client), std::chrono::steady_clock::now()});
+			} else {
+				m_size--;
+				m_metrics.destroyed++;
+			}
+
+			collect_idle(evicted);
+			m_cv.notify_one();
+		}
+
+		// Broken and evicted connections are closed outside of the lock
+		client.reset();
+		evicted.clear();
+
+		refill();
+	}
+
+	/**
+	 * Open connections until pool holds min_size connections. A connection failure
+	 * stops refill, next release or evict_idle call retries.
+	 */
+	void refill()
+	{
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_size >= m_config.min_size) {
+					return;
+				}
+
+				// Reserve slot and connect outside of the lock
+				m_size++;
+			}
+
+			std::unique_ptr<Client> client;
+			try {
+				client = m_factory();
+			}
+			catch (...) {
+				// Called from lease destructors, must not throw
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_size--;
+				m_cv.notify_one();
+				return;
+			}
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_idle.push_back({std::move(client), std::chrono::steady_clock::now()});
+			m_metrics.created++;
+			m_cv.notify_one();
+		}
+	}
+
+	/**
+	 * Move expired idle connections to evicted. Must be called with m_mutex held
+	 */
+	void collect_idle(std::vector<std::unique_ptr<Client>> &evicted)
+	{
+		const auto expiration = std::chrono::steady_clock::now() - m_config.idle_timeout;
+
+		// Oldest idle connections are at the front
+		auto it = m_idle.begin();
+		while (it != m_idle.end() && m_size > m_config.min_size &&
+			it->last_used < expiration) {
+			evicted.push_back(std::move(it->client));
+			m_size--;
+			m_metrics.destroyed++;
+			++it;
+		}
+
+		m_idle.erase(m_idle.begin(), it);
+	}
+
+	Factory m_factory;
+	Validator m_validator;
+	ConnectionPoolConfig m_config;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<IdleConnection> m_idle;
+	uint32_t m_size = 0;
+	ConnectionPoolMetrics m_metrics;
+};
+
+}
+}
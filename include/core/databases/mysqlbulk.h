@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+class MySQLClient;
+
+/**
+ * Bulk inserter packing rows into multi-row INSERT ... VALUES (...),(...) statements.
+ *
+ * Fields are written one by one, then the row is closed with end_row(). A statement is
+ * sent when adding the next row would make it larger than the maximum statement size,
+ * bounded by server max_allowed_packet. Rows not sent by end() are discarded.
+ */
+class MySQLBatchInserter
+{
+public:
+	/**
+	 * @throws MySQLException if max_allowed_packet cannot be read
+	 * @param client
+	 * @param table table name, not escaped
+	 * @param columns column names, not escaped. All table columns if empty
+	 * @param max_statement_size maximum INSERT size, 0 or larger values use server
+	 * max_allowed_packet
+	 */
+	MySQLBatchInserter(MySQLClient &client, const std::string &table,
+		const std::vector<std::string> &columns = {}, size_t max_statement_size = 0);
+
+	MySQLBatchInserter() = delete;
+	MySQLBatchInserter(const MySQLBatchInserter &other) = delete;
+	MySQLBatchInserter &operator=(const MySQLBatchInserter &other) = delete;
+
+	MySQLBatchInserter &write(bool value);
+	MySQLBatchInserter &write(int32_t value) { return write((int64_t) value); }
+	MySQLBatchInserter &write(uint32_t value) { return write((uint64_t) value); }
+	MySQLBatchInserter &write(int64_t value);
+	MySQLBatchInserter &write(uint64_t value);
+	MySQLBatchInserter &write(float value) { return write((double) value); }
+	MySQLBatchInserter &write(double value);
+	MySQLBatchInserter &write(const char *value, size_t len);
+	MySQLBatchInserter &write(const char *value) { return write(value, strlen(value)); }
+	MySQLBatchInserter &write(const std::string &value)
+	{
+		return write(value.data(), value.size());
+	}
+
+	MySQLBatchInserter &write_null();
+	MySQLBatchInserter &write(std::nullptr_t) { return write_null(); }
+
+	/**
+	 * Close current row
+	 *
+	 * @throws MySQLException if sending previous rows failed or row alone exceeds
+	 * maximum statement size
+	 */
+	void end_row();
+
+	/**
+	 * Write a complete row
+	 */
+	template<typename... Args>
+	void write_row(const Args &... args)
+	{
+		// Expand write calls in order
+		int unused[] = {0, (write(args), 0)...};
+		(void) unused;
+		end_row();
+	}
+
+	/**
+	 * Send pending rows
+	 *
+	 * @throws MySQLException if INSERT failed
+	 */
+	void flush();
+
+	/**
+	 * Send pending rows
+	 *
+	 * @throws MySQLException if INSERT failed
+	 * @return number of inserted rows
+	 */
+	uint64_t end();
+
+	uint64_t get_row_count() const { return m_rows; }
+
+	size_t get_max_statement_size() const { return m_max_statement_size; }
+
+	/**
+	 * @return statement recording batches in query stats, INSERT prefix without rows
+	 */
+	const std::string &get_statement_name() const { return m_prefix; }
+
+private:
+	void begin_field();
+
+	MySQLClient &m_client;
+	std::string m_prefix = "";
+	size_t m_max_statement_size = 0;
+	std::string m_statement = "";
+	uint64_t m_statement_rows = 0;
+	std::string m_row = "";
+	uint32_t m_row_fields = 0;
+	uint64_t m_rows = 0;
+};
+
+/**
+ * Bulk loader using LOAD DATA LOCAL INFILE, rows are streamed from memory through a
+ * local infile handler, no file is written.
+ *
+ * Rows are buffered and sent by a LOAD DATA statement each time buffer_size is
+ * reached. Client must enable local infile, see MySQLClient::set_local_infile.
+ * Text values are read in the connection character set.
+ * Like any LOAD DATA LOCAL, invalid values are converted with a warning instead of
+ * failing the statement.
+ */
+class MySQLBulkLoader
+{
+public:
+	/**
+	 * @throws MySQLException if client doesn't allow local infile
+	 * @param client
+	 * @param table table name, not escaped
+	 * @param columns column names, not escaped. All table columns if empty
+	 * @param buffer_size
+	 */
+	MySQLBulkLoader(MySQLClient &client, const std::string &table,
+		const std::vector<std::string> &columns = {}, size_t buffer_size = 1024 * 1024);
+
+	MySQLBulkLoader() = delete;
+	MySQLBulkLoader(const MySQLBulkLoader &other) = delete;
+	MySQLBulkLoader &operator=(const MySQLBulkLoader &other) = delete;
+
+	MySQLBulkLoader &write(bool value) { return write((int64_t) (value ? 1 : 0)); }
+	MySQLBulkLoader &write(int32_t value) { return write((int64_t) value); }
+	MySQLBulkLoader &write(uint32_t value) { return write((uint64_t) value); }
+	MySQLBulkLoader &write(int64_t value);
+	MySQLBulkLoader &write(uint64_t value);
+	MySQLBulkLoader &write(float value) { return write((double) value); }
+	MySQLBulkLoader &write(double value);
+	MySQLBulkLoader &write(const char *value, size_t len);
+	MySQLBulkLoader &write(const char *value) { return write(value, strlen(value)); }
+	MySQLBulkLoader &write(const std::string &value)
+	{
+		return write(value.data(), value.size());
+	}
+
+	MySQLBulkLoader &write_null();
+	MySQLBulkLoader &write(std::nullptr_t) { return write_null(); }
+
+	/**
+	 * Close current row
+	 *
+	 * @throws MySQLException if row is empty or buffer flush failed
+	 */
+	void end_row();
+
+	/**
+	 * Write a complete row
+	 */
+	template<typename... Args>
+	void write_row(const Args &... args)
+	{
+		// Expand write calls in order
+		int unused[] = {0, (write(args), 0)...};
+		(void) unused;
+		end_row();
+	}
+
+	/**
+	 * Load buffered rows
+	 *
+	 * @throws MySQLException if LOAD DATA failed
+	 */
+	void flush();
+
+	/**
+	 * Load remaining rows
+	 *
+	 * @throws MySQLException if LOAD DATA failed
+	 * @return number of loaded rows
+	 */
+	uint64_t end();
+
+	uint64_t get_row_count() const { return m_rows; }
+
+private:
+	void begin_field();
+
+	static int infile_init(void **ptr, const char *filename, void *userdata);
+	static int infile_read(void *ptr, char *buf, unsigned int buf_len);
+	static void infile_end(void *ptr);
+	static int infile_error(void *ptr, char *error_msg, unsigned int error_msg_len);
+
+	MySQLClient &m_client;
+	std::string m_query = "";
+	size_t m_buffer_size = 0;
+	std::string m_buffer = "";
+	size_t m_read_offset = 0;
+	uint32_t m_row_fields = 0;
+	uint64_t m_rows = 0;
+};
+
+}
+}
@@ -27,10 +27,18 @@
 
 #include "core/utils/exception.h"
 #include "database.h"
+#include "querystats.h"
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <my_global.h>
 #include <mysql.h>
+#include "mysqlstatement.h"
 
 namespace winterwind
 {
@@ -48,6 +56,19 @@ public:
 	virtual ~MySQLException() throw() = default;
 };
 
+/**
+ * Unbuffered query result: rows are read from server one by one with next(), client
+ * memory doesn't grow with result size. Connection cannot run another query until
+ * all rows are read or result is destroyed.
+ *
+ * @code
+ * MySQLResult res = mysql.exec("SELECT id, name FROM users");
+ * while (res.next()) {
+ * 	int64_t id = res.get<int64_t>(0);
+ * 	std::string name = res.get<std::string>("name");
+ * }
+ * @endcode
+ */
 class MySQLResult
 {
 public:
@@ -61,8 +82,111 @@ public:
 	MySQLResult(MySQLResult &&other) noexcept;
 	MySQLResult(MySQLResult &other) = delete;
 	MySQLResult operator=(MySQLResult &other) = delete;
+
+	/**
+	 * Read next row from server
+	 *
+	 * @throws MySQLException if reading failed
+	 * @return false when all rows were read
+	 */
+	bool next();
+
+	size_t get_field_count() const { return m_field_count; }
+	const char *get_field_name(size_t col) const { return m_fields[col].name; }
+
+	/**
+	 * Column index for a field name, name map is built on first call
+	 *
+	 * @throws MySQLException if field doesn't exist
+	 * @param name
+	 * @return column index
+	 */
+	size_t get_field_index(const std::string &name) const;
+
+	/**
+	 * @return number of rows read by next()
+	 */
+	uint64_t get_row_count() const { return m_row_count; }
+
+	/**
+	 * @param col column index
+	 * @return true if column value is NULL on current row
+	 */
+	bool is_null(size_t col) const { return m_row[col] == nullptr; }
+
+	/**
+	 * Read current row column converted to T. NULL values return T().
+	 *
+	 * @tparam T integral, floating point or std::string
+	 * @param col column index
+	 * @return column value
+	 */
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, T>::type
+	get(size_t col) const
+	{
+		return is_null(col) ? T() : (std::is_unsigned<T>::value ?
+			(T) strtoull(m_row[col], NULL, 10) : (T) strtoll(m_row[col], NULL, 10));
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_same<T, bool>::value, T>::type get(size_t col) const
+	{
+		return get<int64_t>(col) != 0;
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_floating_point<T>::value, T>::type get(size_t col) const
+	{
+		return is_null(col) ? T() : (T) strtod(m_row[col], NULL);
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_same<T, std::string>::value, T>::type
+	get(size_t col) const
+	{
+		return is_null(col) ? T() : std::string(m_row[col], m_lengths[col]);
+	}
+
+	/**
+	 * Read current row column by name, see get(size_t)
+	 */
+	template<typename T>
+	T get(const std::string &name) const
+	{
+		return get<T>(get_field_index(name));
+	}
+
+	/**
+	 * Write remaining rows as a JSON array while reading them
+	 *
+	 * @throws MySQLException if reading failed
+	 * @param os destination stream
+	 * @param named_columns write rows as objects indexed by column names instead of
+	 * arrays
+	 */
+	void toJsonStream(std::ostream &os, bool named_columns = false);
+
+	/**
+	 * Write remaining rows as CSV (RFC 4180) while reading them. NULL values are
+	 * written as empty fields.
+	 *
+	 * @throws MySQLException if reading failed
+	 * @param os destination stream
+	 * @param header write column names as first line
+	 * @param separator
+	 */
+	void toCsvStream(std::ostream &os, bool header = true, char separator = ',');
+
 private:
+	MYSQL *m_conn = nullptr;
 	MYSQL_RES *m_result = nullptr;
+	MYSQL_FIELD *m_fields = nullptr;
+	size_t m_field_count = 0;
+	MYSQL_ROW m_row = nullptr;
+	unsigned long *m_lengths = nullptr;
+	uint64_t m_row_count = 0;
+	mutable std::unordered_map<std::string, size_t> m_field_indexes;
 };
 
 struct MySQLExplainEntry
@@ -81,6 +205,8 @@ struct MySQLExplainEntry
 
 class MySQLClient: private DatabaseInterface
 {
+	friend class MySQLBatchInserter;
+	friend class MySQLBulkLoader;
 public:
 	/**
 	 * Connect to a MySQL server
@@ -117,21 +243,89 @@ public:
 
 	/**
 	 * Verify is MySQL connection is working.
-	 * If connection is inactive and database is up, reconnects.
+	 * Connection is only pinged when it was idle for more than ping interval or
+	 * after a connection error, and reconnected if ping failed.
 	 *
 	 * @throws MySQLException
 	 */
 	void check_connection();
 
+	/**
+	 * Set idle time after which check_connection pings server
+	 *
+	 * @param interval 0 pings before each query
+	 */
+	void set_ping_interval(std::chrono::milliseconds interval) { m_ping_interval = interval; }
+
+	/**
+	 * Allow LOAD DATA LOCAL INFILE, used by MySQLBulkLoader. Client reconnects if
+	 * setting changes. Local files are never read: outside of a MySQLBulkLoader
+	 * load, server requests are refused.
+	 *
+	 * @throws MySQLException on reconnection failure
+	 * @param enable
+	 */
+	void set_local_infile(bool enable);
+
 	/**
 	 * Exec raw SQL query
 	 *
 	 * @throws MySQLException if query failed
 	 * @param query
+	 * @param statement name recorded in query stats, defaults to the normalized query
 	 * @return MySQLResult
 	 *
 	 */
-	MySQLResult exec(const std::string &query);
+	MySQLResult exec(const std::string &query, const std::string &statement = "");
+
+	/**
+	 * Prepare a statement on server. Statements are cached per connection, least
+	 * recently used ones are closed when cache capacity is reached, and all of them
+	 * on reconnection: a returned statement must not be kept.
+	 *
+	 * @throws MySQLException if preparation failed
+	 * @param query SQL with ? placeholders
+	 * @return prepared statement
+	 */
+	MySQLStatement &prepare(const std::string &query);
+
+	/**
+	 * Prepare (or reuse) a statement, bind its parameters and execute it
+	 *
+	 * @code
+	 * mysql.exec_prepared("INSERT INTO users (name, age) VALUES (?, ?)", "bob", 42);
+	 * @endcode
+	 *
+	 * @throws MySQLException if query failed
+	 * @param query SQL with ? placeholders
+	 * @param args parameters values
+	 * @return executed statement, ready to fetch rows
+	 */
+	template<typename... Args>
+	MySQLStatement &exec_prepared(const std::string &query, const Args &... args)
+	{
+		MySQLStatement &stmt = prepare(query);
+		stmt.bind(args...);
+		execute(stmt);
+		return stmt;
+	}
+
+	/**
+	 * Execute a statement with its bound parameters
+	 *
+	 * @throws MySQLException if query failed
+	 * @param stmt statement returned by prepare
+	 */
+	void execute(MySQLStatement &stmt);
+
+	/**
+	 * Set maximum number of cached prepared statements
+	 *
+	 * @param capacity
+	 */
+	void set_statements_capacity(size_t capacity);
+
+	size_t get_statements_count() const { return m_statements.size(); }
 
 	void list_tables(std::vector<std::string> &result);
 
@@ -139,6 +333,30 @@ public:
 
 	bool explain(const std::string &q, std::vector<MySQLExplainEntry> &res);
 
+	/**
+	 * Record statistics of queries executed by exec, tracked by their SQL string.
+	 * Row counts are only known for data modifications as results are not buffered.
+	 *
+	 * @param stats statistics, can be shared between clients, nullptr disables them
+	 */
+	void set_query_stats(const std::shared_ptr<DatabaseQueryStats> &stats)
+	{
+		m_query_stats = stats;
+	}
+
+	const std::shared_ptr<DatabaseQueryStats> &get_query_stats() const
+	{
+		return m_query_stats;
+	}
+
+	/**
+	 * Create a slow query explain function using explain() on a new connection with
+	 * this client credentials
+	 *
+	 * @return function for DatabaseQueryStats::set_explain_function
+	 */
+	DatabaseQueryStats::ExplainFunction create_explain_function() const;
+
 protected:
 	/**
 	 * Try to connect to MySQL database. If connection failed a MySQLException is thrown.
@@ -150,12 +368,49 @@ protected:
 	 */
 	void disconnect();
 private:
+	/**
+	 * Record query duration into query stats
+	 */
+	void track_query(const std::string &statement, const std::string &query,
+		const std::chrono::steady_clock::time_point &start, bool error, uint64_t rows,
+		bool explainable);
+
+	void evict_statement();
+
+	/**
+	 * Install local infile handler refusing server requests
+	 */
+	void reset_local_infile_handler();
+
+	/**
+	 * Track connection liveness after a query
+	 *
+	 * @param error query error code, 0 on success
+	 */
+	void on_query_done(unsigned int error);
+
 	MYSQL *m_conn = nullptr;
 	std::string m_host = "localhost";
 	std::string m_user = "";
 	std::string m_password = "";
 	std::string m_db = "";
 	uint16_t m_port = 3306;
+	std::chrono::milliseconds m_ping_interval = std::chrono::seconds(5);
+	// Last time server answered, reset to force a ping
+	std::chrono::steady_clock::time_point m_last_activity;
+	bool m_local_infile = false;
+	std::shared_ptr<DatabaseQueryStats> m_query_stats;
+
+	struct CachedStatement
+	{
+		std::unique_ptr<MySQLStatement> statement;
+		std::list<const std::string *>::iterator lru;
+	};
+
+	// Keyed by SQL string, LRU list references map keys, most recent first
+	std::unordered_map<std::string, CachedStatement> m_statements;
+	std::list<const std::string *> m_statements_lru;
+	size_t m_statements_capacity = 256;
 };
 }
 }
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <my_global.h>
+#include <mysql.h>
+
+namespace winterwind
+{
+namespace db
+{
+class MySQLClient;
+
+/**
+ * Server-side prepared statement with binary parameters & results.
+ *
+ * Statements are created by MySQLClient::prepare and cached per connection. Result
+ * buffers are allocated once per statement and reused by next executions; string
+ * buffers grow when a value doesn't fit.
+ *
+ * @code
+ * MySQLStatement &stmt = mysql.exec_prepared("SELECT id, name FROM users WHERE age > ?", 18);
+ * while (stmt.fetch()) {
+ * 	int64_t id = stmt.get<int64_t>(0);
+ * 	std::string name = stmt.get<std::string>(1);
+ * }
+ * @endcode
+ */
+class MySQLStatement
+{
+	friend class MySQLClient;
+public:
+	~MySQLStatement();
+
+	MySQLStatement(const MySQLStatement &other) = delete;
+	MySQLStatement &operator=(const MySQLStatement &other) = delete;
+
+	/**
+	 * Bind all statement parameters, in order
+	 *
+	 * @throws MySQLException if arguments count doesn't match statement parameters
+	 * @param args parameters values, nullptr binds NULL
+	 */
+	template<typename... Args>
+	void bind(const Args &... args)
+	{
+		if (sizeof...(args) != m_params.size()) {
+			throw_param_count(sizeof...(args));
+		}
+
+		bind_params(0, args...);
+	}
+
+	void bind_param(size_t idx, std::nullptr_t);
+	void bind_param(size_t idx, const std::string &value);
+	void bind_param(size_t idx, const char *value);
+	void bind_param(size_t idx, bool value);
+	void bind_param(size_t idx, double value);
+	void bind_param(size_t idx, float value) { bind_param(idx, (double) value); }
+
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value>::type
+	bind_param(size_t idx, T value)
+	{
+		bind_integer(idx, (int64_t) value, std::is_unsigned<T>::value);
+	}
+
+	/**
+	 * Execute statement with bound parameters. Result rows are fetched into client
+	 * memory, connection can be used while they are read.
+	 *
+	 * @throws MySQLException
+	 */
+	void execute();
+
+	/**
+	 * Read next result row
+	 *
+	 * @throws MySQLException
+	 * @return false when there is no more rows
+	 */
+	bool fetch();
+
+	/**
+	 * @param col column index
+	 * @return true if column value is NULL on current row
+	 */
+	bool is_null(size_t col) const { return m_results[col].is_null != 0; }
+
+	/**
+	 * Read current row column converted to T. NULL values return T().
+	 *
+	 * @tparam T integral, floating point or std::string
+	 * @param col column index
+	 * @return column value
+	 */
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, T>::type
+	get(size_t col) const
+	{
+		return (T) get_int64(col);
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_same<T, bool>::value, T>::type get(size_t col) const
+	{
+		return get_int64(col) != 0;
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_floating_point<T>::value, T>::type get(size_t col) const
+	{
+		return (T) get_double(col);
+	}
+
+	template<typename T>
+	typename std::enable_if<std::is_same<T, std::string>::value, T>::type
+	get(size_t col) const
+	{
+		return get_string(col);
+	}
+
+	const std::string &get_query() const { return m_query; }
+	size_t get_param_count() const { return m_params.size(); }
+	size_t get_field_count() const { return m_results.size(); }
+	const char *get_field_name(size_t col) const;
+
+	/**
+	 * @return rows returned by SELECT or affected by last execution
+	 */
+	uint64_t get_row_count() const { return m_row_count; }
+	uint64_t get_insert_id() const { return mysql_stmt_insert_id(m_stmt); }
+
+private:
+	/**
+	 * Prepare query on connection
+	 *
+	 * @throws MySQLException
+	 */
+	MySQLStatement(MYSQL *conn, const std::string &query);
+
+	void bind_params(size_t) {}
+
+	template<typename T, typename... Args>
+	void bind_params(size_t idx, const T &value, const Args &... args)
+	{
+		bind_param(idx, value);
+		bind_params(idx + 1, args...);
+	}
+
+	MYSQL_BIND &reset_param(size_t idx);
+	void bind_integer(size_t idx, int64_t value, bool is_unsigned);
+	void throw_param_count(size_t count) const;
+	void throw_error(const std::string &action) const;
+	void bind_results();
+
+	int64_t get_int64(size_t col) const;
+	double get_double(size_t col) const;
+	std::string get_string(size_t col) const;
+
+	struct Param
+	{
+		union
+		{
+			int64_t integer;
+			double real;
+		};
+		std::string string;
+		my_bool is_null = 0;
+		unsigned long length = 0;
+	};
+
+	struct Result
+	{
+		enum_field_types type;
+		bool is_unsigned = false;
+		int64_t integer = 0;
+		double real = 0;
+		std::vector<char> string;
+		my_bool is_null = 0;
+		my_bool error = 0;
+		unsigned long length = 0;
+	};
+
+	MYSQL_STMT *m_stmt = nullptr;
+	std::string m_query;
+	uint64_t m_row_count = 0;
+
+	std::vector<Param> m_params;
+	std::vector<MYSQL_BIND> m_param_binds;
+
+	MYSQL_RES *m_metadata = nullptr;
+	std::vector<Result> m_results;
+	std::vector<MYSQL_BIND> m_result_binds;
+};
+
+}
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include "core/utils/threads.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace winterwind
+{
+namespace db
+{
+
+/**
+ * Non blocking PostgreSQL client.
+ *
+ * Queries are queued from any thread and dispatched by an event loop thread over a
+ * set of connections, each connection running one query at a time. Results are
+ * returned through callbacks, called from the event loop thread, or futures.
+ * Queries queued once the client is stopping fail immediately.
+ *
+ * Broken connections are reset and their statements prepared again without blocking
+ * the event loop.
+ *
+ * @code
+ * PostgreSQLAsyncClient pg(connect_string, 8);
+ * pg.start();
+ * std::future<PostgreSQLResult> f = pg.exec("SELECT 1");
+ * PostgreSQLResult res = f.get();
+ * @endcode
+ */
+class PostgreSQLAsyncClient : public Thread
+{
+public:
+	/**
+	 * Query callback. On error, result is nullptr and error contains the error message
+	 */
+	typedef std::function<void(PostgreSQLResult *result, const std::string &error)>
+		QueryCallback;
+
+	/**
+	 * Open connections to database
+	 *
+	 * @throws PostgreSQLException if a connection failed
+	 * @param connect_string
+	 * @param connections number of connections, which is the number of concurrent queries
+	 * @param minimum_db_version
+	 */
+	PostgreSQLAsyncClient(const std::string &connect_string, uint16_t connections = 4,
+		int32_t minimum_db_version = 90500);
+
+	PostgreSQLAsyncClient() = delete;
+
+	/**
+	 * Stop the event loop, pending queries are failed
+	 */
+	~PostgreSQLAsyncClient() override;
+
+	void *run() override;
+
+	void stop() override;
+
+	/**
+	 * Register a statement on all connections. Must be called before start()
+	 *
+	 * @throws PostgreSQLException if event loop is running or statement is invalid
+	 * @param stn statement name
+	 * @param st statement value
+	 */
+	void register_statement(const std::string &stn, const std::string &st);
+
+	/**
+	 * Queue a query
+	 *
+	 * @param query SQL string
+	 * @param params query parameters ($1, $2...), in text format
+	 * @param callback
+	 * @param binary_results request results in binary format
+	 */
+	void exec(const std::string &query, const std::vector<std::string> &params,
+		const QueryCallback &callback, bool binary_results = false);
+
+	/**
+	 * Queue a query
+	 *
+	 * @param query SQL string
+	 * @param params query parameters ($1, $2...), in text format
+	 * @param binary_results request results in binary format
+	 * @return future result, throwing PostgreSQLException if query failed
+	 */
+	std::future<PostgreSQLResult> exec(const std::string &query,
+		const std::vector<std::string> &params = {}, bool binary_results = false);
+
+	/**
+	 * Queue a prepared statement execution
+	 *
+	 * @param stn statement name, registered with register_statement
+	 * @param params statement parameters, in text format
+	 * @param callback
+	 * @param binary_results request results in binary format
+	 */
+	void exec_prepared(const std::string &stn, const std::vector<std::string> &params,
+		const QueryCallback &callback, bool binary_results = false);
+
+	/**
+	 * Queue a prepared statement execution
+	 *
+	 * @param stn statement name, registered with register_statement
+	 * @param params statement parameters, in text format
+	 * @param binary_results request results in binary format
+	 * @return future result, throwing PostgreSQLException if query failed
+	 */
+	std::future<PostgreSQLResult> exec_prepared(const std::string &stn,
+		const std::vector<std::string> &params = {}, bool binary_results = false);
+
+	/**
+	 * @return number of queued and running queries
+	 */
+	size_t pending_queries() const { return m_pending; }
+
+private:
+	struct Query
+	{
+		std::string query;
+		bool prepared;
+		std::vector<std::string> params;
+		bool binary_results;
+		QueryCallback callback;
+	};
+
+	enum ConnectionState : uint8_t
+	{
+		STATE_READY,
+		STATE_RESETTING,
+		STATE_PREPARING,
+		STATE_BROKEN,
+	};
+
+	struct Connection
+	{
+		std::unique_ptr<PostgreSQLClient> client;
+		std::unique_ptr<Query> query;
+		PGresult *result = nullptr;
+		bool want_write = false;
+		ConnectionState state = STATE_READY;
+		// PQresetPoll status, tells which socket event the reset waits for
+		PostgresPollingStatusType reset_status = PGRES_POLLING_WRITING;
+		std::chrono::steady_clock::time_point reset_time;
+		// Next statement to prepare after a reset
+		std::unordered_map<std::string, std::string>::const_iterator statement;
+	};
+
+	void enqueue(std::unique_ptr<Query> query);
+	std::future<PostgreSQLResult> enqueue_future(std::unique_ptr<Query> query);
+	void wakeup();
+	void dispatch();
+	void send(Connection &c, std::unique_ptr<Query> query);
+	void flush(Connection &c);
+	void handle_input(Connection &c);
+	void complete(Connection &c);
+	void connection_failed(Connection &c);
+	void start_reset(Connection &c);
+	void poll_reset(Connection &c);
+	void reset_failed(Connection &c);
+	void prepare_next(Connection &c);
+	void handle_prepare_input(Connection &c);
+	void fail_queue(const std::string &error);
+	void notify(const Query &query, PostgreSQLResult *result, const std::string &error);
+
+	std::vector<std::unique_ptr<Connection>> m_connections;
+
+	std::mutex m_queue_mutex;
+	std::deque<std::unique_ptr<Query>> m_queue;
+	std::atomic<size_t> m_pending;
+
+	int m_wakeup_pipe[2] = {-1, -1};
+};
+
+}
+}
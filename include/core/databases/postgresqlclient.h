@@ -26,8 +26,17 @@
 #pragma once
 
 #include "database.h"
+#include "postgresqltypes.h"
+#include "querystats.h"
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <ostream>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <json/json.h>
 
@@ -47,6 +56,99 @@ public:
 	~PostgreSQLException() throw() {}
 };
 
+/**
+ * Map result rows to Row type. Rows are decoded as a std::tuple of Columns types,
+ * then converted by map. Specialize it to map rows to custom types:
+ *
+ * @code
+ * template<> struct PostgreSQLRowMapper<User>
+ * {
+ * 	typedef std::tuple<int64_t, std::string> Columns;
+ * 	static User map(Columns &&c) { return User{std::get<0>(c), std::move(std::get<1>(c))}; }
+ * };
+ * @endcode
+ */
+template<typename Row> struct PostgreSQLRowMapper;
+
+template<typename... Ts> struct PostgreSQLRowMapper<std::tuple<Ts...>>
+{
+	typedef std::tuple<Ts...> Columns;
+	static std::tuple<Ts...> map(Columns &&c) { return std::move(c); }
+};
+
+/**
+ * Decode result rows to std::tuple. Column decoders are resolved once, at
+ * construction.
+ */
+template<typename Columns> class PostgreSQLRowDecoder;
+
+template<typename... Ts>
+class PostgreSQLRowDecoder<std::tuple<Ts...>>
+{
+public:
+	/**
+	 * @throws PostgreSQLException if result columns cannot be converted to Ts
+	 * @param result
+	 */
+	explicit PostgreSQLRowDecoder(const PGresult *result): m_result(result)
+	{
+		if (PQnfields(result) < (int) sizeof...(Ts)) {
+			throw PostgreSQLException("PostgreSQL: result has "
+				+ std::to_string(PQnfields(result)) + " columns, "
+				+ std::to_string(sizeof...(Ts)) + " expected");
+		}
+
+		resolve(std::index_sequence_for<Ts...>());
+	}
+
+	std::tuple<Ts...> decode(int row) const
+	{
+		return decode(row, std::index_sequence_for<Ts...>());
+	}
+
+private:
+	template<size_t I>
+	using ColumnType = typename std::tuple_element<I, std::tuple<Ts...>>::type;
+
+	template<size_t... I>
+	void resolve(std::index_sequence<I...>)
+	{
+		int unused[] = {0, (resolve_column<I>(), 0)...};
+		(void) unused;
+	}
+
+	template<size_t I>
+	void resolve_column()
+	{
+		std::get<I>(m_decoders) = PostgreSQLDecoder<ColumnType<I>>::resolve(
+			PQftype(m_result, I), PQfformat(m_result, I));
+		if (!std::get<I>(m_decoders)) {
+			throw PostgreSQLException(std::string("PostgreSQL: unsupported conversion for "
+				"column ") + PQfname(m_result, I));
+		}
+	}
+
+	template<size_t... I>
+	std::tuple<Ts...> decode(int row, std::index_sequence<I...>) const
+	{
+		return std::tuple<Ts...>(decode_column<I>(row)...);
+	}
+
+	template<size_t I>
+	ColumnType<I> decode_column(int row) const
+	{
+		if (PQgetisnull(m_result, row, I)) {
+			return ColumnType<I>();
+		}
+
+		return std::get<I>(m_decoders)(PQgetvalue(m_result, row, I),
+			PQgetlength(m_result, row, I));
+	}
+
+	const PGresult *m_result;
+	std::tuple<typename PostgreSQLDecoder<Ts>::Func...> m_decoders;
+};
+
 /**
  * RAII class for PostgreSQL results
  */
@@ -84,11 +186,61 @@ public:
 	 * Pointer to PGresult
 	 * @return m_result
 	 */
-	PGresult *operator*() { return m_result; }
+	PGresult *operator*() const { return m_result; }
 	ExecStatusType get_status() const { return m_status; }
 
+	/**
+	 * @param row
+	 * @param col
+	 * @return true if field is NULL
+	 */
+	bool is_null(int row, int col) const { return PQgetisnull(m_result, row, col) == 1; }
+
+	/**
+	 * Read field for row and col with type T. Text and binary results are supported,
+	 * see PostgreSQLDecoder for supported types.
+	 *
+	 * @throws PostgreSQLException if column type cannot be converted to T
+	 * @tparam T destination type
+	 * @param row
+	 * @param col
+	 * @return field value, or T() if field is NULL
+	 */
+	template<typename T> T get(int row, int col) const;
+
+	/**
+	 * Decode all rows to Row type, see PostgreSQLRowMapper
+	 *
+	 * @throws PostgreSQLException if columns cannot be converted
+	 * @tparam Row destination type, std::tuple or type with a PostgreSQLRowMapper
+	 * @return rows
+	 */
+	template<typename Row> std::vector<Row> rows() const;
+
 	void toJson(Json::Value &res);
+
+	/**
+	 * Serialize result to JSON directly from PGresult, with the same document
+	 * layout as toJson
+	 *
+	 * @param res destination string, result is appended
+	 * @param named_columns write rows as objects indexed by column names instead of
+	 * arrays
+	 */
+	void toJsonString(std::string &res, bool named_columns = false) const;
+
+	/**
+	 * Serialize result to JSON directly from PGresult, see toJsonString
+	 *
+	 * @param os destination stream
+	 * @param named_columns write rows as objects indexed by column names instead of
+	 * arrays
+	 */
+	void toJsonStream(std::ostream &os, bool named_columns = false) const;
 private:
+	void write_json(std::string &buf, const std::function<void(std::string &)> &flush,
+		bool named_columns) const;
+
 	PGresult *m_result = nullptr;
 	ExecStatusType m_status = PGRES_COMMAND_OK;
 };
@@ -102,12 +254,129 @@ struct PostgreSQLTableDefinition
 	std::unordered_map<std::string, std::string> indexes;
 };
 
+/**
+ * Query parameters, converted to text format
+ */
+class PostgreSQLParams
+{
+public:
+	PostgreSQLParams() = default;
+
+	template<typename... Args>
+	explicit PostgreSQLParams(const Args &... args)
+	{
+		int unused[] = {0, (add(args), 0)...};
+		(void) unused;
+	}
+
+	PostgreSQLParams &add(const std::string &value)
+	{
+		m_params.push_back(value);
+		m_nulls.push_back(false);
+		return *this;
+	}
+
+	PostgreSQLParams &add(const char *value)
+	{
+		return value ? add(std::string(value)) : add(nullptr);
+	}
+
+	PostgreSQLParams &add(std::nullptr_t)
+	{
+		m_params.emplace_back();
+		m_nulls.push_back(true);
+		return *this;
+	}
+
+	PostgreSQLParams &add(bool value) { return add(std::string(value ? "t" : "f")); }
+
+	PostgreSQLParams &add(double value)
+	{
+		// Keep full precision
+		char buf[32];
+		int len = snprintf(buf, sizeof(buf), "%.17g", value);
+		return add(std::string(buf, (size_t) len));
+	}
+
+	PostgreSQLParams &add(float value) { return add((double) value); }
+
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value, PostgreSQLParams &>::type add(T value)
+	{
+		return add(std::to_string(value));
+	}
+
+	int size() const { return (int) m_params.size(); }
+
+	const std::string &get_value(int i) const { return m_params[i]; }
+
+	bool is_null(int i) const { return m_nulls[i]; }
+
+	/**
+	 * @return parameter values for libpq, valid until next add call
+	 */
+	const char **values()
+	{
+		m_values.resize(m_params.size());
+		for (size_t i = 0; i < m_params.size(); i++) {
+			m_values[i] = m_nulls[i] ? nullptr : m_params[i].c_str();
+		}
+		return m_values.data();
+	}
+
+private:
+	std::vector<std::string> m_params;
+	std::vector<bool> m_nulls;
+	std::vector<const char *> m_values;
+};
+
+/**
+ * Ordered list of prepared statement executions, sent together by
+ * PostgreSQLClient::exec_batch
+ */
+class PostgreSQLBatch
+{
+	friend class PostgreSQLClient;
+public:
+	/**
+	 * Queue a prepared statement execution
+	 *
+	 * @param statement registered statement name
+	 * @param params statement parameters, in text format
+	 * @return batch object
+	 */
+	PostgreSQLBatch &add(const std::string &statement,
+		const std::vector<std::string> &params = {})
+	{
+		m_queries.push_back({statement, params});
+		return *this;
+	}
+
+	size_t size() const { return m_queries.size(); }
+	bool empty() const { return m_queries.empty(); }
+	void clear() { m_queries.clear(); }
+
+private:
+	struct Query
+	{
+		std::string statement;
+		std::vector<std::string> params;
+	};
+
+	std::vector<Query> m_queries;
+};
+
 /**
  * PostgreSQL client
  */
 class PostgreSQLClient: private DatabaseInterface
 {
 	friend class PostgreSQLResult;
+	friend class PostgreSQLCopyWriter;
+	friend class PostgreSQLCopyReader;
+	friend class PostgreSQLResultStream;
+	friend class PostgreSQLAsyncClient;
+	friend class PostgreSQLListener;
 public:
 	/**
 	 * Construct PostgreSQL client and connect
@@ -143,9 +412,114 @@ public:
 	 * Execute a raw query and return a PostgreSQLResult
 	 *
 	 * @param query SQL string
+	 * @param binary_results request results in binary format
 	 * @return PostgreSQLResult object
 	 */
-	PostgreSQLResult exec(const char *query);
+	PostgreSQLResult exec(const char *query, bool binary_results = false);
+
+	/**
+	 * Execute a registered statement and decode result rows to Row type
+	 *
+	 * @code
+	 * auto items = pg.query<std::tuple<int64_t, std::string, double>>("get_items", 42);
+	 * @endcode
+	 *
+	 * @throws PostgreSQLException if query failed or columns cannot be converted
+	 * @tparam Row destination type, std::tuple or type with a PostgreSQLRowMapper
+	 * @param stn statement name
+	 * @param args statement parameters
+	 * @return rows
+	 */
+	template<typename Row, typename... Args>
+	std::vector<Row> query(const std::string &stn, const Args &... args)
+	{
+		PostgreSQLParams params(args...);
+		PostgreSQLResult result = exec_prepared(stn.c_str(), params.size(),
+			params.values());
+		return result.rows<Row>();
+	}
+
+	/**
+	 * Execute a registered statement
+	 *
+	 * @throws PostgreSQLException if query failed
+	 * @param stn statement name
+	 * @param params statement parameters
+	 * @param binary_results request results in binary format
+	 * @return PostgreSQLResult object
+	 */
+	PostgreSQLResult exec_statement(const std::string &stn, PostgreSQLParams &params,
+		bool binary_results = false)
+	{
+		return exec_prepared(stn.c_str(), params.size(), params.values(), NULL, NULL,
+			binary_results);
+	}
+
+	/**
+	 * Execute a parameterized query. Query is transparently prepared on first use and
+	 * kept in a per-connection LRU cache of prepared statements.
+	 *
+	 * @code
+	 * pg.exec_params("SELECT name FROM users WHERE id = $1 AND active = $2", 42, true);
+	 * @endcode
+	 *
+	 * @throws PostgreSQLException if query failed
+	 * @param sql SQL string with $1, $2... placeholders
+	 * @param args query parameters
+	 * @return PostgreSQLResult object
+	 */
+	template<typename... Args>
+	PostgreSQLResult exec_params(const std::string &sql, const Args &... args)
+	{
+		PostgreSQLParams params(args...);
+		return exec_params(sql, params);
+	}
+
+	/**
+	 * Execute a parameterized query, see exec_params above
+	 *
+	 * @throws PostgreSQLException if query failed
+	 * @param sql SQL string with $1, $2... placeholders
+	 * @param params query parameters
+	 * @param binary_results request results in binary format
+	 * @return PostgreSQLResult object
+	 */
+	PostgreSQLResult exec_params(const std::string &sql, PostgreSQLParams &params,
+		bool binary_results = false);
+
+	/**
+	 * Send a notification to channel listeners
+	 *
+	 * @throws PostgreSQLException
+	 * @param channel
+	 * @param payload
+	 */
+	void notify(const std::string &channel, const std::string &payload = "");
+
+	/**
+	 * Set maximum number of statements prepared by exec_params. Least recently used
+	 * statements are deallocated when capacity is reached.
+	 *
+	 * @param capacity
+	 */
+	void set_auto_statements_capacity(size_t capacity);
+
+	size_t get_auto_statements_count() const { return m_auto_statements.size(); }
+
+	/**
+	 * Execute all batch queries and return their results in the same order.
+	 * With libpq pipeline mode all queries are sent without waiting for previous
+	 * results, otherwise they are executed one by one.
+	 * Outside of a transaction, the batch is atomic: if one query fails, none of
+	 * them is applied.
+	 *
+	 * @throws PostgreSQLException if a query failed, once all results are read
+	 * @param batch queries to execute
+	 * @param binary_results request results in binary format
+	 * @return query results
+	 */
+	std::vector<PostgreSQLResult> exec_batch(const PostgreSQLBatch &batch,
+		bool binary_results = false);
 
 	/**
 	 * Register a statement with a name
@@ -206,7 +580,46 @@ public:
 
 	void escape_string(const std::string &param, std::string &res);
 
-protected:
+	/**
+	 * Record statistics of queries executed by exec, exec_params & prepared statements.
+	 * Unprepared queries are tracked by their SQL string, prepared ones by statement
+	 * name.
+	 *
+	 * @param stats statistics, can be shared between clients, nullptr disables them
+	 */
+	void set_query_stats(const std::shared_ptr<DatabaseQueryStats> &stats)
+	{
+		m_query_stats = stats;
+	}
+
+	const std::shared_ptr<DatabaseQueryStats> &get_query_stats() const
+	{
+		return m_query_stats;
+	}
+
+	/**
+	 * Create a slow query explain function with its own connection. Read-only queries
+	 * are explained with EXPLAIN (ANALYZE, BUFFERS), others with EXPLAIN only as
+	 * ANALYZE executes the query.
+	 *
+	 * @param connect_string
+	 * @return function for DatabaseQueryStats::set_explain_function
+	 */
+	static DatabaseQueryStats::ExplainFunction create_explain_function(
+		const std::string &connect_string);
+
+	/**
+	 * @return true if a transaction is running
+	 */
+	bool in_transaction() const { return PQtransactionStatus(m_conn) != PQTRANS_IDLE; }
+
+	/**
+	 * @return true if connection is established, without checking server
+	 */
+	bool is_connected() const { return PQstatus(m_conn) == CONNECTION_OK; }
+
+	int32_t get_server_version() const { return m_pgversion; }
+
 	/**
 	 * Verify is PostgreSQL connection is working.
 	 * If connection is inactive and database is up, reconnects.
@@ -215,6 +628,7 @@ protected:
 	 */
 	void check_connection();
 
+protected:
 	void set_client_encoding(const std::string &encoding);
 
 	/**
@@ -225,11 +639,15 @@ protected:
 	 * @param colconst
 	 * @return PostgreSQL result for row and col converted to T type
 	 */
-	template<typename T> T read_field(PostgreSQLResult &res, int row, int col);
+	template<typename T> T read_field(PostgreSQLResult &res, int row, int col)
+	{
+		return res.get<T>(row, col);
+	}
 
 	/**
 	 * Exec a previously prepared query (stmtName)
-	 * paramsNumber, params, paramsLenghts, paramsFormats & nobinary refers to:
+	 * paramsNumber, params, paramsLenghts, paramsFormats & binary_results (resultFormat)
+	 * refers to:
 	 * https://www.postgresql.org/docs/9.6/static/libpq-exec.html (see PQExecPrepared)
 	 *
 	 * @param stmtName
@@ -237,12 +655,12 @@ protected:
 	 * @param params
 	 * @param paramsLengths
 	 * @param paramsFormats
-	 * @param nobinary
+	 * @param binary_results request results in binary format
 	 * @return PostgreSQLResult object
 	 */
 	PostgreSQLResult exec_prepared(const char *stmtName, const int paramsNumber,
 		const char **params, const int *paramsLengths = NULL,
-		const int *paramsFormats = NULL, bool nobinary = true);
+		const int *paramsFormats = NULL, bool binary_results = true);
 
 	/**
 	 * Connects to database using m_connect_string
@@ -255,12 +673,94 @@ protected:
 	void disconnect();
 
 private:
+#ifdef LIBPQ_HAS_PIPELINING
+	/**
+	 * Send all batch queries using pipeline mode, returns raw results
+	 */
+	void exec_pipeline(const PostgreSQLBatch &batch, bool binary_results,
+		std::vector<PGresult *> &results);
+#endif
+
 	std::string m_connect_string = "";
 	PGconn *m_conn = nullptr;
 	int32_t m_pgversion = 0;
 	int32_t m_min_pgversion = 0;
 
+	/**
+	 * Prepare sql if not already done, returns its statement name
+	 */
+	std::string prepare_auto_statement(const std::string &sql);
+
+	void evict_auto_statement();
+
+	/**
+	 * Reset connection and restore its session state
+	 *
+	 * @throws PostgreSQLException if reconnection failed
+	 */
+	void reset();
+
+	/**
+	 * Restore session state lost with the server connection
+	 */
+	void on_reconnect();
+
+	/**
+	 * Record query result & duration into query stats
+	 */
+	void track_query(const PGresult *result,
+		const std::chrono::steady_clock::time_point &start, const char *statement,
+		const char *query, int params_count, const char *const *params,
+		const int *params_formats);
+
+	std::shared_ptr<DatabaseQueryStats> m_query_stats;
+
 	std::unordered_map<std::string, std::string> m_statements;
+
+	struct AutoStatement
+	{
+		std::string name;
+		std::list<const std::string *>::iterator lru;
+	};
+
+	// Keyed by SQL string, LRU list references map keys, most recent first
+	std::unordered_map<std::string, AutoStatement> m_auto_statements;
+	std::list<const std::string *> m_auto_statements_lru;
+	size_t m_auto_statements_capacity = 256;
+	uint64_t m_auto_statement_id = 0;
 };
+
+template<typename T>
+T PostgreSQLResult::get(int row, int col) const
+{
+	if (is_null(row, col)) {
+		return T();
+	}
+
+	typename PostgreSQLDecoder<T>::Func decoder = PostgreSQLDecoder<T>::resolve(
+		PQftype(m_result, col), PQfformat(m_result, col));
+	if (!decoder) {
+		throw PostgreSQLException(std::string("PostgreSQL: unsupported conversion for "
+			"column ") + PQfname(m_result, col));
+	}
+
+	return decoder(PQgetvalue(m_result, row, col), PQgetlength(m_result, row, col));
+}
+
+template<typename Row>
+std::vector<Row> PostgreSQLResult::rows() const
+{
+	typedef PostgreSQLRowMapper<Row> Mapper;
+	PostgreSQLRowDecoder<typename Mapper::Columns> decoder(m_result);
+
+	const int count = PQntuples(m_result);
+	std::vector<Row> res;
+	res.reserve((size_t) count);
+	for (int row = 0; row < count; row++) {
+		res.push_back(Mapper::map(decoder.decode(row)));
+	}
+
+	return res;
+}
 }
 }
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+
+enum PostgreSQLCopyFormat
+{
+	PG_COPY_TEXT,
+	PG_COPY_BINARY,
+};
+
+/**
+ * Bulk loader using COPY ... FROM STDIN.
+ *
+ * Fields are written one by one, then the row is closed with end_row(). Data is
+ * buffered and sent to the server by chunks of buffer_size bytes.
+ * With binary format, written C++ types must match exactly the column types
+ * (ex: int64_t for bigint columns).
+ *
+ * The client connection cannot be used for other queries until end() or abort().
+ */
+class PostgreSQLCopyWriter
+{
+public:
+	/**
+	 * Start COPY table (columns) FROM STDIN
+	 *
+	 * @throws PostgreSQLException if COPY cannot be started
+	 * @param client
+	 * @param table table name, not escaped
+	 * @param columns column names, not escaped. All table columns if empty
+	 * @param format
+	 * @param buffer_size
+	 */
+	PostgreSQLCopyWriter(PostgreSQLClient &client, const std::string &table,
+		const std::vector<std::string> &columns = {},
+		PostgreSQLCopyFormat format = PG_COPY_TEXT, size_t buffer_size = 64 * 1024);
+
+	PostgreSQLCopyWriter() = delete;
+	PostgreSQLCopyWriter(const PostgreSQLCopyWriter &other) = delete;
+	PostgreSQLCopyWriter &operator=(const PostgreSQLCopyWriter &other) = delete;
+
+	/**
+	 * Aborts COPY if end() was not called
+	 */
+	~PostgreSQLCopyWriter();
+
+	PostgreSQLCopyWriter &write(bool value);
+	PostgreSQLCopyWriter &write(int16_t value);
+	PostgreSQLCopyWriter &write(int32_t value);
+	PostgreSQLCopyWriter &write(int64_t value);
+	PostgreSQLCopyWriter &write(float value);
+	PostgreSQLCopyWriter &write(double value);
+	PostgreSQLCopyWriter &write(const char *value, size_t len);
+	PostgreSQLCopyWriter &write(const char *value) { return write(value, strlen(value)); }
+	PostgreSQLCopyWriter &write(const std::string &value)
+	{
+		return write(value.data(), value.size());
+	}
+
+	PostgreSQLCopyWriter &write_null();
+
+	/**
+	 * Close current row
+	 *
+	 * @throws PostgreSQLException if buffer flush failed
+	 */
+	void end_row();
+
+	/**
+	 * Write a complete row
+	 */
+	template<typename... Args>
+	void write_row(const Args &... args)
+	{
+		// Expand write calls in order
+		int unused[] = {0, (write(args), 0)...};
+		(void) unused;
+		end_row();
+	}
+
+	/**
+	 * Send remaining data and terminate COPY
+	 *
+	 * @throws PostgreSQLException if COPY failed
+	 * @return number of copied rows
+	 */
+	uint64_t end();
+
+	/**
+	 * Cancel COPY, no row is inserted
+	 *
+	 * @param reason error message reported to the server
+	 */
+	void abort(const std::string &reason = "COPY aborted by client");
+
+	uint64_t get_row_count() const { return m_rows; }
+
+private:
+	void begin_field();
+	void write_binary_field(const char *data, int32_t len);
+	void write_text_escaped(const char *data, size_t len);
+	void flush();
+
+	PGconn *m_conn = nullptr;
+	PostgreSQLCopyFormat m_format = PG_COPY_TEXT;
+	size_t m_buffer_size = 0;
+	std::string m_buffer = "";
+	size_t m_row_start = 0;
+	int16_t m_row_fields = 0;
+	uint64_t m_rows = 0;
+	bool m_running = false;
+};
+
+/**
+ * Row reader using COPY (query) TO STDOUT.
+ *
+ * Rows are read one by one, whole result is never loaded in memory.
+ * The client connection cannot be used for other queries until all rows are read.
+ */
+class PostgreSQLCopyReader
+{
+public:
+	/**
+	 * Start COPY (query) TO STDOUT
+	 *
+	 * @throws PostgreSQLException if COPY cannot be started
+	 * @param client
+	 * @param query SELECT query
+	 * @param format
+	 */
+	PostgreSQLCopyReader(PostgreSQLClient &client, const std::string &query,
+		PostgreSQLCopyFormat format = PG_COPY_TEXT);
+
+	PostgreSQLCopyReader() = delete;
+	PostgreSQLCopyReader(const PostgreSQLCopyReader &other) = delete;
+	PostgreSQLCopyReader &operator=(const PostgreSQLCopyReader &other) = delete;
+
+	/**
+	 * Discard unread rows
+	 */
+	~PostgreSQLCopyReader();
+
+	/**
+	 * Read next row
+	 *
+	 * @throws PostgreSQLException if COPY failed
+	 * @return false when there is no more rows
+	 */
+	bool next();
+
+	size_t get_field_count() const { return m_fields.size(); }
+
+	bool is_null(size_t field) const { return m_fields[field].len < 0; }
+
+	/**
+	 * Read field with type T. Binary COPY doesn't carry types, binary fields require
+	 * their column type OID.
+	 *
+	 * @throws PostgreSQLException if conversion is not supported
+	 * @param field field index
+	 * @param type column type OID
+	 * @return field value, or T() if field is NULL
+	 */
+	template<typename T>
+	T get(size_t field, Oid type = PG_TEXTOID) const
+	{
+		if (is_null(field)) {
+			return T();
+		}
+
+		typename PostgreSQLDecoder<T>::Func decoder = PostgreSQLDecoder<T>::resolve(type,
+			m_format == PG_COPY_BINARY ? 1 : 0);
+		if (!decoder) {
+			throw PostgreSQLException("PostgreSQL COPY: unsupported conversion for "
+				"field " + std::to_string(field));
+		}
+
+		return decoder(m_fields[field].data, m_fields[field].len);
+	}
+
+	/**
+	 * Read all remaining rows and call callback for each one
+	 *
+	 * @throws PostgreSQLException if COPY failed
+	 * @param callback
+	 * @return number of rows read
+	 */
+	uint64_t read_all(const std::function<void(const PostgreSQLCopyReader &)> &callback);
+
+	uint64_t get_row_count() const { return m_rows; }
+
+private:
+	struct Field
+	{
+		const char *data;
+		int len;
+	};
+
+	void parse_text_row(const char *row, int len);
+	bool parse_binary_row(const char *row, int len);
+	void finish();
+
+	PGconn *m_conn = nullptr;
+	PostgreSQLCopyFormat m_format = PG_COPY_TEXT;
+	char *m_row = nullptr;
+	std::vector<Field> m_fields;
+	std::vector<std::string> m_text_fields;
+	uint64_t m_rows = 0;
+	bool m_header_read = false;
+	bool m_running = false;
+};
+
+}
+}
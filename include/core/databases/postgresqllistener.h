@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include "core/utils/threads.h"
+#include "core/utils/threadsafequeue.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace winterwind
+{
+namespace db
+{
+
+struct PostgreSQLNotification
+{
+	std::string channel;
+	std::string payload;
+	int32_t backend_pid;
+};
+
+/**
+ * Receives PostgreSQL NOTIFY messages on a dedicated connection.
+ *
+ * Notifications are dispatched to channel callbacks, from the listener thread, or
+ * queued when channel has no callback. Channels are listened again after a
+ * reconnection.
+ */
+class PostgreSQLListener : public Thread
+{
+public:
+	typedef std::function<void(const PostgreSQLNotification &)> Callback;
+
+	/**
+	 * Open listener connection
+	 *
+	 * @throws PostgreSQLException if connection failed
+	 * @param connect_string
+	 * @param reconnect_interval delay between reconnection attempts
+	 * @param max_queue_size maximum queued notifications, next ones are dropped
+	 */
+	PostgreSQLListener(const std::string &connect_string,
+		std::chrono::milliseconds reconnect_interval = std::chrono::seconds(1),
+		size_t max_queue_size = 10000);
+
+	PostgreSQLListener() = delete;
+
+	~PostgreSQLListener() override;
+
+	void *run() override;
+
+	void stop() override;
+
+	/**
+	 * Listen on channel. Can be called from any thread, LISTEN is issued by the
+	 * listener thread.
+	 *
+	 * @param channel
+	 * @param callback called for each notification, if empty notifications are queued
+	 */
+	void listen(const std::string &channel, const Callback &callback = nullptr);
+
+	/**
+	 * Stop listening on channel
+	 *
+	 * @param channel
+	 */
+	void unlisten(const std::string &channel);
+
+	/**
+	 * Add a callback called, from the listener thread, when connection is restored.
+	 * Notifications sent while connection was lost are not received.
+	 *
+	 * @param callback
+	 */
+	void add_reconnect_callback(const std::function<void()> &callback);
+
+	/**
+	 * Pop a queued notification
+	 *
+	 * @param notification
+	 * @return false if queue is empty
+	 */
+	bool pop_notification(PostgreSQLNotification &notification);
+
+	/**
+	 * @return true if all channels are listened on a working connection
+	 */
+	bool is_ready() const { return m_ready; }
+
+	/**
+	 * @return number of successful reconnections
+	 */
+	uint32_t get_reconnection_count() const { return m_reconnections; }
+
+private:
+	void wakeup();
+	bool sync_channels();
+	void dispatch_notifications();
+	void connection_lost();
+
+	std::unique_ptr<PostgreSQLClient> m_client;
+	std::chrono::milliseconds m_reconnect_interval;
+	size_t m_max_queue_size;
+
+	std::mutex m_channels_mutex;
+	std::unordered_map<std::string, Callback> m_channels;
+	std::vector<std::function<void()>> m_reconnect_callbacks;
+
+	// Channels listened on current connection, only used by listener thread
+	std::unordered_set<std::string> m_listening;
+	std::atomic_bool m_ready;
+	std::atomic<uint32_t> m_reconnections;
+	bool m_connected = true;
+	bool m_reconnected = false;
+
+	ThreadSafeQueue<PostgreSQLNotification> m_queue;
+	int m_wakeup_pipe[2] = {-1, -1};
+};
+
+}
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace winterwind
+{
+namespace db
+{
+
+class PostgreSQLListener;
+
+struct PostgreSQLResultCacheConfig
+{
+	std::chrono::milliseconds ttl = std::chrono::minutes(1);
+	// Estimated memory used by cached results
+	size_t max_memory = 64 * 1024 * 1024;
+	// NOTIFY channel used to invalidate tags, payload is the tag
+	std::string channel = "winterwind_cache";
+};
+
+struct PostgreSQLResultCacheMetrics
+{
+	uint64_t entries = 0;
+	uint64_t memory = 0;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	uint64_t expirations = 0;
+	uint64_t invalidations = 0;
+};
+
+/**
+ * Cache of prepared statement results, shared by any number of clients & threads.
+ *
+ * Entries are keyed by statement name and parameters, expire after a TTL, and
+ * least recently used ones are evicted when memory limit is reached. Each entry has
+ * tags (usually table names) which permit invalidating it when data changes.
+ * install_invalidation_trigger creates a trigger sending a NOTIFY on table changes,
+ * and attach() makes a PostgreSQLListener invalidate the matching tags.
+ *
+ * Cached results are shared and read-only.
+ */
+class PostgreSQLResultCache
+{
+public:
+	typedef std::shared_ptr<const PostgreSQLResult> ResultPtr;
+
+	explicit PostgreSQLResultCache(
+		const PostgreSQLResultCacheConfig &config = PostgreSQLResultCacheConfig());
+
+	/**
+	 * Return cached result or execute statement and cache its result
+	 *
+	 * @throws PostgreSQLException if query failed, failures are not cached
+	 * @param client client used on cache miss
+	 * @param stn registered statement name
+	 * @param tags tags of cached entry
+	 * @param params statement parameters
+	 * @param ttl entry TTL, configured TTL if zero
+	 * @return result
+	 */
+	ResultPtr exec_prepared(PostgreSQLClient &client, const std::string &stn,
+		const std::vector<std::string> &tags, PostgreSQLParams &params,
+		std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+
+	/**
+	 * Return cached result or execute statement, see exec_prepared above
+	 */
+	template<typename... Args>
+	ResultPtr exec(PostgreSQLClient &client, const std::string &stn,
+		const std::vector<std::string> &tags, const Args &... args)
+	{
+		PostgreSQLParams params(args...);
+		return exec_prepared(client, stn, tags, params);
+	}
+
+	/**
+	 * Drop all entries having tag
+	 *
+	 * @param tag
+	 */
+	void invalidate_tag(const std::string &tag);
+
+	/**
+	 * Drop all entries
+	 */
+	void clear();
+
+	/**
+	 * Invalidate tags notified on configured channel. Cache is cleared when listener
+	 * reconnects, as notifications may have been lost.
+	 * Cache must outlive the listener.
+	 *
+	 * @param listener
+	 */
+	void attach(PostgreSQLListener &listener);
+
+	/**
+	 * Create a trigger notifying tag on configured channel when table is modified
+	 *
+	 * @throws PostgreSQLException
+	 * @param client
+	 * @param table table name, not escaped
+	 * @param tag invalidated tag, table name if empty
+	 */
+	void install_invalidation_trigger(PostgreSQLClient &client, const std::string &table,
+		const std::string &tag = "");
+
+	PostgreSQLResultCacheMetrics get_metrics();
+
+private:
+	struct Entry
+	{
+		ResultPtr result;
+		std::chrono::steady_clock::time_point expires;
+		size_t size;
+		std::vector<std::string> tags;
+		std::list<const std::string *>::iterator lru;
+	};
+
+	typedef std::unordered_map<std::string, Entry> EntryMap;
+
+	static std::string make_key(const std::string &stn, const PostgreSQLParams &params);
+	static size_t estimate_size(const PGresult *result);
+
+	void remove(EntryMap::iterator it);
+
+	PostgreSQLResultCacheConfig m_config;
+
+	std::mutex m_mutex;
+	EntryMap m_entries;
+	// Most recently used first, references m_entries keys
+	std::list<const std::string *> m_lru;
+	std::unordered_map<std::string, std::unordered_set<const std::string *>> m_tags;
+
+	// Invalidation generations, queries started before an invalidation of one of
+	// their tags are not cached
+	uint64_t m_generation = 0;
+	uint64_t m_clear_generation = 0;
+	std::unordered_map<std::string, uint64_t> m_tag_generations;
+
+	PostgreSQLResultCacheMetrics m_metrics;
+};
+
+}
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+
+enum PostgreSQLStreamMode
+{
+	/**
+	 * Rows are read as they arrive (libpq chunked rows mode when available, single
+	 * row mode otherwise). Connection is busy until all rows are read.
+	 */
+	PG_STREAM_ROWS,
+	/**
+	 * Rows are fetched by fetch_size blocks from a server-side cursor. Connection
+	 * can run other queries between fetches.
+	 */
+	PG_STREAM_CURSOR,
+};
+
+/**
+ * Iterate over query results without loading whole result in client memory.
+ *
+ * @code
+ * PostgreSQLResultStream stream(pg, "SELECT id, name FROM users");
+ * while (stream.next()) {
+ * 	process(stream.get<int32_t>(0), stream.get<std::string>(1));
+ * }
+ * @endcode
+ *
+ * In rows mode, destroying the stream before last row cancels the query, unless a
+ * transaction is open on the connection: cancelling would abort the transaction,
+ * remaining rows are read and dropped instead.
+ */
+class PostgreSQLResultStream
+{
+public:
+	/**
+	 * Send query and prepare row streaming
+	 *
+	 * @throws PostgreSQLException if query cannot be sent
+	 * @param client
+	 * @param query SQL query
+	 * @param params query parameters ($1, $2...), in text format
+	 * @param mode streaming mode
+	 * @param fetch_size rows per block in chunked rows & cursor modes
+	 * @param binary_results request results in binary format
+	 */
+	PostgreSQLResultStream(PostgreSQLClient &client, const std::string &query,
+		const std::vector<std::string> &params = {}, PostgreSQLStreamMode mode = PG_STREAM_ROWS,
+		int fetch_size = 1000, bool binary_results = false);
+
+	PostgreSQLResultStream() = delete;
+	PostgreSQLResultStream(const PostgreSQLResultStream &other) = delete;
+	PostgreSQLResultStream &operator=(const PostgreSQLResultStream &other) = delete;
+
+	/**
+	 * Cancel query if rows remain
+	 */
+	~PostgreSQLResultStream();
+
+	/**
+	 * Move to next row
+	 *
+	 * @throws PostgreSQLException if query failed
+	 * @return false when there is no more rows
+	 */
+	bool next();
+
+	/**
+	 * Fields are known once next() has been called, and remain after last row
+	 *
+	 * @throws PostgreSQLException if next() has not been called yet
+	 */
+	int get_field_count() const;
+
+	/**
+	 * @throws PostgreSQLException if next() has not been called yet or col is invalid
+	 */
+	const std::string &get_field_name(int col) const;
+
+	bool is_null(int col) const { return m_result->is_null(m_row, col); }
+
+	/**
+	 * Read current row field with type T, see PostgreSQLResult::get
+	 *
+	 * @throws PostgreSQLException if column type cannot be converted to T
+	 * @param col
+	 * @return field value, or T() if field is NULL
+	 */
+	template<typename T> T get(int col) const { return m_result->get<T>(m_row, col); }
+
+	/**
+	 * @return number of rows read
+	 */
+	uint64_t get_row_count() const { return m_rows; }
+
+private:
+	bool fetch_rows();
+	bool fetch_cursor();
+	void keep_fields(const PGresult *result);
+	void close(bool success);
+
+	PGconn *m_conn = nullptr;
+	PostgreSQLStreamMode m_mode = PG_STREAM_ROWS;
+	int m_fetch_size = 1000;
+	bool m_binary_results = false;
+
+	std::unique_ptr<PostgreSQLResult> m_result;
+	int m_row = 0;
+	uint64_t m_rows = 0;
+	bool m_running = false;
+	bool m_in_transaction = false;
+	bool m_has_fields = false;
+	std::vector<std::string> m_fields;
+
+	std::string m_cursor = "";
+	bool m_own_transaction = false;
+};
+
+}
+}
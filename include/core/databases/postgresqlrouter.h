@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "postgresqlclient.h"
+#include <chrono>
+#include <memory>
+
+namespace winterwind
+{
+namespace db
+{
+
+enum PostgreSQLReplicaSelection
+{
+	PG_REPLICA_ROUND_ROBIN,
+	PG_REPLICA_LEAST_LATENCY,
+};
+
+struct PostgreSQLRouterConfig
+{
+	PostgreSQLReplicaSelection selection = PG_REPLICA_ROUND_ROBIN;
+	// Replicas lagging more are not used
+	std::chrono::milliseconds max_lag = std::chrono::seconds(10);
+	// Delay between replicas health checks
+	std::chrono::milliseconds health_check_interval = std::chrono::seconds(5);
+};
+
+struct PostgreSQLReplicaStatus
+{
+	std::string connect_string;
+	bool healthy;
+	// Health check query round trip, smoothed
+	std::chrono::microseconds latency;
+	// milliseconds::max() when replica lag is unknown
+	std::chrono::milliseconds lag;
+	uint64_t queries;
+};
+
+/**
+ * Routes queries between a primary server and read replicas.
+ *
+ * Read-only statements and transactions are sent to a healthy replica, writes and
+ * transactions started with begin() to the primary. A replica is unhealthy when it
+ * cannot be reached or its replication lag exceeds max_lag or is unknown. Reads fail
+ * over to the primary when no replica is healthy.
+ *
+ * Like PostgreSQLClient, a router is not thread safe, use one router per thread or a
+ * ConnectionPool of routers.
+ */
+class PostgreSQLRouter
+{
+public:
+	/**
+	 * Connect to primary & replicas
+	 *
+	 * @throws PostgreSQLException if primary connection failed. Unreachable replicas
+	 * are only flagged unhealthy.
+	 * @param primary primary connect string
+	 * @param replicas replicas connect strings
+	 * @param config
+	 */
+	PostgreSQLRouter(const std::string &primary, const std::vector<std::string> &replicas,
+		const PostgreSQLRouterConfig &config = PostgreSQLRouterConfig());
+
+	PostgreSQLRouter() = delete;
+
+	PostgreSQLClient &get_primary() { return *m_primary; }
+
+	/**
+	 * Select client for a read: a healthy replica, or primary if there is none or a
+	 * primary transaction is running
+	 *
+	 * @return client
+	 */
+	PostgreSQLClient &get_reader();
+
+	/**
+	 * Execute query on a reader if it's a read-only statement (SELECT without
+	 * locking clause, SHOW...), on primary otherwise. Statements calling functions
+	 * modifying data must use exec_write.
+	 *
+	 * @throws PostgreSQLException
+	 * @param query
+	 * @return PostgreSQLResult object
+	 */
+	PostgreSQLResult exec(const std::string &query);
+
+	/**
+	 * Execute query on a reader. If replica connection fails, query is retried on
+	 * another replica or primary.
+	 *
+	 * @throws PostgreSQLException
+	 * @param query read-only SQL
+	 * @return PostgreSQLResult object
+	 */
+	PostgreSQLResult exec_read(const std::string &query);
+
+	/**
+	 * Execute query on primary
+	 *
+	 * @throws PostgreSQLException
+	 * @param query
+	 * @return PostgreSQLResult object
+	 */
+	PostgreSQLResult exec_write(const std::string &query)
+	{
+		return m_primary->exec(query.c_str());
+	}
+
+	/**
+	 * Run f into a READ ONLY transaction on a reader. Transaction is rolled back if f
+	 * throws.
+	 *
+	 * @throws PostgreSQLException
+	 * @param f function receiving the client to use
+	 */
+	template<typename F>
+	void read_only_transaction(F f)
+	{
+		PostgreSQLClient &client = get_reader();
+		client.exec("BEGIN READ ONLY");
+		try {
+			f(client);
+		}
+		catch (...) {
+			try {
+				client.rollback();
+			}
+			catch (PostgreSQLException &) {}
+			throw;
+		}
+		client.exec("COMMIT");
+	}
+
+	/**
+	 * Start a transaction on primary, all queries go to primary until commit or
+	 * rollback
+	 */
+	void begin() { m_primary->begin(); }
+	void commit() { m_primary->commit(); }
+	void rollback() { m_primary->rollback(); }
+
+	/**
+	 * Check replicas latency & replication lag
+	 *
+	 * @param force check even if health_check_interval isn't elapsed
+	 */
+	void check_health(bool force = false);
+
+	/**
+	 * Verify primary connection, see PostgreSQLClient::check_connection
+	 *
+	 * @throws PostgreSQLException
+	 */
+	void check_connection() { m_primary->check_connection(); }
+
+	std::vector<PostgreSQLReplicaStatus> get_replicas_status() const;
+
+	/**
+	 * @return number of reads sent to primary because no replica was healthy
+	 */
+	uint64_t get_failover_count() const { return m_failovers; }
+
+private:
+	struct Replica
+	{
+		std::string connect_string;
+		std::unique_ptr<PostgreSQLClient> client;
+		bool healthy = false;
+		std::chrono::microseconds latency = std::chrono::microseconds(0);
+		std::chrono::milliseconds lag = std::chrono::milliseconds(0);
+		uint64_t queries = 0;
+	};
+
+	bool in_primary_transaction() const;
+	void check_replica(Replica &replica);
+	Replica *select_replica();
+
+	PostgreSQLRouterConfig m_config;
+	std::unique_ptr<PostgreSQLClient> m_primary;
+	std::vector<Replica> m_replicas;
+	size_t m_next_replica = 0;
+	std::chrono::steady_clock::time_point m_last_health_check;
+	uint64_t m_failovers = 0;
+};
+
+}
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libpq-fe.h>
+}
+
+namespace winterwind
+{
+namespace db
+{
+
+/**
+ * PostgreSQL built-in types OIDs (see catalog/pg_type.h)
+ */
+enum PostgreSQLTypeOid : Oid
+{
+	PG_BOOLOID = 16,
+	PG_BYTEAOID = 17,
+	PG_CHAROID = 18,
+	PG_NAMEOID = 19,
+	PG_INT8OID = 20,
+	PG_INT2OID = 21,
+	PG_INT4OID = 23,
+	PG_TEXTOID = 25,
+	PG_OIDOID = 26,
+	PG_JSONOID = 114,
+	PG_FLOAT4OID = 700,
+	PG_FLOAT8OID = 701,
+	PG_BOOLARRAYOID = 1000,
+	PG_INT2ARRAYOID = 1005,
+	PG_INT4ARRAYOID = 1007,
+	PG_TEXTARRAYOID = 1009,
+	PG_VARCHARARRAYOID = 1015,
+	PG_INT8ARRAYOID = 1016,
+	PG_FLOAT4ARRAYOID = 1021,
+	PG_FLOAT8ARRAYOID = 1022,
+	PG_BPCHAROID = 1042,
+	PG_VARCHAROID = 1043,
+	PG_TIMESTAMPOID = 1114,
+	PG_TIMESTAMPTZOID = 1184,
+	PG_NUMERICOID = 1700,
+	PG_UUIDOID = 2950,
+	PG_JSONBOID = 3802,
+};
+
+/**
+ * PostgreSQL timestamp & timestamptz (UTC) values
+ */
+typedef std::chrono::system_clock::time_point PostgreSQLTimestamp;
+
+/**
+ * Field decoder from PostgreSQL text (format 0) or binary (format 1) representation.
+ *
+ * Decoder is resolved once for a column type & format, then called for each value.
+ * Supported types are bool, int16_t, int32_t, int64_t, uint32_t, uint64_t, float,
+ * double, std::string, PostgreSQLTimestamp and std::vector of int16_t, int32_t,
+ * int64_t, double & std::string for one dimension arrays. Arrays containing NULL
+ * elements throw a DatabaseException when decoded.
+ *
+ * std::string decoder returns raw bytes for bytea and the text representation for
+ * every other type, including binary numeric, uuid & timestamps.
+ *
+ * @tparam T destination type
+ */
+template<typename T>
+struct PostgreSQLDecoder
+{
+	typedef T (*Func)(const char *data, int len);
+
+	/**
+	 * @param type column type OID
+	 * @param format column format
+	 * @return decoder function, nullptr if conversion is not supported
+	 */
+	static Func resolve(Oid type, int format);
+};
+
+template<> PostgreSQLDecoder<bool>::Func PostgreSQLDecoder<bool>::resolve(Oid, int);
+template<> PostgreSQLDecoder<int16_t>::Func PostgreSQLDecoder<int16_t>::resolve(Oid, int);
+template<> PostgreSQLDecoder<int32_t>::Func PostgreSQLDecoder<int32_t>::resolve(Oid, int);
+template<> PostgreSQLDecoder<int64_t>::Func PostgreSQLDecoder<int64_t>::resolve(Oid, int);
+template<> PostgreSQLDecoder<uint32_t>::Func PostgreSQLDecoder<uint32_t>::resolve(Oid, int);
+template<> PostgreSQLDecoder<uint64_t>::Func PostgreSQLDecoder<uint64_t>::resolve(Oid, int);
+template<> PostgreSQLDecoder<float>::Func PostgreSQLDecoder<float>::resolve(Oid, int);
+template<> PostgreSQLDecoder<double>::Func PostgreSQLDecoder<double>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::string>::Func
+	PostgreSQLDecoder<std::string>::resolve(Oid, int);
+template<> PostgreSQLDecoder<PostgreSQLTimestamp>::Func
+	PostgreSQLDecoder<PostgreSQLTimestamp>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::vector<int16_t>>::Func
+	PostgreSQLDecoder<std::vector<int16_t>>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::vector<int32_t>>::Func
+	PostgreSQLDecoder<std::vector<int32_t>>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::vector<int64_t>>::Func
+	PostgreSQLDecoder<std::vector<int64_t>>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::vector<double>>::Func
+	PostgreSQLDecoder<std::vector<double>>::resolve(Oid, int);
+template<> PostgreSQLDecoder<std::vector<std::string>>::Func
+	PostgreSQLDecoder<std::vector<std::string>>::resolve(Oid, int);
+
+}
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+
+struct DatabaseQueryStatsConfig
+{
+	// Queries slower than this threshold are logged, 0 disables slow query log
+	std::chrono::milliseconds slow_query_threshold = std::chrono::milliseconds(0);
+	// Statements tracked separately, next ones are aggregated under "<other>"
+	size_t max_statements = 1000;
+	// Slow queries waiting for EXPLAIN, next ones are not explained
+	size_t max_explain_queue = 100;
+	// Longer unprepared queries are truncated in statistics keys & slow query reports,
+	// and are not explained
+	size_t max_query_length = 4096;
+};
+
+/**
+ * Statistics of a statement: execution count, rows, errors & latency histogram
+ */
+struct DatabaseStatementStats
+{
+	// Histogram buckets upper bounds, last bucket has no bound
+	static const std::array<std::chrono::microseconds, 17> latency_buckets;
+
+	uint64_t count = 0;
+	uint64_t errors = 0;
+	// Rows returned or affected
+	uint64_t rows = 0;
+	std::chrono::microseconds total_time = std::chrono::microseconds(0);
+	std::chrono::microseconds max_time = std::chrono::microseconds(0);
+	std::array<uint64_t, 18> histogram{};
+
+	/**
+	 * Estimate a latency percentile using the histogram
+	 *
+	 * @param p percentile, between 0 & 1
+	 * @return upper bound of the bucket containing percentile
+	 */
+	std::chrono::microseconds percentile(double p) const;
+};
+
+struct DatabaseSlowQuery
+{
+	// Statement name, or normalized query for unprepared queries
+	std::string statement;
+	std::string query;
+	std::vector<std::string> params;
+	// false if query cannot be replayed by EXPLAIN (NULL or binary parameters)
+	bool explainable = true;
+	std::chrono::microseconds duration;
+	uint64_t rows = 0;
+	// Query plan, empty if not explained
+	std::string plan;
+};
+
+/**
+ * Per statement latency, row & error counters for a database client.
+ *
+ * Statistics can be shared by multiple clients (a connection pool for instance), they
+ * are thread safe. Queries slower than the configured threshold are logged and, if an
+ * explain function is set, their plan is captured by a background thread with its own
+ * connection, without blocking the client.
+ */
+class DatabaseQueryStats
+{
+public:
+	/**
+	 * Returns plan of a query, called from explain thread
+	 */
+	typedef std::function<std::string(const DatabaseSlowQuery &query)> ExplainFunction;
+	typedef std::function<void(const DatabaseSlowQuery &query)> SlowQueryCallback;
+
+	explicit DatabaseQueryStats(const DatabaseQueryStatsConfig &config =
+		DatabaseQueryStatsConfig());
+
+	~DatabaseQueryStats();
+
+	/**
+	 * Record a query execution
+	 *
+	 * @param statement statement name or normalized query
+	 * @param duration
+	 * @param rows rows returned or affected
+	 * @param error true if query failed
+	 */
+	void record(const std::string &statement, std::chrono::microseconds duration,
+		uint64_t rows, bool error);
+
+	const DatabaseQueryStatsConfig &get_config() const { return m_config; }
+
+	/**
+	 * @param duration
+	 * @return true if query is slower than threshold
+	 */
+	bool is_slow(std::chrono::microseconds duration) const
+	{
+		return m_config.slow_query_threshold.count() > 0 &&
+			duration >= m_config.slow_query_threshold;
+	}
+
+	/**
+	 * Log a slow query and queue it for EXPLAIN if an explain function is set
+	 *
+	 * @param query
+	 */
+	void report_slow_query(DatabaseSlowQuery &&query);
+
+	/**
+	 * Capture plan of slow queries. Function is called from a background thread and
+	 * must use its own connection.
+	 *
+	 * @param explain_function
+	 */
+	void set_explain_function(const ExplainFunction &explain_function);
+
+	/**
+	 * Callback called for each slow query, from explain thread with the plan if an
+	 * explain function is set, from the querying thread otherwise
+	 *
+	 * @param callback
+	 */
+	void set_slow_query_callback(const SlowQueryCallback &callback);
+
+	std::unordered_map<std::string, DatabaseStatementStats> get_statements_stats() const;
+
+	/**
+	 * @param statement
+	 * @return statement statistics, zeroed if statement was never executed
+	 */
+	DatabaseStatementStats get_statement_stats(const std::string &statement) const;
+
+	void reset();
+
+private:
+	class ExplainThread;
+
+	void notify_slow_query(const DatabaseSlowQuery &query);
+
+	DatabaseQueryStatsConfig m_config;
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, DatabaseStatementStats> m_statements;
+	SlowQueryCallback m_slow_query_callback;
+	std::unique_ptr<ExplainThread> m_explain_thread;
+};
+
+}
+}
@@ -28,6 +28,7 @@
 #include <cstdint>
 #include <iostream>
 #include "../httpcommon.h"
+#include "requestbody.h"
 
 namespace winterwind
 {
@@ -84,11 +85,29 @@ public:
 		return *this;
 	}
 
+	const RequestBodyPtr &get_body() const
+	{
+		return m_body;
+	}
+
+	/**
+	 * Stream request body from body source instead of post_data
+	 *
+	 * @param body
+	 * @return current query
+	 */
+	Query &set_body(const RequestBodyPtr &body)
+	{
+		m_body = body;
+		return *this;
+	}
+
 private:
 	const std::string m_url = "";
 	const Flag m_flag = FLAG_SIMPLE;
 	const Method m_method = GET;
 	std::string m_post_data = "";
+	RequestBodyPtr m_body = nullptr;
 };
 }
 }
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "core/utils/exception.h"
+
+namespace winterwind
+{
+namespace http
+{
+
+class RequestBodyException : public BaseException
+{
+public:
+	explicit RequestBodyException(const std::string &what) : BaseException(what) {}
+
+	~RequestBodyException() throw() override = default;
+};
+
+/**
+ * Streamed HTTP request body.
+ *
+ * Body is read by chunks while request is sent, it's never fully loaded in memory.
+ * If body size is unknown, request is sent using chunked transfer encoding.
+ */
+class RequestBody
+{
+public:
+	static const size_t READ_ERROR = (size_t) -1;
+
+	virtual ~RequestBody() = default;
+
+	/**
+	 * Read next body chunk
+	 *
+	 * @param buf destination buffer
+	 * @param len buffer length
+	 * @return number of bytes read, 0 at end of body, READ_ERROR to abort request
+	 */
+	virtual size_t read(char *buf, size_t len) = 0;
+
+	/**
+	 * @return body size in bytes, or -1 if unknown
+	 */
+	virtual int64_t size() const = 0;
+
+	/**
+	 * Restart body reading from its beginning. It's required by cURL to resend body
+	 * on redirections or authentication negotiation.
+	 *
+	 * @return false if body cannot be rewound
+	 */
+	virtual bool rewind() { return false; }
+};
+
+typedef std::shared_ptr<RequestBody> RequestBodyPtr;
+
+/**
+ * Body read from a file descriptor using pread
+ */
+class FileRequestBody : public RequestBody
+{
+public:
+	/**
+	 * @param fd opened file descriptor
+	 * @param close_fd close fd when body is destroyed
+	 */
+	explicit FileRequestBody(int fd, bool close_fd = false);
+
+	/**
+	 * @throws RequestBodyException if file cannot be opened
+	 * @param path file path
+	 */
+	explicit FileRequestBody(const std::string &path);
+
+	~FileRequestBody() override;
+
+	size_t read(char *buf, size_t len) override;
+	int64_t size() const override { return m_size; }
+	bool rewind() override;
+
+private:
+	int m_fd = -1;
+	bool m_close_fd = false;
+	int64_t m_size = -1;
+	int64_t m_offset = 0;
+};
+
+/**
+ * Body read from a memory mapped file
+ */
+class MmapRequestBody : public RequestBody
+{
+public:
+	/**
+	 * @throws RequestBodyException if file cannot be opened or mapped
+	 * @param path file path
+	 */
+	explicit MmapRequestBody(const std::string &path);
+
+	~MmapRequestBody() override;
+
+	size_t read(char *buf, size_t len) override;
+	int64_t size() const override { return (int64_t) m_size; }
+	bool rewind() override;
+
+private:
+	char *m_data = nullptr;
+	size_t m_size = 0;
+	size_t m_offset = 0;
+};
+
+/**
+ * Body produced by a generator function
+ */
+class GeneratorRequestBody : public RequestBody
+{
+public:
+	/**
+	 * Generator has read() semantics: it fills buffer and returns written length,
+	 * 0 at end of body or READ_ERROR
+	 */
+	typedef std::function<size_t(char *buf, size_t len)> Generator;
+
+	/**
+	 * @param generator
+	 * @param size body size if known, -1 to use chunked transfer encoding
+	 */
+	explicit GeneratorRequestBody(const Generator &generator, int64_t size = -1) :
+		m_generator(generator), m_size(size)
+	{}
+
+	~GeneratorRequestBody() override = default;
+
+	size_t read(char *buf, size_t len) override { return m_generator(buf, len); }
+	int64_t size() const override { return m_size; }
+
+private:
+	Generator m_generator;
+	int64_t m_size = -1;
+};
+
+}
+}
@@ -26,8 +26,10 @@
 #pragma once
 
 #include "httpcommon.h"
+#include "http/requestbody.h"
 #include "xmlparser.h"
 #include <atomic>
+#include <curl/curl.h>
 #include <json/json.h>
 #include <string>
 #include <unordered_map>
@@ -91,7 +93,42 @@ public:
 	void http_string_escape(const std::string &src, std::string &dst);
 
 protected:
+	/**
+	 * Per request cURL storage. It must outlive the transfer as cURL references
+	 * url, headers & post_data until the handle is released.
+	 */
+	struct CurlRequest
+	{
+		explicit CurlRequest(std::string *res) : response(res) {}
+
+		std::string url = "";
+		std::string post_data = "";
+		struct curl_slist *headers = nullptr;
+		std::string *response = nullptr;
+		RequestBodyPtr body = nullptr;
+	};
+
 	static size_t curl_writer(char *data, size_t size, size_t nmemb, void *user_data);
+	static size_t curl_reader(char *data, size_t size, size_t nmemb, void *body);
+	static int curl_seeker(void *body, curl_off_t offset, int origin);
+
+	/**
+	 * Create a cURL easy handle for query, consuming the pending headers, URI & form
+	 * parameters of this client
+	 *
+	 * @param query
+	 * @param req request storage, see CurlRequest
+	 * @return configured easy handle, ready to perform
+	 */
+	CURL *prepare_request(const Query &query, CurlRequest &req);
+
+	/**
+	 * Free cURL easy handle & request storage created by prepare_request
+	 *
+	 * @param curl
+	 * @param req
+	 */
+	void release_request(CURL *curl, CurlRequest &req);
 
 	void prepare_json_query();
 
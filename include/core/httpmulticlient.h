@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "httpclient.h"
+#include <functional>
+#include <memory>
+
+namespace winterwind
+{
+namespace http
+{
+
+/**
+ * Asynchronous HTTP client based on cURL multi interface.
+ *
+ * Requests are queued with add_request and performed concurrently by perform().
+ * When the server supports HTTP/2 (negotiated through TLS ALPN), in-flight requests
+ * to the same host are multiplexed as streams over a shared connection instead of
+ * opening one connection per request. Connections are kept between perform() calls.
+ */
+class HTTPMultiClient : public HTTPClient
+{
+public:
+	/**
+	 * Request completion callback
+	 *
+	 * @param rc cURL transfer status
+	 * @param http_code HTTP response code (0 if no response was received)
+	 * @param res response body
+	 */
+	typedef std::function<void(CURLcode rc, long http_code, const std::string &res)>
+		RequestCallback;
+
+	/**
+	 * @param max_concurrent_streams maximum number of HTTP/2 streams per connection
+	 * @param max_host_connections maximum number of connections per host. HTTP/1.1 hosts
+	 * can't multiplex, it also limits the number of their parallel requests
+	 * @param max_file_size maximum response size per request
+	 */
+	explicit HTTPMultiClient(uint32_t max_concurrent_streams = 100,
+		uint32_t max_host_connections = 1, uint32_t max_file_size = 1024 * 1024);
+
+	~HTTPMultiClient() override;
+
+	/**
+	 * Queue a request. Pending headers, URI & form parameters are consumed like with
+	 * HTTPClient::request. Request is started at next perform() call.
+	 *
+	 * @param query
+	 * @param cb callback called from perform() when request is completed
+	 */
+	void add_request(const Query &query, const RequestCallback &cb);
+
+	/**
+	 * Perform all queued requests and wait for their completion.
+	 * Callbacks can queue new requests, they are performed in the same call.
+	 */
+	void perform();
+
+	/**
+	 * @return number of queued or running requests
+	 */
+	size_t pending_requests() const { return m_transfers.size(); }
+
+private:
+	struct Transfer
+	{
+		Transfer(): req(&response) {}
+
+		CurlRequest req;
+		std::string response = "";
+		RequestCallback callback;
+	};
+
+	/**
+	 * Read completed transfers and call their callbacks
+	 */
+	void process_completed_transfers();
+
+	CURLM *m_multi = nullptr;
+	std::unordered_map<CURL *, std::unique_ptr<Transfer>> m_transfers;
+};
+}
+}
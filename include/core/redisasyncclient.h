@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "redisclient.h"
+#include "core/utils/threads.h"
+#include <hiredis/async.h>
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace winterwind
+{
+/**
+ * Non blocking Redis client.
+ *
+ * Commands are queued from any thread and written by an event loop thread on a
+ * single connection without waiting for previous replies (pipelining). Replies
+ * are returned in order through callbacks, called from the event loop thread, or
+ * futures.
+ *
+ * @code
+ * RedisAsyncClient redis("localhost", 6379);
+ * redis.start();
+ * std::future<std::string> f = redis.command({"GET", "key"});
+ * std::string value = f.get();
+ * @endcode
+ */
+class RedisAsyncClient : public Thread
+{
+public:
+	/**
+	 * Command callback. Reply is only valid during the call. On connection error,
+	 * reply is nullptr and error contains the error message
+	 */
+	typedef std::function<void(const redisReply *reply, const std::string &error)>
+		CommandCallback;
+
+	/**
+	 * Connection is opened by the event loop
+	 *
+	 * @param host
+	 * @param port
+	 * @param cb_interval circuit breaker interval in seconds
+	 */
+	RedisAsyncClient(const std::string &host, uint16_t port, uint32_t cb_interval = 1);
+
+	RedisAsyncClient() = delete;
+
+	/**
+	 * Stop the event loop, pending commands are failed
+	 */
+	~RedisAsyncClient() override;
+
+	void *run() override;
+
+	void stop() override;
+
+	/**
+	 * Queue a command. Once client is stopping, callback is called immediately with
+	 * an error
+	 *
+	 * @param args command name & arguments, binary safe
+	 * @param callback
+	 */
+	void command(const std::vector<std::string> &args, const CommandCallback &callback);
+
+	/**
+	 * Queue a command
+	 *
+	 * @param args command name & arguments, binary safe
+	 * @return future reply as string (integers are converted, nil is an empty string),
+	 * throwing RedisException on error reply or connection error
+	 */
+	std::future<std::string> command(const std::vector<std::string> &args);
+
+	/**
+	 * @return number of queued and sent commands waiting for a reply
+	 */
+	size_t pending_commands() const { return m_pending; }
+
+private:
+	struct Command
+	{
+		RedisAsyncClient *client;
+		std::vector<std::string> args;
+		CommandCallback callback;
+	};
+
+	void wakeup();
+	bool connect();
+	void dispatch();
+	void notify(const Command &command, const redisReply *reply, const std::string &error);
+
+	static void on_reply(redisAsyncContext *ac, void *reply, void *privdata);
+	static void on_connect(const redisAsyncContext *ac, int status);
+	static void on_disconnect(const redisAsyncContext *ac, int status);
+
+	// Event adapter, hiredis tells which events it waits for
+	static void add_read(void *privdata);
+	static void del_read(void *privdata);
+	static void add_write(void *privdata);
+	static void del_write(void *privdata);
+	static void cleanup(void *privdata);
+
+	std::string m_host = "";
+	uint16_t m_port = 6379;
+	uint32_t m_circuit_breaker_interval = 1;
+	time_t m_last_failed_connection = 0;
+
+	// Owned by the event loop thread
+	redisAsyncContext *m_context = nullptr;
+	bool m_want_read = false;
+	bool m_want_write = false;
+
+	std::mutex m_queue_mutex;
+	std::deque<std::unique_ptr<Command>> m_queue;
+	std::atomic<size_t> m_pending;
+
+	int m_wakeup_pipe[2] = {-1, -1};
+};
+}
@@ -25,20 +25,134 @@
 
 #pragma once
 
+#include "core/utils/exception.h"
 #include <hiredis/hiredis.h>
+#include <chrono>
+#include <cstring>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace winterwind
 {
+class RedisException : public BaseException
+{
+public:
+	explicit RedisException(const std::string &what) : BaseException(what) {}
+	RedisException() = delete;
+
+	~RedisException() throw() override = default;
+};
+
+/**
+ * Binary safe command argument referencing caller memory, nothing is copied.
+ * Referenced data must outlive the command call.
+ */
+struct RedisArg
+{
+	RedisArg(const std::string &str) : data(str.data()), size(str.size()) {}
+	RedisArg(const char *str) : data(str), size(strlen(str)) {}
+	RedisArg(const char *d, size_t s) : data(d), size(s) {}
+
+	const char *data;
+	size_t size;
+};
+
+/**
+ * Owns a hiredis reply and frees it on destruction
+ */
+class RedisReply
+{
+public:
+	RedisReply() = default;
+	explicit RedisReply(redisReply *reply) : m_reply(reply) {}
+
+	~RedisReply()
+	{
+		if (m_reply) {
+			freeReplyObject(m_reply);
+		}
+	}
+
+	RedisReply(RedisReply &&other) noexcept : m_reply(other.m_reply)
+	{
+		other.m_reply = nullptr;
+	}
+
+	RedisReply &operator=(RedisReply &&other) noexcept
+	{
+		std::swap(m_reply, other.m_reply);
+		return *this;
+	}
+
+	RedisReply(const RedisReply &other) = delete;
+	RedisReply &operator=(const RedisReply &other) = delete;
+
+	redisReply *operator->() const { return m_reply; }
+	redisReply *get() const { return m_reply; }
+
+	/**
+	 * @return false if there is no reply (connection error)
+	 */
+	explicit operator bool() const { return m_reply != nullptr; }
+
+	bool is_error() const { return m_reply && m_reply->type == REDIS_REPLY_ERROR; }
+	bool is_nil() const { return m_reply && m_reply->type == REDIS_REPLY_NIL; }
+
+	/**
+	 * @return string, status or error reply content, empty string otherwise
+	 */
+	std::string str() const
+	{
+		return m_reply && m_reply->str ? std::string(m_reply->str, m_reply->len) : "";
+	}
+
+	/**
+	 * Reply content without copy, valid while this RedisReply is alive
+	 */
+	const char *data() const { return m_reply ? m_reply->str : nullptr; }
+	size_t size() const { return m_reply && m_reply->str ? (size_t) m_reply->len : 0; }
+
+private:
+	redisReply *m_reply = nullptr;
+};
+
 class RedisClient
 {
+	friend class RedisPipeline;
 public:
 	RedisClient(const std::string &host, uint16_t port,
 		uint32_t cb_interval = 0);
 
 	~RedisClient();
 
+	/**
+	 * @return true if client holds a usable connection (no round trip)
+	 */
+	bool is_connected() const { return m_context != nullptr && m_context->err == 0; }
+
+	/**
+	 * Send PING, reconnects if needed
+	 *
+	 * @return false if server is unreachable
+	 */
+	bool ping();
+
+	/**
+	 * @return number of successful connections, changes when client reconnected
+	 * and lost its server side state
+	 */
+	uint64_t get_connect_count() const { return m_connect_count; }
+
+	/**
+	 * @return last time server answered a command
+	 */
+	std::chrono::steady_clock::time_point get_last_activity() const
+	{
+		return m_last_activity;
+	}
+
 	bool type(const std::string &key, std::string &res);
 
 	bool set(const std::string &key, const std::string &value,
@@ -46,6 +160,13 @@ public:
 
 	bool get(const std::string &key, std::string &res);
 
+	/**
+	 * GET without copying the value, use RedisReply::data() & size()
+	 *
+	 * @return reply, empty on connection error
+	 */
+	RedisReply get_reply(const RedisArg &key);
+
 	bool del(const std::string &key);
 
 	bool hset(const std::string &key, const std::string &skey, const std::string &value,
@@ -53,19 +174,93 @@ public:
 
 	bool hget(const std::string &key, const std::string &skey, std::string &res);
 
+	/**
+	 * HGET without copying the value, use RedisReply::data() & size()
+	 *
+	 * @return reply, empty on connection error
+	 */
+	RedisReply hget_reply(const RedisArg &key, const RedisArg &skey);
+
 	bool hdel(const std::string &key, const std::string &skey);
 
 	bool hkeys(const std::string &key, std::vector<std::string> &res);
 
 	bool expire(const std::string &key, const uint32_t value);
 
+	/**
+	 * Get multiple keys with one MGET round trip
+	 *
+	 * @param keys
+	 * @param res found keys values, missing keys are not added
+	 * @return false on error
+	 */
+	bool mget(const std::vector<std::string> &keys,
+		std::unordered_map<std::string, std::string> &res);
+
+	/**
+	 * Set multiple keys with one MSET round trip
+	 *
+	 * @param values keys & values
+	 * @return false on error
+	 */
+	bool mset(const std::unordered_map<std::string, std::string> &values);
+
+	/**
+	 * Get multiple hash fields with one HMGET round trip
+	 *
+	 * @param key hash key
+	 * @param skeys fields
+	 * @param res found fields values, missing fields are not added
+	 * @return false on error
+	 */
+	bool hmget(const std::string &key, const std::vector<std::string> &skeys,
+		std::unordered_map<std::string, std::string> &res);
+
+	/**
+	 * Load a Lua script on the server and cache its SHA1 locally
+	 *
+	 * @param script Lua script
+	 * @param sha script SHA1
+	 * @return false on error
+	 */
+	bool load_script(const std::string &script, std::string &sha);
+
+	/**
+	 * Run a Lua script with EVALSHA. Script is loaded on first call and reloaded
+	 * if the server doesn't know it anymore (NOSCRIPT: flush or restart)
+	 *
+	 * @param script Lua script
+	 * @param keys KEYS script arguments
+	 * @param args ARGV script arguments
+	 * @return script reply, empty reply on connection error
+	 */
+	RedisReply eval(const std::string &script, const std::vector<std::string> &keys,
+		const std::vector<std::string> &args);
+
+	/**
+	 * Run any command, binary safe
+	 *
+	 * @param args command name & arguments
+	 * @return reply, empty on connection error
+	 */
+	RedisReply command(const std::vector<RedisArg> &args);
+
 private:
 	void connect();
 
+	/**
+	 * Drop broken context, next command reconnects
+	 */
+	void on_connection_error(const char *function);
+
 	std::string m_host = "";
 	uint16_t m_port = 6379;
 	uint32_t m_circuit_breaker_interval = 60;
 	time_t m_last_failed_connection = 0;
 	redisContext *m_context = nullptr;
+	uint64_t m_connect_count = 0;
+	std::chrono::steady_clock::time_point m_last_activity;
+	// Lua script => SHA1
+	std::unordered_map<std::string, std::string> m_scripts;
 };
 }
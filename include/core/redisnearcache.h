@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "redisclient.h"
+#include "core/utils/threads.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+
+namespace winterwind
+{
+struct RedisNearCacheConfig
+{
+	/**
+	 * Maximum number of cached keys
+	 */
+	size_t max_entries = 10000;
+
+	/**
+	 * Approximate maximum memory used by cached keys & values, in bytes
+	 */
+	size_t max_memory = 64 * 1024 * 1024;
+
+	/**
+	 * Circuit breaker interval in seconds
+	 */
+	uint32_t cb_interval = 1;
+};
+
+struct RedisNearCacheMetrics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t invalidations = 0;
+	uint64_t evictions = 0;
+	uint64_t flushes = 0;
+	size_t entries = 0;
+	size_t memory = 0;
+};
+
+/**
+ * In-process cache of Redis values, kept coherent by server assisted client
+ * side caching (CLIENT TRACKING, Redis >= 6).
+ *
+ * Values are read through a dedicated connection with tracking enabled and
+ * redirected to an invalidation connection, subscribed to __redis__:invalidate
+ * by the cache thread. When a cached key is modified on the server, its entry is
+ * dropped. If any connection is lost, whole cache is dropped.
+ *
+ * Until the invalidation connection is ready, reads are not cached.
+ *
+ * @code
+ * RedisNearCache cache("localhost", 6379);
+ * cache.start();
+ * std::string value;
+ * cache.get("key", value);
+ * @endcode
+ */
+class RedisNearCache : public Thread
+{
+public:
+	RedisNearCache(const std::string &host, uint16_t port,
+		const RedisNearCacheConfig &config = RedisNearCacheConfig());
+
+	RedisNearCache() = delete;
+
+	~RedisNearCache() override;
+
+	void *run() override;
+
+	void stop() override;
+
+	/**
+	 * GET key from cache, or from Redis on miss
+	 *
+	 * @param key
+	 * @param res value
+	 * @return false if key doesn't exist or on error
+	 */
+	bool get(const std::string &key, std::string &res);
+
+	/**
+	 * HGET key field from cache, or from Redis on miss
+	 *
+	 * @param key
+	 * @param skey hash field
+	 * @param res value
+	 * @return false if field doesn't exist or on error
+	 */
+	bool hget(const std::string &key, const std::string &skey, std::string &res);
+
+	/**
+	 * Drop a key from local cache
+	 */
+	void invalidate(const std::string &key);
+
+	/**
+	 * Drop all keys from local cache
+	 */
+	void clear();
+
+	RedisNearCacheMetrics get_metrics() const;
+
+	/**
+	 * @return server id of the invalidation connection, 0 when not subscribed
+	 */
+	int64_t get_invalidation_client_id() const { return m_redirect_id; }
+
+private:
+	struct Entry
+	{
+		bool has_value = false;
+		std::string value = "";
+		std::unordered_map<std::string, std::string> fields;
+		size_t memory = 0;
+		std::list<std::string>::iterator lru;
+	};
+
+	bool lookup(const std::string &key, const std::string *skey, std::string &res);
+	bool fetch(const std::string &key, const std::string *skey, std::string &res);
+	void store(const std::string &key, const std::string *skey, const std::string &value,
+		uint64_t invalidation_seq);
+	bool enable_tracking();
+
+	// Must be called with m_mutex held
+	void erase(const std::string &key);
+	void flush();
+
+	bool connect_invalidation(redisContext *&ctx);
+	void handle_invalidation(const redisReply *reply);
+	void wakeup();
+
+	std::string m_host = "";
+	uint16_t m_port = 6379;
+	RedisNearCacheConfig m_config;
+
+	// Cached values, most recently used keys at front of m_lru
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+	std::list<std::string> m_lru;
+	RedisNearCacheMetrics m_metrics;
+	// Values read while an invalidation was received may be stale, don't store them
+	std::atomic<uint64_t> m_invalidation_seq{0};
+
+	// Tracked connection used to read values
+	std::mutex m_client_mutex;
+	RedisClient m_client;
+	uint64_t m_tracking_connect_count = 0;
+	int64_t m_tracking_redirect = 0;
+
+	// Invalidation connection id, 0 when not subscribed
+	std::atomic<int64_t> m_redirect_id{0};
+	time_t m_last_failed_connection = 0;
+
+	int m_wakeup_pipe[2] = {-1, -1};
+};
+}
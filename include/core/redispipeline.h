@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "redisclient.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace winterwind
+{
+/**
+ * Queue Redis commands and send them in one write, then read all replies.
+ *
+ * @code
+ * RedisPipeline pipeline(redis);
+ * pipeline.set("a", "1").expire("a", 60).get("b");
+ * std::vector<RedisReply> replies;
+ * if (pipeline.exec(replies)) {
+ * 	std::string b = replies[2].str();
+ * }
+ * @endcode
+ *
+ * Commands are serialized when queued, arguments are binary safe.
+ */
+class RedisPipeline
+{
+public:
+	explicit RedisPipeline(RedisClient &client) : m_client(client) {}
+
+	RedisPipeline(const RedisPipeline &other) = delete;
+	RedisPipeline &operator=(const RedisPipeline &other) = delete;
+
+	RedisPipeline &get(const std::string &key);
+
+	/**
+	 * Queue SET, with EX option if expire_value is not 0
+	 */
+	RedisPipeline &set(const std::string &key, const std::string &value,
+		uint32_t expire_value = 0);
+
+	RedisPipeline &del(const std::string &key);
+	RedisPipeline &expire(const std::string &key, uint32_t value);
+	RedisPipeline &hget(const std::string &key, const std::string &skey);
+	RedisPipeline &hset(const std::string &key, const std::string &skey,
+		const std::string &value);
+	RedisPipeline &hdel(const std::string &key, const std::string &skey);
+
+	/**
+	 * Queue any command
+	 *
+	 * @param args command name & arguments
+	 */
+	RedisPipeline &command(const std::vector<std::string> &args);
+
+	/**
+	 * Send queued commands and read their replies. Queue is cleared.
+	 *
+	 * @param replies replies in commands order, Redis errors are error replies
+	 * @return false on connection error
+	 */
+	bool exec(std::vector<RedisReply> &replies);
+
+	size_t size() const { return m_commands; }
+	bool empty() const { return m_commands == 0; }
+	void clear();
+
+private:
+	void begin_command(size_t argc);
+	void append_arg(const char *data, size_t len);
+	void append_arg(const std::string &arg) { append_arg(arg.data(), arg.size()); }
+
+	RedisClient &m_client;
+	// Commands serialized with Redis protocol
+	std::string m_buffer = "";
+	size_t m_commands = 0;
+};
+}
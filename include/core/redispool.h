@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "redisclient.h"
+#include "databases/connectionpool.h"
+#include <atomic>
+#include <ctime>
+
+namespace winterwind
+{
+/**
+ * Thread-safe pool of RedisClient.
+ *
+ * Each thread borrows its own client through a RAII lease:
+ *
+ * @code
+ * RedisPool pool("localhost", 6379);
+ * {
+ * 	auto redis = pool.acquire();
+ * 	redis->set("key", "value");
+ * }
+ * @endcode
+ *
+ * Clients idle for more than ping_interval are pinged before being lent, broken
+ * ones are replaced. When a connection fails, no new connection is opened until
+ * cb_interval has elapsed, acquire() throws a DatabaseException meanwhile.
+ */
+class RedisPool
+{
+public:
+	typedef db::ConnectionPool<RedisClient>::Lease Lease;
+
+	/**
+	 * @throws DatabaseException if config.min_size connections cannot be opened
+	 * @param host
+	 * @param port
+	 * @param config pool size, idle & wait timeouts
+	 * @param cb_interval circuit breaker interval in seconds
+	 * @param ping_interval idle delay after which a client is pinged before use
+	 */
+	RedisPool(const std::string &host, uint16_t port,
+		const db::ConnectionPoolConfig &config = db::ConnectionPoolConfig(),
+		uint32_t cb_interval = 0,
+		std::chrono::milliseconds ping_interval = std::chrono::seconds(5));
+
+	RedisPool(const RedisPool &other) = delete;
+	RedisPool &operator=(const RedisPool &other) = delete;
+
+	/**
+	 * Borrow a client, waiting at most config wait_timeout
+	 *
+	 * @throws DatabaseException on timeout or connection failure
+	 */
+	Lease acquire() { return m_pool.acquire(); }
+
+	/**
+	 * Borrow a client, waiting at most timeout
+	 *
+	 * @throws DatabaseException on timeout or connection failure
+	 */
+	Lease acquire(std::chrono::milliseconds timeout) { return m_pool.acquire(timeout); }
+
+	/**
+	 * Close idle clients over min_size unused since idle_timeout, then reopen
+	 * clients up to min_size
+	 */
+	void evict_idle() { m_pool.evict_idle(); }
+
+	/**
+	 * @return pool size, wait times & borrow counters
+	 */
+	db::ConnectionPoolMetrics get_metrics() const { return m_pool.get_metrics(); }
+
+	/**
+	 * @return ratio of max_size connections currently lent, between 0 and 1
+	 */
+	float get_utilization() const;
+
+private:
+	std::unique_ptr<RedisClient> create_client();
+	void validate_client(RedisClient &client) const;
+
+	std::string m_host = "";
+	uint16_t m_port = 6379;
+	uint32_t m_circuit_breaker_interval = 0;
+	uint32_t m_max_size = 0;
+	std::chrono::milliseconds m_ping_interval = std::chrono::seconds(5);
+	std::atomic<time_t> m_last_failed_connection{0};
+
+	// Must be last: its constructor calls create_client
+	db::ConnectionPool<RedisClient> m_pool;
+};
+}
@@ -101,3 +101,11 @@ void trim(std::string &str);
  * @return
  */
 bool replace(std::string &str, const std::string &from, const std::string &to);
+
+/**
+ * Append JSON escaped string, with quotes, to buf
+ * @param buf destination
+ * @param str string to escape, can contain NUL characters
+ * @param len str length
+ */
+void json_append_string(std::string &buf, const char *str, size_t len);
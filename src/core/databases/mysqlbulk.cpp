@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/mysqlbulk.h"
+#include "databases/mysqlclient.h"
+#include "databases/log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <errmsg.h>
+
+namespace winterwind
+{
+namespace db
+{
+
+static std::string mysql_columns_list(const std::vector<std::string> &columns)
+{
+	std::string list;
+	for (const auto &column : columns) {
+		list += list.empty() ? " (" : ",";
+		list += column;
+	}
+
+	if (!list.empty()) {
+		list += ")";
+	}
+
+	return list;
+}
+
+/*
+ * MySQL batch inserter
+ */
+
+MySQLBatchInserter::MySQLBatchInserter(MySQLClient &client, const std::string &table,
+	const std::vector<std::string> &columns, size_t max_statement_size):
+	m_client(client),
+	m_prefix("INSERT INTO " + table + mysql_columns_list(columns) + " VALUES ")
+{
+	MySQLResult res = m_client.exec("SELECT @@max_allowed_packet");
+	if (!res.next()) {
+		throw MySQLException("unable to read max_allowed_packet");
+	}
+
+	// Keep room for packet header, server enforces a 1024 bytes minimum
+	const size_t max_allowed_packet = res.get<size_t>(0);
+	const size_t max_packet = max_allowed_packet > 2048 ? max_allowed_packet - 1024 :
+		max_allowed_packet / 2;
+	m_max_statement_size = max_statement_size == 0 ? max_packet :
+		std::min(max_statement_size, max_packet);
+}
+
+void MySQLBatchInserter::begin_field()
+{
+	m_row += m_row_fields++ == 0 ? '(' : ',';
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write(bool value)
+{
+	begin_field();
+	m_row += value ? '1' : '0';
+	return *this;
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write(int64_t value)
+{
+	begin_field();
+	m_row += std::to_string(value);
+	return *this;
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write(uint64_t value)
+{
+	begin_field();
+	m_row += std::to_string(value);
+	return *this;
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write(double value)
+{
+	// MySQL has no NaN & infinity
+	if (!std::isfinite(value)) {
+		return write_null();
+	}
+
+	begin_field();
+	char buf[32];
+	const int len = snprintf(buf, sizeof(buf), "%.17g", value);
+	m_row.append(buf, (size_t) len);
+	return *this;
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write(const char *value, size_t len)
+{
+	begin_field();
+	m_row += '\'';
+	const size_t offset = m_row.size();
+	m_row.resize(offset + len * 2 + 1);
+	const unsigned long escaped_len = mysql_real_escape_string(m_client.m_conn,
+		&m_row[offset], value, len);
+	m_row.resize(offset + escaped_len);
+	m_row += '\'';
+	return *this;
+}
+
+MySQLBatchInserter &MySQLBatchInserter::write_null()
+{
+	begin_field();
+	m_row += "NULL";
+	return *this;
+}
+
+void MySQLBatchInserter::end_row()
+{
+	if (m_row_fields == 0) {
+		throw MySQLException("batch insert: empty row");
+	}
+
+	m_row += ')';
+	m_row_fields = 0;
+
+	if (m_statement_rows > 0 && m_statement.size() + 1 + m_row.size() > m_max_statement_size) {
+		flush();
+	}
+
+	if (m_statement_rows == 0) {
+		if (m_prefix.size() + m_row.size() > m_max_statement_size) {
+			m_row.clear();
+			throw MySQLException("batch insert: row exceeds maximum statement size ("
+				+ std::to_string(m_max_statement_size) + " bytes)");
+		}
+
+		m_statement = m_prefix;
+	} else {
+		m_statement += ',';
+	}
+
+	m_statement += m_row;
+	m_statement_rows++;
+	m_row.clear();
+}
+
+void MySQLBatchInserter::flush()
+{
+	if (m_statement_rows == 0) {
+		return;
+	}
+
+	// Record every batch under the same statement
+	m_client.exec(m_statement, m_prefix);
+	m_rows += m_statement_rows;
+	m_statement.clear();
+	m_statement_rows = 0;
+}
+
+uint64_t MySQLBatchInserter::end()
+{
+	flush();
+	return m_rows;
+}
+
+/*
+ * MySQL bulk loader
+ */
+
+MySQLBulkLoader::MySQLBulkLoader(MySQLClient &client, const std::string &table,
+	const std::vector<std::string> &columns, size_t buffer_size):
+	m_client(client),
+	m_query("LOAD DATA LOCAL INFILE 'winterwind_bulk_load' INTO TABLE " + table +
+		" CHARACTER SET " + std::string(mysql_character_set_name(client.m_conn)) +
+		" FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\' LINES TERMINATED BY '\\n'" +
+		mysql_columns_list(columns)),
+	m_buffer_size(buffer_size)
+{
+	if (!m_client.m_local_infile) {
+		throw MySQLException("bulk load requires local infile, see "
+			"MySQLClient::set_local_infile");
+	}
+
+	m_buffer.reserve(m_buffer_size);
+}
+
+void MySQLBulkLoader::begin_field()
+{
+	if (m_row_fields++ > 0) {
+		m_buffer += '\t';
+	}
+}
+
+MySQLBulkLoader &MySQLBulkLoader::write(int64_t value)
+{
+	begin_field();
+	m_buffer += std::to_string(value);
+	return *this;
+}
+
+MySQLBulkLoader &MySQLBulkLoader::write(uint64_t value)
+{
+	begin_field();
+	m_buffer += std::to_string(value);
+	return *this;
+}
+
+MySQLBulkLoader &MySQLBulkLoader::write(double value)
+{
+	// MySQL has no NaN & infinity
+	if (!std::isfinite(value)) {
+		return write_null();
+	}
+
+	begin_field();
+	char buf[32];
+	const int len = snprintf(buf, sizeof(buf), "%.17g", value);
+	m_buffer.append(buf, (size_t) len);
+	return *this;
+}
+
+MySQLBulkLoader &MySQLBulkLoader::write(const char *value, size_t len)
+{
+	begin_field();
+	size_t last = 0;
+	for (size_t i = 0; i < len; i++) {
+		const char c = value[i];
+		if (c != '\\' && c != '\t' && c != '\n' && c != '\r' && c != '\0') {
+			continue;
+		}
+
+		m_buffer.append(value + last, i - last);
+		last = i + 1;
+		switch (c) {
+			case '\\': m_buffer += "\\\\"; break;
+			case '\t': m_buffer += "\\t"; break;
+			case '\n': m_buffer += "\\n"; break;
+			case '\r': m_buffer += "\\r"; break;
+			default: m_buffer += "\\0"; break;
+		}
+	}
+
+	m_buffer.append(value + last, len - last);
+	return *this;
+}
+
+MySQLBulkLoader &MySQLBulkLoader::write_null()
+{
+	begin_field();
+	m_buffer += "\\N";
+	return *this;
+}
+
+void MySQLBulkLoader::end_row()
+{
+	if (m_row_fields == 0) {
+		throw MySQLException("bulk load: empty row");
+	}
+
+	m_buffer += '\n';
+	m_row_fields = 0;
+
+	if (m_buffer.size() >= m_buffer_size) {
+		flush();
+	}
+}
+
+int MySQLBulkLoader::infile_init(void **ptr, const char *, void *userdata)
+{
+	*ptr = userdata;
+	return 0;
+}
+
+int MySQLBulkLoader::infile_read(void *ptr, char *buf, unsigned int buf_len)
+{
+	MySQLBulkLoader *loader = (MySQLBulkLoader *) ptr;
+	const size_t len = std::min((size_t) buf_len,
+		loader->m_buffer.size() - loader->m_read_offset);
+	memcpy(buf, loader->m_buffer.data() + loader->m_read_offset, len);
+	loader->m_read_offset += len;
+	return (int) len;
+}
+
+void MySQLBulkLoader::infile_end(void *)
+{
+}
+
+int MySQLBulkLoader::infile_error(void *, char *error_msg, unsigned int error_msg_len)
+{
+	snprintf(error_msg, error_msg_len, "bulk load read error");
+	return CR_UNKNOWN_ERROR;
+}
+
+void MySQLBulkLoader::flush()
+{
+	if (m_buffer.empty()) {
+		return;
+	}
+
+	// Reconnection replaces the handler, it must happen before installing it
+	m_client.check_connection();
+
+	m_read_offset = 0;
+	mysql_set_local_infile_handler(m_client.m_conn, infile_init, infile_read, infile_end,
+		infile_error, this);
+
+	try {
+		m_client.exec(m_query);
+	}
+	catch (MySQLException &) {
+		m_client.reset_local_infile_handler();
+		m_buffer.clear();
+		throw;
+	}
+
+	m_client.reset_local_infile_handler();
+	m_rows += mysql_affected_rows(m_client.m_conn);
+
+	const unsigned int warnings = mysql_warning_count(m_client.m_conn);
+	if (warnings > 0) {
+		log_warn(db_log, "MySQL bulk load: " << warnings << " warnings, some values "
+			"were truncated or converted");
+	}
+
+	m_buffer.clear();
+}
+
+uint64_t MySQLBulkLoader::end()
+{
+	flush();
+	return m_rows;
+}
+
+}
+}
@@ -24,8 +24,14 @@
  */
 
 #include "databases/mysqlclient.h"
+#include "databases/log.h"
+#include "databases/sqlutils.h"
+#include "utils/stringutils.h"
+#include <cstdio>
 #include <cstring>
+#include <errmsg.h>
 #include <iostream>
+#include <sstream>
 
 namespace winterwind
 {
@@ -38,7 +44,8 @@ namespace db
 
 #define MYSQLROW_TO_STRING(_row, i) _row[i] ? std::string((_row)[i], strlen((_row)[i])) : "NULL"
 
-MySQLResult::MySQLResult(MYSQL *conn)
+MySQLResult::MySQLResult(MYSQL *conn):
+	m_conn(conn)
 {
 	m_result = mysql_use_result(conn);
 	if (!m_result && mysql_errno(conn) != 0) {
@@ -46,6 +53,11 @@ MySQLResult::MySQLResult(MYSQL *conn)
 			+ std::to_string(mysql_errno(conn))
 			+ "): '" + std::string(mysql_error(conn)) + "'");
 	}
+
+	if (m_result) {
+		m_fields = mysql_fetch_fields(m_result);
+		m_field_count = mysql_num_fields(m_result);
+	}
 }
 
 MySQLResult::~MySQLResult()
@@ -56,8 +68,183 @@ MySQLResult::~MySQLResult()
 }
 
 MySQLResult::MySQLResult(MySQLResult &&other) noexcept:
-	m_result(other.m_result)
+	m_conn(other.m_conn),
+	m_result(other.m_result),
+	m_fields(other.m_fields),
+	m_field_count(other.m_field_count),
+	m_row(other.m_row),
+	m_lengths(other.m_lengths),
+	m_row_count(other.m_row_count),
+	m_field_indexes(std::move(other.m_field_indexes))
+{
+	other.m_result = nullptr;
+}
+
+bool MySQLResult::next()
 {
+	if (!m_result) {
+		return false;
+	}
+
+	m_row = mysql_fetch_row(m_result);
+	if (!m_row) {
+		if (mysql_errno(m_conn) != 0) {
+			throw MySQLException("row fetching failed " + std::string(mysql_error(m_conn)));
+		}
+
+		return false;
+	}
+
+	m_lengths = mysql_fetch_lengths(m_result);
+	m_row_count++;
+	return true;
+}
+
+size_t MySQLResult::get_field_index(const std::string &name) const
+{
+	if (m_field_indexes.empty()) {
+		for (size_t i = 0; i < m_field_count; i++) {
+			m_field_indexes[m_fields[i].name] = i;
+		}
+	}
+
+	const auto it = m_field_indexes.find(name);
+	if (it == m_field_indexes.end()) {
+		throw MySQLException("unknown result field " + name);
+	}
+
+	return it->second;
+}
+
+static bool mysql_is_json_number(enum_field_types type)
+{
+	switch (type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_YEAR:
+		case MYSQL_TYPE_FLOAT:
+		case MYSQL_TYPE_DOUBLE:
+		case MYSQL_TYPE_DECIMAL:
+		case MYSQL_TYPE_NEWDECIMAL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void MySQLResult::toJsonStream(std::ostream &os, bool named_columns)
+{
+	static const size_t flush_threshold = 64 * 1024;
+
+	// Resolve column output kind & keys once
+	std::vector<bool> numbers(m_field_count);
+	std::vector<std::string> keys(named_columns ? m_field_count : 0);
+	for (size_t col = 0; col < m_field_count; col++) {
+		numbers[col] = mysql_is_json_number(m_fields[col].type);
+		if (named_columns) {
+			json_append_string(keys[col], m_fields[col].name, m_fields[col].name_length);
+			keys[col] += ':';
+		}
+	}
+
+	std::string buf = "[";
+	bool first_row = true;
+	while (next()) {
+		if (!first_row) {
+			buf += ',';
+		}
+		first_row = false;
+
+		buf += named_columns ? '{' : '[';
+		for (size_t col = 0; col < m_field_count; col++) {
+			if (col > 0) {
+				buf += ',';
+			}
+
+			if (named_columns) {
+				buf += keys[col];
+			}
+
+			if (is_null(col)) {
+				buf += "null";
+			} else if (numbers[col]) {
+				// Text numbers are valid JSON numbers
+				buf.append(m_row[col], m_lengths[col]);
+			} else {
+				json_append_string(buf, m_row[col], m_lengths[col]);
+			}
+		}
+		buf += named_columns ? '}' : ']';
+
+		if (buf.size() >= flush_threshold) {
+			os.write(buf.data(), buf.size());
+			buf.clear();
+		}
+	}
+
+	buf += ']';
+	os.write(buf.data(), buf.size());
+}
+
+static void csv_append_field(std::string &buf, const char *str, size_t len, char separator)
+{
+	bool quote = false;
+	for (size_t i = 0; i < len && !quote; i++) {
+		quote = str[i] == separator || str[i] == '"' || str[i] == '\n' || str[i] == '\r';
+	}
+
+	if (!quote) {
+		buf.append(str, len);
+		return;
+	}
+
+	buf += '"';
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] == '"') {
+			buf += '"';
+		}
+		buf += str[i];
+	}
+	buf += '"';
+}
+
+void MySQLResult::toCsvStream(std::ostream &os, bool header, char separator)
+{
+	static const size_t flush_threshold = 64 * 1024;
+
+	std::string buf;
+	if (header) {
+		for (size_t col = 0; col < m_field_count; col++) {
+			if (col > 0) {
+				buf += separator;
+			}
+			csv_append_field(buf, m_fields[col].name, m_fields[col].name_length, separator);
+		}
+		buf += "\r\n";
+	}
+
+	while (next()) {
+		for (size_t col = 0; col < m_field_count; col++) {
+			if (col > 0) {
+				buf += separator;
+			}
+
+			if (!is_null(col)) {
+				csv_append_field(buf, m_row[col], m_lengths[col], separator);
+			}
+		}
+		buf += "\r\n";
+
+		if (buf.size() >= flush_threshold) {
+			os.write(buf.data(), buf.size());
+			buf.clear();
+		}
+	}
+
+	os.write(buf.data(), buf.size());
 }
 
 /*
@@ -94,31 +281,196 @@ void MySQLClient::connect()
 			std::string(mysql_error(m_conn)));
 	}
 
+	if (m_local_infile) {
+		unsigned int local_infile = 1;
+		mysql_options(m_conn, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+		reset_local_infile_handler();
+	}
+
 	if (mysql_real_connect(m_conn, m_host.c_str(), m_user.c_str(), m_password.c_str(),
 		(!m_db.empty() ? m_db.c_str() : NULL), m_port, NULL, 0) == NULL) {
 		throw MySQLException("connection failed " + std::string(mysql_error(m_conn)));
 	}
+
+	m_last_activity = std::chrono::steady_clock::now();
 }
 
 void MySQLClient::disconnect()
 {
+	// Statements belong to the connection
+	m_statements.clear();
+	m_statements_lru.clear();
+
 	if (m_conn) {
 		mysql_close(m_conn);
 		m_conn = nullptr;
 	}
 }
 
-MySQLResult MySQLClient::exec(const std::string &query)
+MySQLResult MySQLClient::exec(const std::string &query, const std::string &statement)
 {
 	if (m_check_before_exec) {
 		check_connection();
 	}
 
+	const auto start = m_query_stats ? std::chrono::steady_clock::now() :
+		std::chrono::steady_clock::time_point();
+
+	// Literals would make one statistics entry per query
+	const auto statement_key = [&]() {
+		return !statement.empty() ? statement : normalize_query(query,
+			m_query_stats->get_config().max_query_length);
+	};
+
 	if (mysql_real_query(m_conn, query.c_str(), query.size()) != 0) {
+		on_query_done(mysql_errno(m_conn));
+		if (m_query_stats) {
+			track_query(statement_key(), query, start, true, 0, false);
+		}
+
 		throw MySQLException("query failed " + std::string(mysql_error(m_conn)));
 	}
 
-	 return MySQLResult(m_conn);
+	on_query_done(0);
+	if (!m_query_stats) {
+		return MySQLResult(m_conn);
+	}
+
+	try {
+		MySQLResult result(m_conn);
+		// Rows of a result set are unknown until fetched
+		track_query(statement_key(), query, start, false,
+			mysql_field_count(m_conn) == 0 ? mysql_affected_rows(m_conn) : 0, true);
+		return result;
+	}
+	catch (MySQLException &) {
+		track_query(statement_key(), query, start, true, 0, false);
+		throw;
+	}
+}
+
+MySQLStatement &MySQLClient::prepare(const std::string &query)
+{
+	if (m_check_before_exec) {
+		check_connection();
+	}
+
+	const auto it = m_statements.find(query);
+	if (it != m_statements.end()) {
+		m_statements_lru.splice(m_statements_lru.begin(), m_statements_lru, it->second.lru);
+		return *it->second.statement;
+	}
+
+	std::unique_ptr<MySQLStatement> statement(new MySQLStatement(m_conn, query));
+
+	while (!m_statements.empty() && m_statements.size() >= m_statements_capacity) {
+		evict_statement();
+	}
+
+	auto inserted = m_statements.emplace(query, CachedStatement());
+	CachedStatement &cached = inserted.first->second;
+	cached.statement = std::move(statement);
+	m_statements_lru.push_front(&inserted.first->first);
+	cached.lru = m_statements_lru.begin();
+	return *cached.statement;
+}
+
+void MySQLClient::evict_statement()
+{
+	const std::string *query = m_statements_lru.back();
+	m_statements_lru.pop_back();
+	m_statements.erase(*query);
+}
+
+void MySQLClient::set_statements_capacity(size_t capacity)
+{
+	m_statements_capacity = capacity;
+	while (!m_statements.empty() && m_statements.size() > m_statements_capacity) {
+		evict_statement();
+	}
+}
+
+void MySQLClient::execute(MySQLStatement &stmt)
+{
+	const auto start = m_query_stats ? std::chrono::steady_clock::now() :
+		std::chrono::steady_clock::time_point();
+
+	try {
+		stmt.execute();
+		on_query_done(0);
+	}
+	catch (MySQLException &) {
+		on_query_done(mysql_stmt_errno(stmt.m_stmt));
+		if (m_query_stats) {
+			track_query(stmt.get_query(), stmt.get_query(), start, true, 0, false);
+		}
+		throw;
+	}
+
+	// EXPLAIN cannot replay ? placeholders
+	if (m_query_stats) {
+		track_query(stmt.get_query(), stmt.get_query(), start, false,
+			stmt.get_row_count(), stmt.get_param_count() == 0);
+	}
+}
+
+void MySQLClient::track_query(const std::string &statement, const std::string &query,
+	const std::chrono::steady_clock::time_point &start, bool error, uint64_t rows,
+	bool explainable)
+{
+	const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	m_query_stats->record(statement, duration, rows, error);
+
+	if (!m_query_stats->is_slow(duration)) {
+		return;
+	}
+
+	DatabaseSlowQuery slow_query;
+	slow_query.statement = statement;
+	slow_query.explainable = explainable;
+
+	// Don't copy huge queries (batch inserts) into the log & explain queue
+	const size_t max_length = m_query_stats->get_config().max_query_length;
+	if (query.size() > max_length) {
+		slow_query.query = query.substr(0, max_length) + "...";
+		slow_query.explainable = false;
+	} else {
+		slow_query.query = query;
+	}
+
+	slow_query.duration = duration;
+	slow_query.rows = rows;
+	m_query_stats->report_slow_query(std::move(slow_query));
+}
+
+DatabaseQueryStats::ExplainFunction MySQLClient::create_explain_function() const
+{
+	// Connection is opened on first use, from explain thread
+	auto client = std::make_shared<std::unique_ptr<MySQLClient>>();
+	const std::string host = m_host, user = m_user, password = m_password, db = m_db;
+	const uint16_t port = m_port;
+	return [client, host, user, password, port, db](const DatabaseSlowQuery &query) {
+		if (!*client) {
+			*client = std::make_unique<MySQLClient>(host, user, password, port, db);
+		}
+
+		std::vector<MySQLExplainEntry> entries;
+		(*client)->explain(query.query, entries);
+
+		std::stringstream plan;
+		plan << "id\tselect_type\ttable\ttype\tpossible_keys\tkey\tkey_len\tref\trows"
+			"\tExtra" << std::endl;
+		for (const auto &entry : entries) {
+			plan << entry.id << "\t" << entry.select_type << "\t" << entry.table << "\t"
+				<< entry.type << "\t" << entry.possible_keys << "\t" << entry.key << "\t"
+				<< entry.key_len << "\t" << entry.ref << "\t" << entry.rows << "\t"
+				<< entry.extra << std::endl;
+		}
+
+		return plan.str();
+	};
 }
 
 void MySQLClient::begin()
@@ -138,17 +490,81 @@ void MySQLClient::rollback()
 
 void MySQLClient::check_connection()
 {
-	if (!mysql_ping(m_conn)) {
-		disconnect();
+	if (!m_conn) {
 		connect();
+		return;
 	}
+
+	const auto now = std::chrono::steady_clock::now();
+	if (now - m_last_activity < m_ping_interval) {
+		return;
+	}
+
+	if (mysql_ping(m_conn) == 0) {
+		m_last_activity = now;
+		return;
+	}
+
+	log_warn(db_log, "MySQL connection lost (" << mysql_error(m_conn)
+		<< "), reconnecting");
+	disconnect();
+	connect();
 }
 
-void MySQLClient::list_tables(std::vector<std::string> &result)
+static int local_infile_refuse_init(void **, const char *, void *)
+{
+	return 1;
+}
+
+static int local_infile_refuse_read(void *, char *, unsigned int)
+{
+	return -1;
+}
+
+static void local_infile_refuse_end(void *)
+{
+}
+
+static int local_infile_refuse_error(void *, char *error_msg, unsigned int error_msg_len)
+{
+	snprintf(error_msg, error_msg_len, "LOCAL INFILE is only allowed for bulk loads");
+	return CR_UNKNOWN_ERROR;
+}
+
+void MySQLClient::reset_local_infile_handler()
 {
-	exec("SHOW TABLES");
+	mysql_set_local_infile_handler(m_conn, local_infile_refuse_init,
+		local_infile_refuse_read, local_infile_refuse_end, local_infile_refuse_error,
+		nullptr);
+}
+
+void MySQLClient::set_local_infile(bool enable)
+{
+	if (enable == m_local_infile) {
+		return;
+	}
+
+	m_local_infile = enable;
+	disconnect();
+	connect();
+}
 
-	MySQLResult mysql_res(m_conn);
+void MySQLClient::on_query_done(unsigned int error)
+{
+	if (error == 0) {
+		m_last_activity = std::chrono::steady_clock::now();
+		return;
+	}
+
+	// Server may be gone, ping it on next check
+	if (error == CR_SERVER_GONE_ERROR || error == CR_SERVER_LOST) {
+		m_last_activity = std::chrono::steady_clock::time_point();
+	}
+}
+
+void MySQLClient::list_tables(std::vector<std::string> &result)
+{
+	MySQLResult mysql_res = exec("SHOW TABLES");
 	MYSQL_ROWLOOP(*mysql_res, row) {
 		for (int i = 0; i < num_fields; i++) {
 			result.emplace_back(row[i] ? row[i] : "NULL");
@@ -162,9 +578,7 @@ bool MySQLClient::get_table_definition(const std::string &table, std::string &re
 		return false;
 	}
 
-	exec("SHOW CREATE TABLE " + table);
-
-	MySQLResult mysql_res(m_conn);
+	MySQLResult mysql_res = exec("SHOW CREATE TABLE " + table);
 	MYSQL_ROWLOOP(*mysql_res, row) {
 		for (int i = 0; i < num_fields; i++) {
 			res = (row[i] ? row[i] : "NULL");
@@ -180,14 +594,12 @@ bool MySQLClient::explain(const std::string &q, std::vector<MySQLExplainEntry> &
 		return false;
 	}
 
-	exec("EXPLAIN " + q);
-
-	MySQLResult mysql_res(m_conn);
-	MYSQL_FIELD *field;
+	MySQLResult mysql_res = exec("EXPLAIN " + q);
+	MYSQL_FIELD *fields = mysql_fetch_fields(*mysql_res);
 	MYSQL_ROWLOOP(*mysql_res, row) {
 		MySQLExplainEntry entry;
 		for (int i = 0; i < num_fields; i++) {
-			field = mysql_fetch_field(*mysql_res);
+			MYSQL_FIELD *field = &fields[i];
 			if (strcmp(field->name, "id") == 0) {
 				entry.id = (uint16_t) (row[i] ? atoi(row[i]) : 0);
 			} else if (strcmp(field->name, "select_type") == 0) {
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/mysqlstatement.h"
+#include "databases/mysqlclient.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace winterwind
+{
+namespace db
+{
+
+// Initial string result buffer size, larger values grow buffer on fetch
+static const unsigned long MYSQL_STRING_BUFFER_MIN = 16;
+static const unsigned long MYSQL_STRING_BUFFER_MAX = 256;
+
+MySQLStatement::MySQLStatement(MYSQL *conn, const std::string &query):
+	m_query(query)
+{
+	m_stmt = mysql_stmt_init(conn);
+	if (!m_stmt) {
+		throw MySQLException("unable to init statement " + std::string(mysql_error(conn)));
+	}
+
+	if (mysql_stmt_prepare(m_stmt, query.c_str(), query.size()) != 0) {
+		const std::string error = mysql_stmt_error(m_stmt);
+		mysql_stmt_close(m_stmt);
+		throw MySQLException("statement preparation failed (" + query + "): " + error);
+	}
+
+	m_params.resize(mysql_stmt_param_count(m_stmt));
+	m_param_binds.resize(m_params.size());
+	for (size_t i = 0; i < m_params.size(); i++) {
+		bind_param(i, nullptr);
+	}
+
+	m_metadata = mysql_stmt_result_metadata(m_stmt);
+	if (m_metadata) {
+		try {
+			bind_results();
+		}
+		catch (MySQLException &) {
+			mysql_free_result(m_metadata);
+			mysql_stmt_close(m_stmt);
+			throw;
+		}
+	}
+}
+
+MySQLStatement::~MySQLStatement()
+{
+	if (m_metadata) {
+		mysql_free_result(m_metadata);
+	}
+
+	mysql_stmt_close(m_stmt);
+}
+
+void MySQLStatement::throw_param_count(size_t count) const
+{
+	throw MySQLException("statement expects " + std::to_string(m_params.size())
+		+ " parameters, " + std::to_string(count) + " given (" + m_query + ")");
+}
+
+void MySQLStatement::throw_error(const std::string &action) const
+{
+	throw MySQLException("statement " + action + " failed (" + m_query + "): "
+		+ std::string(mysql_stmt_error(m_stmt)));
+}
+
+MYSQL_BIND &MySQLStatement::reset_param(size_t idx)
+{
+	if (idx >= m_params.size()) {
+		throw MySQLException("statement parameter " + std::to_string(idx)
+			+ " out of range (" + m_query + ")");
+	}
+
+	Param &param = m_params[idx];
+	param.is_null = 0;
+	param.length = 0;
+
+	MYSQL_BIND &bind = m_param_binds[idx];
+	memset(&bind, 0, sizeof(bind));
+	bind.is_null = &param.is_null;
+	bind.length = &param.length;
+	return bind;
+}
+
+void MySQLStatement::bind_param(size_t idx, std::nullptr_t)
+{
+	MYSQL_BIND &bind = reset_param(idx);
+	bind.buffer_type = MYSQL_TYPE_NULL;
+	m_params[idx].is_null = 1;
+}
+
+void MySQLStatement::bind_param(size_t idx, const std::string &value)
+{
+	MYSQL_BIND &bind = reset_param(idx);
+	Param &param = m_params[idx];
+	param.string = value;
+	param.length = param.string.size();
+	bind.buffer_type = MYSQL_TYPE_STRING;
+	bind.buffer = (void *) param.string.data();
+	bind.buffer_length = param.length;
+}
+
+void MySQLStatement::bind_param(size_t idx, const char *value)
+{
+	if (!value) {
+		bind_param(idx, nullptr);
+		return;
+	}
+
+	bind_param(idx, std::string(value));
+}
+
+void MySQLStatement::bind_param(size_t idx, bool value)
+{
+	bind_integer(idx, value ? 1 : 0, false);
+}
+
+void MySQLStatement::bind_param(size_t idx, double value)
+{
+	MYSQL_BIND &bind = reset_param(idx);
+	m_params[idx].real = value;
+	bind.buffer_type = MYSQL_TYPE_DOUBLE;
+	bind.buffer = &m_params[idx].real;
+}
+
+void MySQLStatement::bind_integer(size_t idx, int64_t value, bool is_unsigned)
+{
+	MYSQL_BIND &bind = reset_param(idx);
+	m_params[idx].integer = value;
+	bind.buffer_type = MYSQL_TYPE_LONGLONG;
+	bind.buffer = &m_params[idx].integer;
+	bind.is_unsigned = (my_bool) is_unsigned;
+}
+
+void MySQLStatement::bind_results()
+{
+	const unsigned int field_count = mysql_num_fields(m_metadata);
+	MYSQL_FIELD *fields = mysql_fetch_fields(m_metadata);
+
+	m_results.resize(field_count);
+	m_result_binds.resize(field_count);
+	for (unsigned int i = 0; i < field_count; i++) {
+		Result &result = m_results[i];
+		result.type = fields[i].type;
+		result.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+
+		MYSQL_BIND &bind = m_result_binds[i];
+		memset(&bind, 0, sizeof(bind));
+		bind.is_null = &result.is_null;
+		bind.error = &result.error;
+		bind.length = &result.length;
+
+		switch (fields[i].type) {
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+				bind.buffer_type = MYSQL_TYPE_LONGLONG;
+				bind.buffer = &result.integer;
+				bind.is_unsigned = (my_bool) result.is_unsigned;
+				break;
+			case MYSQL_TYPE_FLOAT:
+			case MYSQL_TYPE_DOUBLE:
+				bind.buffer_type = MYSQL_TYPE_DOUBLE;
+				bind.buffer = &result.real;
+				break;
+			default:
+				// Strings, blobs, decimals & dates are converted to text by client library
+				result.string.resize(std::max(MYSQL_STRING_BUFFER_MIN,
+					std::min(fields[i].length, MYSQL_STRING_BUFFER_MAX)));
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				bind.buffer = result.string.data();
+				bind.buffer_length = result.string.size();
+				break;
+		}
+	}
+
+	if (mysql_stmt_bind_result(m_stmt, m_result_binds.data()) != 0) {
+		throw_error("result binding");
+	}
+}
+
+void MySQLStatement::execute()
+{
+	// Discard rows left by previous execution
+	mysql_stmt_free_result(m_stmt);
+	m_row_count = 0;
+
+	if (!m_param_binds.empty() && mysql_stmt_bind_param(m_stmt, m_param_binds.data()) != 0) {
+		throw_error("parameters binding");
+	}
+
+	if (mysql_stmt_execute(m_stmt) != 0) {
+		throw_error("execution");
+	}
+
+	if (!m_metadata) {
+		m_row_count = mysql_stmt_affected_rows(m_stmt);
+		return;
+	}
+
+	if (mysql_stmt_store_result(m_stmt) != 0) {
+		throw_error("result fetching");
+	}
+
+	m_row_count = mysql_stmt_num_rows(m_stmt);
+}
+
+bool MySQLStatement::fetch()
+{
+	const int rc = mysql_stmt_fetch(m_stmt);
+	if (rc == MYSQL_NO_DATA) {
+		return false;
+	}
+
+	if (rc == 1) {
+		throw_error("fetch");
+	}
+
+	if (rc != MYSQL_DATA_TRUNCATED) {
+		return true;
+	}
+
+	// Grow truncated string buffers and fetch their full value, next rows will use
+	// the larger buffers
+	for (size_t i = 0; i < m_results.size(); i++) {
+		Result &result = m_results[i];
+		MYSQL_BIND &bind = m_result_binds[i];
+		if (!result.error || bind.buffer_type != MYSQL_TYPE_STRING) {
+			continue;
+		}
+
+		result.string.resize(result.length);
+		bind.buffer = result.string.data();
+		bind.buffer_length = result.string.size();
+		if (mysql_stmt_fetch_column(m_stmt, &bind, (unsigned int) i, 0) != 0) {
+			throw_error("column fetch");
+		}
+
+		result.error = 0;
+	}
+
+	if (mysql_stmt_bind_result(m_stmt, m_result_binds.data()) != 0) {
+		throw_error("result binding");
+	}
+
+	return true;
+}
+
+const char *MySQLStatement::get_field_name(size_t col) const
+{
+	return mysql_fetch_fields(m_metadata)[col].name;
+}
+
+int64_t MySQLStatement::get_int64(size_t col) const
+{
+	const Result &result = m_results[col];
+	if (result.is_null) {
+		return 0;
+	}
+
+	switch (m_result_binds[col].buffer_type) {
+		case MYSQL_TYPE_LONGLONG:
+			return result.integer;
+		case MYSQL_TYPE_DOUBLE:
+			return (int64_t) result.real;
+		default:
+			return result.is_unsigned ? (int64_t) strtoull(get_string(col).c_str(), NULL, 10)
+				: strtoll(get_string(col).c_str(), NULL, 10);
+	}
+}
+
+double MySQLStatement::get_double(size_t col) const
+{
+	const Result &result = m_results[col];
+	if (result.is_null) {
+		return 0;
+	}
+
+	switch (m_result_binds[col].buffer_type) {
+		case MYSQL_TYPE_LONGLONG:
+			return result.is_unsigned ? (double) (uint64_t) result.integer :
+				(double) result.integer;
+		case MYSQL_TYPE_DOUBLE:
+			return result.real;
+		default:
+			return strtod(get_string(col).c_str(), NULL);
+	}
+}
+
+std::string MySQLStatement::get_string(size_t col) const
+{
+	const Result &result = m_results[col];
+	if (result.is_null) {
+		return "";
+	}
+
+	switch (m_result_binds[col].buffer_type) {
+		case MYSQL_TYPE_LONGLONG:
+			return result.is_unsigned ? std::to_string((uint64_t) result.integer) :
+				std::to_string(result.integer);
+		case MYSQL_TYPE_DOUBLE: {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.17g", result.real);
+			return buf;
+		}
+		default:
+			return std::string(result.string.data(),
+				std::min<size_t>(result.length, result.string.size()));
+	}
+}
+
+}
+}
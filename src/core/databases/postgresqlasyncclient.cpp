@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqlasyncclient.h"
+#include "databases/log.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace winterwind
+{
+namespace db
+{
+
+// Delay between two reset attempts of a broken connection
+static const auto reset_retry_interval = std::chrono::seconds(1);
+
+PostgreSQLAsyncClient::PostgreSQLAsyncClient(const std::string &connect_string,
+	uint16_t connections, int32_t minimum_db_version):
+	m_pending(0)
+{
+	if (pipe(m_wakeup_pipe) != 0) {
+		throw PostgreSQLException("PostgreSQL async client: unable to create wakeup pipe");
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	for (uint16_t i = 0; i < std::max<uint16_t>(connections, 1); i++) {
+		std::unique_ptr<Connection> c(new Connection());
+		c->client = std::make_unique<PostgreSQLClient>(connect_string, minimum_db_version);
+		PQsetnonblocking(c->client->m_conn, 1);
+		m_connections.push_back(std::move(c));
+	}
+}
+
+PostgreSQLAsyncClient::~PostgreSQLAsyncClient()
+{
+	stop_and_wait();
+
+	// Event loop was never started
+	fail_queue("PostgreSQL async client stopped");
+
+	for (auto &c : m_connections) {
+		PQclear(c->result);
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		close(fd);
+	}
+}
+
+void PostgreSQLAsyncClient::stop()
+{
+	Thread::stop();
+	wakeup();
+}
+
+void PostgreSQLAsyncClient::register_statement(const std::string &stn, const std::string &st)
+{
+	if (is_running()) {
+		throw PostgreSQLException("PostgreSQL async client: statements must be registered "
+			"before starting event loop");
+	}
+
+	for (auto &c : m_connections) {
+		c->client->register_statement(stn, st);
+	}
+}
+
+void PostgreSQLAsyncClient::exec(const std::string &query,
+	const std::vector<std::string> &params, const QueryCallback &callback,
+	bool binary_results)
+{
+	enqueue(std::unique_ptr<Query>(new Query{query, false, params, binary_results, callback}));
+}
+
+std::future<PostgreSQLResult> PostgreSQLAsyncClient::exec(const std::string &query,
+	const std::vector<std::string> &params, bool binary_results)
+{
+	return enqueue_future(std::unique_ptr<Query>(
+		new Query{query, false, params, binary_results, nullptr}));
+}
+
+void PostgreSQLAsyncClient::exec_prepared(const std::string &stn,
+	const std::vector<std::string> &params, const QueryCallback &callback,
+	bool binary_results)
+{
+	enqueue(std::unique_ptr<Query>(new Query{stn, true, params, binary_results, callback}));
+}
+
+std::future<PostgreSQLResult> PostgreSQLAsyncClient::exec_prepared(const std::string &stn,
+	const std::vector<std::string> &params, bool binary_results)
+{
+	return enqueue_future(std::unique_ptr<Query>(
+		new Query{stn, true, params, binary_results, nullptr}));
+}
+
+std::future<PostgreSQLResult> PostgreSQLAsyncClient::enqueue_future(
+	std::unique_ptr<Query> query)
+{
+	// std::function must be copyable, share the promise
+	auto promise = std::make_shared<std::promise<PostgreSQLResult>>();
+	query->callback = [promise](PostgreSQLResult *result, const std::string &error) {
+		if (result) {
+			promise->set_value(std::move(*result));
+		} else {
+			promise->set_exception(std::make_exception_ptr(PostgreSQLException(error)));
+		}
+	};
+
+	std::future<PostgreSQLResult> future = promise->get_future();
+	enqueue(std::move(query));
+	return future;
+}
+
+void PostgreSQLAsyncClient::enqueue(std::unique_ptr<Query> query)
+{
+	m_pending++;
+	{
+		std::unique_lock<std::mutex> lock(m_queue_mutex);
+		// Event loop drains the queue a last time once stopping, it won't see this one
+		if (!is_stopping()) {
+			m_queue.push_back(std::move(query));
+		}
+	}
+
+	if (query) {
+		notify(*query, nullptr, "PostgreSQL async client stopped");
+		return;
+	}
+
+	wakeup();
+}
+
+void PostgreSQLAsyncClient::wakeup()
+{
+	char c = 0;
+	// Pipe full means event loop has already been woken up
+	ssize_t unused = write(m_wakeup_pipe[1], &c, 1);
+	(void) unused;
+}
+
+void *PostgreSQLAsyncClient::run()
+{
+	Thread::set_thread_name("PostgreSQLAsync");
+
+	ThreadStarted();
+
+	std::vector<pollfd> fds;
+	std::vector<Connection *> fd_connections;
+	while (!is_stopping()) {
+		dispatch();
+
+		fds.clear();
+		fd_connections.clear();
+		fds.push_back({m_wakeup_pipe[0], POLLIN, 0});
+		// Wake up to retry broken connections resets
+		int timeout = -1;
+		for (auto &c : m_connections) {
+			if (c->state == STATE_BROKEN) {
+				timeout = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+					reset_retry_interval).count();
+				continue;
+			}
+
+			int socket = PQsocket(c->client->m_conn);
+			if (socket < 0) {
+				if (c->state == STATE_RESETTING) {
+					reset_failed(*c);
+				}
+				continue;
+			}
+
+			short events = (short) (POLLIN | (c->want_write ? POLLOUT : 0));
+			if (c->state == STATE_RESETTING) {
+				events = c->reset_status == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+			}
+
+			fds.push_back({socket, events, 0});
+			fd_connections.push_back(c.get());
+		}
+
+		if (poll(fds.data(), fds.size(), timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			log_error(db_log, "PostgreSQL async client: poll failed, errno " << errno);
+			break;
+		}
+
+		if (fds[0].revents) {
+			char buf[64];
+			while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+		}
+
+		for (size_t i = 1; i < fds.size(); i++) {
+			Connection &c = *fd_connections[i - 1];
+			if (c.state == STATE_RESETTING) {
+				if (fds[i].revents) {
+					poll_reset(c);
+				}
+				continue;
+			}
+
+			if (fds[i].revents & POLLOUT) {
+				flush(c);
+			}
+
+			// A failed flush starts a connection reset
+			if (c.state != STATE_RESETTING &&
+				(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+				handle_input(c);
+			}
+		}
+	}
+
+	// Fail queries which will never be answered
+	for (auto &c : m_connections) {
+		if (c->query) {
+			PGcancel *cancel = PQgetCancel(c->client->m_conn);
+			if (cancel) {
+				char errbuf[256];
+				PQcancel(cancel, errbuf, sizeof(errbuf));
+				PQfreeCancel(cancel);
+			}
+
+			PGresult *result = nullptr;
+			PQsetnonblocking(c->client->m_conn, 0);
+			while ((result = PQgetResult(c->client->m_conn)) != nullptr) {
+				PQclear(result);
+			}
+			PQsetnonblocking(c->client->m_conn, 1);
+
+			PQclear(c->result);
+			c->result = nullptr;
+			std::unique_ptr<Query> query = std::move(c->query);
+			notify(*query, nullptr, "PostgreSQL async client stopped");
+		}
+	}
+
+	fail_queue("PostgreSQL async client stopped");
+	return nullptr;
+}
+
+void PostgreSQLAsyncClient::fail_queue(const std::string &error)
+{
+	std::deque<std::unique_ptr<Query>> queue;
+	{
+		std::unique_lock<std::mutex> lock(m_queue_mutex);
+		queue.swap(m_queue);
+	}
+
+	for (const auto &query : queue) {
+		notify(*query, nullptr, error);
+	}
+}
+
+void PostgreSQLAsyncClient::dispatch()
+{
+	for (auto &c : m_connections) {
+		if (c->state == STATE_BROKEN) {
+			bool waiting;
+			{
+				std::unique_lock<std::mutex> lock(m_queue_mutex);
+				waiting = !m_queue.empty();
+			}
+
+			// Broken connections are only retried when queries are waiting
+			if (waiting && std::chrono::steady_clock::now() - c->reset_time >=
+					reset_retry_interval) {
+				start_reset(*c);
+			}
+			continue;
+		}
+
+		if (c->query || c->state != STATE_READY) {
+			continue;
+		}
+
+		std::unique_ptr<Query> query;
+		{
+			std::unique_lock<std::mutex> lock(m_queue_mutex);
+			if (m_queue.empty()) {
+				return;
+			}
+
+			query = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		send(*c, std::move(query));
+	}
+}
+
+void PostgreSQLAsyncClient::send(Connection &c, std::unique_ptr<Query> query)
+{
+	PGconn *conn = c.client->m_conn;
+	if (PQstatus(conn) != CONNECTION_OK) {
+		// Query waits for another connection or for this one to be reset
+		{
+			std::unique_lock<std::mutex> lock(m_queue_mutex);
+			m_queue.push_front(std::move(query));
+		}
+
+		start_reset(c);
+		return;
+	}
+
+	std::vector<const char *> params;
+	params.reserve(query->params.size());
+	for (const auto &param : query->params) {
+		params.push_back(param.c_str());
+	}
+
+	int result_format = query->binary_results ? 1 : 0;
+	int sent = query->prepared ?
+		PQsendQueryPrepared(conn, query->query.c_str(), (int) params.size(), params.data(),
+			NULL, NULL, result_format) :
+		PQsendQueryParams(conn, query->query.c_str(), (int) params.size(), NULL,
+			params.data(), NULL, NULL, result_format);
+
+	if (!sent) {
+		notify(*query, nullptr, std::string("PostgreSQL database error: ") +
+			PQerrorMessage(conn));
+		return;
+	}
+
+	c.query = std::move(query);
+	flush(c);
+}
+
+void PostgreSQLAsyncClient::flush(Connection &c)
+{
+	int status = PQflush(c.client->m_conn);
+	if (status < 0) {
+		connection_failed(c);
+		return;
+	}
+
+	c.want_write = status == 1;
+}
+
+void PostgreSQLAsyncClient::handle_input(Connection &c)
+{
+	PGconn *conn = c.client->m_conn;
+	if (!PQconsumeInput(conn)) {
+		connection_failed(c);
+		return;
+	}
+
+	if (c.state == STATE_PREPARING) {
+		handle_prepare_input(c);
+		return;
+	}
+
+	if (!c.query) {
+		// Nothing expected, drop notifications to keep memory bounded
+		PGnotify *notify = nullptr;
+		while ((notify = PQnotifies(conn)) != nullptr) {
+			PQfreemem(notify);
+		}
+		return;
+	}
+
+	while (!PQisBusy(conn)) {
+		PGresult *result = PQgetResult(conn);
+		if (!result) {
+			complete(c);
+			return;
+		}
+
+		// Like PQexec, keep the last result of multi statement queries
+		PQclear(c.result);
+		c.result = result;
+	}
+}
+
+void PostgreSQLAsyncClient::complete(Connection &c)
+{
+	std::unique_ptr<Query> query = std::move(c.query);
+	PGresult *raw_result = c.result;
+	c.result = nullptr;
+
+	ExecStatusType status = PQresultStatus(raw_result);
+	if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+		PostgreSQLResult result(raw_result);
+		notify(*query, &result, "");
+	} else {
+		std::string error = std::string("PostgreSQL database error: ") +
+			(raw_result ? PQresultErrorMessage(raw_result) : PQerrorMessage(c.client->m_conn));
+		PQclear(raw_result);
+		notify(*query, nullptr, error);
+	}
+}
+
+void PostgreSQLAsyncClient::connection_failed(Connection &c)
+{
+	std::string error = std::string("PostgreSQL database error: ") +
+		PQerrorMessage(c.client->m_conn);
+	log_warn(db_log, "PostgreSQL async client: " << error);
+
+	PQclear(c.result);
+	c.result = nullptr;
+	c.want_write = false;
+	if (c.query) {
+		std::unique_ptr<Query> query = std::move(c.query);
+		notify(*query, nullptr, error);
+	}
+
+	start_reset(c);
+}
+
+void PostgreSQLAsyncClient::start_reset(Connection &c)
+{
+	PQclear(c.result);
+	c.result = nullptr;
+	c.want_write = false;
+	c.reset_time = std::chrono::steady_clock::now();
+
+	if (!PQresetStart(c.client->m_conn)) {
+		reset_failed(c);
+		return;
+	}
+
+	// Like PQconnectPoll, first wait for the socket to be writable
+	c.state = STATE_RESETTING;
+	c.reset_status = PGRES_POLLING_WRITING;
+}
+
+void PostgreSQLAsyncClient::poll_reset(Connection &c)
+{
+	PGconn *conn = c.client->m_conn;
+	c.reset_status = PQresetPoll(conn);
+	if (c.reset_status == PGRES_POLLING_FAILED) {
+		reset_failed(c);
+		return;
+	}
+
+	if (c.reset_status != PGRES_POLLING_OK) {
+		return;
+	}
+
+	PQsetnonblocking(conn, 1);
+
+	// Prepared statements are lost with the server session
+	c.statement = c.client->m_statements.begin();
+	prepare_next(c);
+}
+
+void PostgreSQLAsyncClient::reset_failed(Connection &c)
+{
+	std::string error = std::string("PostgreSQL database error: ") +
+		PQerrorMessage(c.client->m_conn);
+	log_warn(db_log, "PostgreSQL async client: unable to reset connection: " << error);
+	c.state = STATE_BROKEN;
+
+	// Without any usable connection, queued queries would wait forever
+	for (const auto &other : m_connections) {
+		if (other->state != STATE_BROKEN) {
+			return;
+		}
+	}
+
+	fail_queue(error);
+}
+
+void PostgreSQLAsyncClient::prepare_next(Connection &c)
+{
+	if (c.statement == c.client->m_statements.end()) {
+		c.state = STATE_READY;
+		return;
+	}
+
+	c.state = STATE_PREPARING;
+	if (!PQsendPrepare(c.client->m_conn, c.statement->first.c_str(),
+		c.statement->second.c_str(), 0, NULL)) {
+		connection_failed(c);
+		return;
+	}
+
+	flush(c);
+}
+
+void PostgreSQLAsyncClient::handle_prepare_input(Connection &c)
+{
+	PGconn *conn = c.client->m_conn;
+	while (!PQisBusy(conn)) {
+		PGresult *result = PQgetResult(conn);
+		if (result) {
+			PQclear(c.result);
+			c.result = result;
+			continue;
+		}
+
+		if (PQresultStatus(c.result) != PGRES_COMMAND_OK) {
+			log_error(db_log, "PostgreSQL async client: unable to prepare statement "
+				<< c.statement->first << ": " << PQresultErrorMessage(c.result));
+		}
+
+		PQclear(c.result);
+		c.result = nullptr;
+		++c.statement;
+		prepare_next(c);
+		return;
+	}
+}
+
+void PostgreSQLAsyncClient::notify(const Query &query, PostgreSQLResult *result,
+	const std::string &error)
+{
+	m_pending--;
+	if (!query.callback) {
+		return;
+	}
+
+	try {
+		query.callback(result, error);
+	}
+	catch (std::exception &e) {
+		log_error(db_log, "PostgreSQL async client: query callback thrown exception: "
+			<< e.what());
+	}
+}
+
+}
+}
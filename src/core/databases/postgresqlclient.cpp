@@ -24,12 +24,17 @@
  */
 
 #include "databases/postgresqlclient.h"
+#include "databases/sqlutils.h"
+#include "utils/stringutils.h"
 #include <cmath>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <poll.h>
 
 namespace winterwind
 {
@@ -42,6 +47,12 @@ PostgreSQLResult::PostgreSQLResult(PGresult *result):
 	switch (m_status) {
 		case PGRES_COMMAND_OK:
 		case PGRES_TUPLES_OK:
+		case PGRES_COPY_IN:
+		case PGRES_COPY_OUT:
+		case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+		case PGRES_TUPLES_CHUNK:
+#endif
 			break;
 		case PGRES_FATAL_ERROR:
 		default: {
@@ -61,6 +72,8 @@ PostgreSQLResult::PostgreSQLResult(PostgreSQLResult &&other) noexcept:
 	m_result(other.m_result),
 	m_status(other.m_status)
 {
+	// Moved object must not clear the result
+	other.m_result = nullptr;
 }
 
 PostgreSQLResult::~PostgreSQLResult()
@@ -68,17 +81,6 @@ PostgreSQLResult::~PostgreSQLResult()
 	PQclear(m_result);
 }
 
-#define BOOLOID                 16
-#define CHAROID                 18
-#define INT8OID                 20
-#define INT2OID                 21
-#define INT4OID                 23
-#define TEXTOID                 25
-#define FLOAT4OID 				700
-#define FLOAT8OID 				701
-
-
-
 void PostgreSQLResult::toJson(Json::Value &res)
 {
 	res.clear();
@@ -95,27 +97,31 @@ void PostgreSQLResult::toJson(Json::Value &res)
 		Json::Value &json_row = res["results"][row];
 
 		for (int col = 0; col < field_number; col++) {
-			if (PQgetisnull(m_result, row, col)) {
-				json_row[col] = nullptr;
+			if (is_null(row, col)) {
+				json_row[col] = Json::Value();
 			}
 			else {
 				switch (PQftype(m_result, col)) {
-					case BOOLOID:
-						json_row[col] = (bool) (strncmp(PQgetvalue(m_result, row, col), "t", sizeof("t")) == 0);
+					case PG_BOOLOID:
+						json_row[col] = get<bool>(row, col);
+						break;
+					case PG_INT2OID:
+					case PG_INT4OID:
+						json_row[col] = get<int32_t>(row, col);
 						break;
-					case INT2OID:
-					case INT4OID:
-					case INT8OID:
-						json_row[col] = std::atoi(PQgetvalue(m_result, row, col));
+					case PG_INT8OID:
+						json_row[col] = (Json::Int64) get<int64_t>(row, col);
 						break;
-					case FLOAT4OID:
-					case FLOAT8OID:
-						json_row[col] = std::atof(PQgetvalue(m_result, row, col));
+					case PG_FLOAT4OID:
+					case PG_FLOAT8OID:
+						json_row[col] = get<double>(row, col);
 						break;
-					case CHAROID:
-					case TEXTOID:
+					// numeric is kept as string to not loose precision
+					case PG_NUMERICOID:
+					case PG_CHAROID:
+					case PG_TEXTOID:
 					default:
-						json_row[col] = PQgetvalue(m_result, row, col);
+						json_row[col] = get<std::string>(row, col);
 						break;
 				}
 			}
@@ -123,6 +129,161 @@ void PostgreSQLResult::toJson(Json::Value &res)
 	}
 }
 
+enum PostgreSQLJsonKind
+{
+	PG_JSON_INTEGER,
+	PG_JSON_FLOAT,
+	PG_JSON_BOOL,
+	PG_JSON_RAW_STRING,
+	PG_JSON_DECODED_STRING,
+};
+
+void PostgreSQLResult::write_json(std::string &buf,
+	const std::function<void(std::string &)> &flush, bool named_columns) const
+{
+	static const size_t flush_threshold = 64 * 1024;
+
+	const int result_count = PQntuples(m_result);
+	const int field_number = PQnfields(m_result);
+
+	// Resolve column output kind & keys once
+	std::vector<PostgreSQLJsonKind> kinds((size_t) field_number);
+	std::vector<std::string> keys;
+	for (int col = 0; col < field_number; col++) {
+		bool binary = PQfformat(m_result, col) == 1;
+		switch (PQftype(m_result, col)) {
+			case PG_BOOLOID: kinds[col] = PG_JSON_BOOL; break;
+			case PG_INT2OID:
+			case PG_INT4OID:
+			case PG_INT8OID: kinds[col] = PG_JSON_INTEGER; break;
+			case PG_FLOAT4OID:
+			case PG_FLOAT8OID: kinds[col] = PG_JSON_FLOAT; break;
+			// Text representation is the same in both formats
+			case PG_CHAROID:
+			case PG_NAMEOID:
+			case PG_TEXTOID:
+			case PG_BPCHAROID:
+			case PG_VARCHAROID:
+			case PG_JSONOID: kinds[col] = PG_JSON_RAW_STRING; break;
+			// bytea must be unescaped, like toJson
+			case PG_BYTEAOID: kinds[col] = PG_JSON_DECODED_STRING; break;
+			default:
+				kinds[col] = binary ? PG_JSON_DECODED_STRING : PG_JSON_RAW_STRING;
+				break;
+		}
+
+		if (named_columns) {
+			const char *name = PQfname(m_result, col);
+			std::string key;
+			json_append_string(key, name, strlen(name));
+			key += ':';
+			keys.push_back(key);
+		}
+	}
+
+	buf += "{\"result_count\":";
+	buf += std::to_string(result_count);
+	buf += ",\"status\":";
+	buf += std::to_string((int) m_status);
+	buf += ",\"results\":";
+	if (result_count == 0) {
+		buf += "null";
+	}
+
+	char numbuf[32];
+	for (int row = 0; row < result_count; row++) {
+		buf += row == 0 ? '[' : ',';
+		buf += named_columns ? '{' : '[';
+		for (int col = 0; col < field_number; col++) {
+			if (col > 0) {
+				buf += ',';
+			}
+
+			if (named_columns) {
+				buf += keys[col];
+			}
+
+			if (is_null(row, col)) {
+				buf += "null";
+				continue;
+			}
+
+			const char *value = PQgetvalue(m_result, row, col);
+			const int len = PQgetlength(m_result, row, col);
+			const bool binary = PQfformat(m_result, col) == 1;
+			switch (kinds[col]) {
+				case PG_JSON_INTEGER:
+					if (binary) {
+						int nlen = snprintf(numbuf, sizeof(numbuf), "%lld",
+							(long long) get<int64_t>(row, col));
+						buf.append(numbuf, (size_t) nlen);
+					} else {
+						// Text integers are valid JSON numbers
+						buf.append(value, (size_t) len);
+					}
+					break;
+				case PG_JSON_FLOAT: {
+					if (binary) {
+						double d = get<double>(row, col);
+						if (!std::isfinite(d)) {
+							buf += "null";
+						} else {
+							int nlen = snprintf(numbuf, sizeof(numbuf), "%.17g", d);
+							buf.append(numbuf, (size_t) nlen);
+						}
+					} else if (value[0] == 'N' || value[0] == 'I' || value[1] == 'I') {
+						// NaN, Infinity & -Infinity have no JSON representation
+						buf += "null";
+					} else {
+						buf.append(value, (size_t) len);
+					}
+					break;
+				}
+				case PG_JSON_BOOL:
+					buf += (binary ? value[0] != 0 : value[0] == 't') ? "true" : "false";
+					break;
+				case PG_JSON_RAW_STRING:
+					json_append_string(buf, value, (size_t) len);
+					break;
+				case PG_JSON_DECODED_STRING: {
+					std::string decoded = get<std::string>(row, col);
+					json_append_string(buf, decoded.data(), decoded.size());
+					break;
+				}
+			}
+		}
+		buf += named_columns ? '}' : ']';
+
+		if (flush && buf.size() >= flush_threshold) {
+			flush(buf);
+		}
+	}
+
+	if (result_count > 0) {
+		buf += ']';
+	}
+	buf += '}';
+
+	if (flush) {
+		flush(buf);
+	}
+}
+
+void PostgreSQLResult::toJsonString(std::string &res, bool named_columns) const
+{
+	write_json(res, nullptr, named_columns);
+}
+
+void PostgreSQLResult::toJsonStream(std::ostream &os, bool named_columns) const
+{
+	std::string buf;
+	buf.reserve(72 * 1024);
+	write_json(buf, [&os](std::string &data) {
+		os.write(data.data(), data.size());
+		data.clear();
+	}, named_columns);
+}
+
 /*
  * PostgreSQL Client
  */
@@ -189,26 +350,437 @@ void PostgreSQLClient::check_connection()
 			PQerrorMessage(m_conn));
 	}
 
-	PQresetStart(m_conn);
+	reset();
+}
+
+void PostgreSQLClient::reset()
+{
+	PQreset(m_conn);
+	if (PQstatus(m_conn) != CONNECTION_OK) {
+		throw PostgreSQLException(std::string("PostgreSQL database error: ") +
+			PQerrorMessage(m_conn));
+	}
+
+	on_reconnect();
+}
+
+void PostgreSQLClient::on_reconnect()
+{
+	// Prepared statements don't survive server session
+	m_auto_statements.clear();
+	m_auto_statements_lru.clear();
+
+	for (const auto &statement : m_statements) {
+		PostgreSQLResult stmt(PQprepare(m_conn, statement.first.c_str(),
+			statement.second.c_str(), 0, NULL));
+	}
+}
+
+PostgreSQLResult PostgreSQLClient::exec(const char *query, bool binary_results)
+{
+	if (m_check_before_exec) {
+		check_connection();
+	}
+
+	const auto start = m_query_stats ? std::chrono::steady_clock::now() :
+		std::chrono::steady_clock::time_point();
+
+	// Only extended query protocol permits to choose result format
+	PGresult *result = binary_results ?
+		PQexecParams(m_conn, query, 0, NULL, NULL, NULL, NULL, 1) : PQexec(m_conn, query);
+
+	if (m_query_stats) {
+		// Literals would make one statistics entry per query
+		const std::string statement = normalize_query(query,
+			m_query_stats->get_config().max_query_length);
+		track_query(result, start, statement.c_str(), query, 0, NULL, NULL);
+	}
+
+	return PostgreSQLResult(result);
+}
+
+PostgreSQLResult PostgreSQLClient::exec_params(const std::string &sql,
+	PostgreSQLParams &params, bool binary_results)
+{
+	if (m_check_before_exec) {
+		check_connection();
+	}
+
+	const auto start = m_query_stats ? std::chrono::steady_clock::now() :
+		std::chrono::steady_clock::time_point();
+
+	for (uint8_t attempt = 0; ; attempt++) {
+		const std::string stn = prepare_auto_statement(sql);
+		PGresult *result = PQexecPrepared(m_conn, stn.c_str(), params.size(),
+			params.values(), NULL, NULL, binary_results ? 1 : 0);
+
+		// invalid_sql_statement_name: statement was dropped server side (DISCARD ALL,
+		// connection pooler...), prepare it again
+		const char *sqlstate = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+		if (attempt == 0 && sqlstate && strcmp(sqlstate, "26000") == 0) {
+			PQclear(result);
+			const auto it = m_auto_statements.find(sql);
+			m_auto_statements_lru.erase(it->second.lru);
+			m_auto_statements.erase(it);
+			continue;
+		}
+
+		if (m_query_stats) {
+			track_query(result, start, sql.c_str(), sql.c_str(), params.size(),
+				params.values(), NULL);
+		}
+
+		return PostgreSQLResult(result);
+	}
+}
+
+void PostgreSQLClient::notify(const std::string &channel, const std::string &payload)
+{
+	exec_params("SELECT pg_notify($1, $2)", channel, payload);
+}
+
+std::string PostgreSQLClient::prepare_auto_statement(const std::string &sql)
+{
+	const auto it = m_auto_statements.find(sql);
+	if (it != m_auto_statements.end()) {
+		m_auto_statements_lru.splice(m_auto_statements_lru.begin(), m_auto_statements_lru,
+			it->second.lru);
+		return it->second.name;
+	}
+
+	while (m_auto_statements.size() >= m_auto_statements_capacity) {
+		evict_auto_statement();
+	}
+
+	const std::string stn = "winterwind_auto_" + std::to_string(++m_auto_statement_id);
+	PostgreSQLResult stmt(PQprepare(m_conn, stn.c_str(), sql.c_str(), 0, NULL));
+
+	const auto inserted = m_auto_statements.emplace(sql, AutoStatement{stn, {}});
+	m_auto_statements_lru.push_front(&inserted.first->first);
+	inserted.first->second.lru = m_auto_statements_lru.begin();
+	return stn;
 }
 
-PostgreSQLResult PostgreSQLClient::exec(const char *query)
+void PostgreSQLClient::evict_auto_statement()
 {
+	if (m_auto_statements_lru.empty()) {
+		return;
+	}
+
+	const auto it = m_auto_statements.find(*m_auto_statements_lru.back());
+	m_auto_statements_lru.pop_back();
+
+	// Best effort, it can fail in an aborted transaction. Names are unique,
+	// a leaked statement doesn't conflict with next ones.
+	const std::string query = "DEALLOCATE " + it->second.name;
+	PQclear(PQexec(m_conn, query.c_str()));
+	m_auto_statements.erase(it);
+}
+
+void PostgreSQLClient::set_auto_statements_capacity(size_t capacity)
+{
+	m_auto_statements_capacity = std::max<size_t>(capacity, 1);
+	while (m_auto_statements.size() > m_auto_statements_capacity) {
+		evict_auto_statement();
+	}
+}
+
+std::vector<PostgreSQLResult> PostgreSQLClient::exec_batch(const PostgreSQLBatch &batch,
+	bool binary_results)
+{
+	std::vector<PostgreSQLResult> results;
+	if (batch.empty()) {
+		return results;
+	}
+
 	if (m_check_before_exec) {
 		check_connection();
 	}
 
-	PostgreSQLResult result(PQexec(m_conn, query));
-	return result;
+	std::vector<PGresult *> raw_results;
+#ifdef LIBPQ_HAS_PIPELINING
+	exec_pipeline(batch, binary_results, raw_results);
+#else
+	// Pipeline runs in an implicit transaction, do the same
+	bool implicit_transaction = PQtransactionStatus(m_conn) == PQTRANS_IDLE;
+	if (implicit_transaction) {
+		exec("BEGIN;");
+	}
+
+	std::vector<const char *> params;
+	for (const auto &query : batch.m_queries) {
+		params.clear();
+		for (const auto &param : query.params) {
+			params.push_back(param.c_str());
+		}
+
+		PGresult *result = PQexecPrepared(m_conn, query.statement.c_str(),
+			(int) params.size(), params.data(), NULL, NULL, binary_results ? 1 : 0);
+		raw_results.push_back(result);
+
+		ExecStatusType status = PQresultStatus(result);
+		if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+			break;
+		}
+	}
+
+	if (implicit_transaction) {
+		ExecStatusType status = PQresultStatus(raw_results.back());
+		PQclear(PQexec(m_conn, status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK ?
+			"COMMIT;" : "ROLLBACK;"));
+	}
+#endif
+
+	// Report the first failed query, next ones were aborted by it
+	for (size_t i = 0; i < raw_results.size(); i++) {
+		ExecStatusType status = PQresultStatus(raw_results[i]);
+		if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+			continue;
+		}
+
+		std::stringstream ss;
+		ss << "PostgreSQL database error on batch query #" << i << " ("
+			<< batch.m_queries[i].statement << "): "
+			<< (raw_results[i] ? PQresultErrorMessage(raw_results[i]) : "no result");
+
+		for (PGresult *result : raw_results) {
+			PQclear(result);
+		}
+
+		throw PostgreSQLException(ss.str());
+	}
+
+	results.reserve(raw_results.size());
+	for (PGresult *result : raw_results) {
+		results.emplace_back(result);
+	}
+
+	return results;
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+void PostgreSQLClient::exec_pipeline(const PostgreSQLBatch &batch, bool binary_results,
+	std::vector<PGresult *> &results)
+{
+	if (PQenterPipelineMode(m_conn) != 1) {
+		throw PostgreSQLException(std::string("PostgreSQL database error: ") +
+			PQerrorMessage(m_conn));
+	}
+
+	// Non blocking mode permits to read results while sending queries, without
+	// both sides waiting for each other on full socket buffers
+	PQsetnonblocking(m_conn, 1);
+
+	const size_t count = batch.m_queries.size();
+	results.assign(count, nullptr);
+
+	// Sync point is the last pipeline entry, at index count
+	size_t sent = 0, current = 0;
+	bool synced = false;
+	bool error = false;
+	std::vector<const char *> params;
+
+	while (!synced && !error) {
+		int flush_status = 0;
+		while (sent < count) {
+			const PostgreSQLBatch::Query &query = batch.m_queries[sent];
+			params.clear();
+			for (const auto &param : query.params) {
+				params.push_back(param.c_str());
+			}
+
+			if (!PQsendQueryPrepared(m_conn, query.statement.c_str(), (int) params.size(),
+				params.data(), NULL, NULL, binary_results ? 1 : 0)) {
+				error = true;
+				break;
+			}
+
+			if (++sent == count && !PQpipelineSync(m_conn)) {
+				error = true;
+				break;
+			}
+
+			// Socket is full, read pending results before sending more
+			if ((flush_status = PQflush(m_conn)) != 0) {
+				break;
+			}
+		}
+
+		if (error || (flush_status = PQflush(m_conn)) == -1 || !PQconsumeInput(m_conn)) {
+			error = true;
+			break;
+		}
+
+		const size_t pending = sent == count ? count + 1 : sent;
+		while (current < pending && !PQisBusy(m_conn)) {
+			PGresult *result = PQgetResult(m_conn);
+			if (!result) {
+				// End of current query results
+				current++;
+				continue;
+			}
+
+			if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+				PQclear(result);
+				synced = true;
+				break;
+			}
+
+			if (current < count && !results[current]) {
+				results[current] = result;
+			} else {
+				PQclear(result);
+			}
+		}
+
+		if (synced || (sent < count && flush_status == 0)) {
+			continue;
+		}
+
+		pollfd pfd = {PQsocket(m_conn), (short) (POLLIN | (flush_status ? POLLOUT : 0)), 0};
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			error = true;
+		}
+	}
+
+	PQsetnonblocking(m_conn, 0);
+
+	if (error) {
+		std::string errormsg = std::string("PostgreSQL pipeline error: ") +
+			PQerrorMessage(m_conn);
+		for (PGresult *result : results) {
+			PQclear(result);
+		}
+		results.clear();
+
+		// Connection state is unknown, start from a clean one
+		if (PQexitPipelineMode(m_conn) != 1 || PQstatus(m_conn) != CONNECTION_OK) {
+			try {
+				reset();
+			}
+			catch (PostgreSQLException &) {
+				// Report pipeline error, next check_connection will retry
+			}
+		}
+
+		throw PostgreSQLException(errormsg);
+	}
+
+	PQexitPipelineMode(m_conn);
 }
+#endif
 
 PostgreSQLResult PostgreSQLClient::exec_prepared(const char *stmtName,
 	const int paramsNumber, const char **params, const int *paramsLengths,
-	const int *paramsFormats, bool nobinary)
+	const int *paramsFormats, bool binary_results)
 {
-	return PostgreSQLResult(PQexecPrepared(m_conn, stmtName, paramsNumber,
+	const auto start = m_query_stats ? std::chrono::steady_clock::now() :
+		std::chrono::steady_clock::time_point();
+
+	PGresult *result = PQexecPrepared(m_conn, stmtName, paramsNumber,
 		(const char *const *) params,
-		paramsLengths, paramsFormats, nobinary ? 1 : 0));
+		paramsLengths, paramsFormats, binary_results ? 1 : 0);
+
+	if (m_query_stats) {
+		const auto it = m_statements.find(stmtName);
+		track_query(result, start, stmtName,
+			it != m_statements.end() ? it->second.c_str() : NULL, paramsNumber, params,
+			paramsFormats);
+	}
+
+	return PostgreSQLResult(result);
+}
+
+void PostgreSQLClient::track_query(const PGresult *result,
+	const std::chrono::steady_clock::time_point &start, const char *statement,
+	const char *query, int params_count, const char *const *params,
+	const int *params_formats)
+{
+	const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	const ExecStatusType status = PQresultStatus(result);
+	const bool error = status == PGRES_BAD_RESPONSE || status == PGRES_NONFATAL_ERROR ||
+		status == PGRES_FATAL_ERROR;
+
+	// Returned rows for queries, affected rows for commands
+	const uint64_t rows = status == PGRES_TUPLES_OK ? (uint64_t) PQntuples(result) :
+		strtoull(PQcmdTuples(const_cast<PGresult *>(result)), NULL, 10);
+
+	m_query_stats->record(statement, duration, rows, error);
+
+	if (!m_query_stats->is_slow(duration)) {
+		return;
+	}
+
+	DatabaseSlowQuery slow_query;
+	slow_query.statement = statement;
+	slow_query.explainable = !error && query && !params_formats;
+
+	// Don't copy huge queries into the log & explain queue
+	const std::string full_query = query ? query : statement;
+	const size_t max_length = m_query_stats->get_config().max_query_length;
+	if (full_query.size() > max_length) {
+		slow_query.query = full_query.substr(0, max_length) + "...";
+		slow_query.explainable = false;
+	} else {
+		slow_query.query = full_query;
+	}
+	for (int i = 0; i < params_count; i++) {
+		if (!params[i]) {
+			slow_query.explainable = false;
+		}
+
+		slow_query.params.emplace_back(params[i] ? params[i] : "NULL");
+	}
+
+	slow_query.duration = duration;
+	slow_query.rows = rows;
+	m_query_stats->report_slow_query(std::move(slow_query));
+}
+
+DatabaseQueryStats::ExplainFunction PostgreSQLClient::create_explain_function(
+	const std::string &connect_string)
+{
+	// Connection is opened on first use, from explain thread
+	auto client = std::make_shared<std::unique_ptr<PostgreSQLClient>>();
+	return [connect_string, client](const DatabaseSlowQuery &query) {
+		if (!*client) {
+			*client = std::make_unique<PostgreSQLClient>(connect_string);
+		}
+
+		PostgreSQLParams params;
+		for (const auto &param : query.params) {
+			params.add(param);
+		}
+
+		const auto read_plan = [](const PostgreSQLResult &result) {
+			std::string plan;
+			for (int i = 0; i < PQntuples(*result); i++) {
+				plan += result.get<std::string>(i, 0) + "\n";
+			}
+			return plan;
+		};
+
+		if (is_read_only_query(query.query)) {
+			// ANALYZE runs the query. Queries wrongly classified as read only, like
+			// a SELECT calling a function writing data, are rejected by the server in
+			// a read only transaction, and nothing is kept anyway.
+			(*client)->exec("BEGIN READ ONLY");
+			try {
+				std::string plan = read_plan((*client)->exec_params(
+					"EXPLAIN (ANALYZE, BUFFERS) " + query.query, params));
+				(*client)->rollback();
+				return plan;
+			}
+			catch (PostgreSQLException &) {
+				// Fall back to a plan without execution
+				(*client)->rollback();
+			}
+		}
+
+		return read_plan((*client)->exec_params("EXPLAIN " + query.query, params));
+	};
 }
 
 void PostgreSQLClient::begin()
@@ -247,44 +819,6 @@ void PostgreSQLClient::set_client_encoding(const std::string &encoding)
 	exec(request.c_str());
 }
 
-template<>
-bool PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	return strcmp(PQgetvalue(*res, row, col), "t") == 0;
-}
-
-template<>
-int PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	return atoi(PQgetvalue(*res, row, col));
-}
-
-template<>
-std::string PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	return std::string(PQgetvalue(*res, row, col),
-		(unsigned long) PQgetlength(*res, row, col));
-}
-
-template<>
-uint32_t PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	return (uint32_t) atoi(PQgetvalue(*res, row, col));
-}
-
-template<>
-uint64_t PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	return (uint64_t) atoll(PQgetvalue(*res, row, col));
-}
-
-template<>
-int64_t PostgreSQLClient::read_field(PostgreSQLResult &res, int row, int col)
-{
-	auto *data = (unsigned char *) PQgetvalue(*res, row, col);
-	return (const int64_t) atoll((char *) data);
-}
-
 void PostgreSQLClient::escape_string(const std::string &param, std::string &res)
 {
 	auto *to = new char[(uint32_t) std::ceil(param.size() * 1.5f)];
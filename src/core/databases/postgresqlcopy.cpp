@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqlcopy.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace winterwind
+{
+namespace db
+{
+
+static const char PGCOPY_SIGNATURE[] = "PGCOPY\n\377\r\n";
+static const size_t PGCOPY_SIGNATURE_LEN = 11;
+
+/**
+ * Consume pending results on connection, returning the first one
+ */
+static PGresult *pg_copy_collect_result(PGconn *conn)
+{
+	PGresult *result = PQgetResult(conn);
+	PGresult *extra = nullptr;
+	while ((extra = PQgetResult(conn)) != nullptr) {
+		PQclear(extra);
+	}
+
+	return result;
+}
+
+static inline void pg_copy_append16(std::string &buf, int16_t v)
+{
+	uint16_t n = htons((uint16_t) v);
+	buf.append((const char *) &n, sizeof(n));
+}
+
+static inline void pg_copy_append32(std::string &buf, int32_t v)
+{
+	uint32_t n = htonl((uint32_t) v);
+	buf.append((const char *) &n, sizeof(n));
+}
+
+static inline void pg_copy_append64(std::string &buf, int64_t v)
+{
+	pg_copy_append32(buf, (int32_t) ((uint64_t) v >> 32));
+	pg_copy_append32(buf, (int32_t) ((uint64_t) v & 0xFFFFFFFF));
+}
+
+static inline int16_t pg_copy_read16(const char *p)
+{
+	uint16_t n;
+	memcpy(&n, p, sizeof(n));
+	return (int16_t) ntohs(n);
+}
+
+static inline int32_t pg_copy_read32(const char *p)
+{
+	uint32_t n;
+	memcpy(&n, p, sizeof(n));
+	return (int32_t) ntohl(n);
+}
+
+PostgreSQLCopyWriter::PostgreSQLCopyWriter(PostgreSQLClient &client,
+	const std::string &table, const std::vector<std::string> &columns,
+	PostgreSQLCopyFormat format, size_t buffer_size):
+	m_conn(client.m_conn),
+	m_format(format),
+	m_buffer_size(buffer_size)
+{
+	std::string query = "COPY " + table;
+	if (!columns.empty()) {
+		query += " (";
+		for (size_t i = 0; i < columns.size(); i++) {
+			if (i > 0) {
+				query += ", ";
+			}
+			query += columns[i];
+		}
+		query += ")";
+	}
+
+	query += " FROM STDIN";
+	if (m_format == PG_COPY_BINARY) {
+		query += " (FORMAT binary)";
+	}
+
+	PostgreSQLResult result = client.exec(query.c_str());
+	if (result.get_status() != PGRES_COPY_IN) {
+		throw PostgreSQLException("PostgreSQL COPY: server didn't switch to COPY IN "
+			"mode for table " + table);
+	}
+
+	// Client connection may have been reset by exec
+	m_conn = client.m_conn;
+	m_running = true;
+	m_buffer.reserve(m_buffer_size + 1024);
+
+	if (m_format == PG_COPY_BINARY) {
+		m_buffer.append(PGCOPY_SIGNATURE, PGCOPY_SIGNATURE_LEN);
+		// Flags & header extension length
+		pg_copy_append32(m_buffer, 0);
+		pg_copy_append32(m_buffer, 0);
+	}
+}
+
+PostgreSQLCopyWriter::~PostgreSQLCopyWriter()
+{
+	abort();
+}
+
+void PostgreSQLCopyWriter::begin_field()
+{
+	if (m_format == PG_COPY_BINARY) {
+		if (m_row_fields == 0) {
+			// Field count is written when row is closed
+			m_row_start = m_buffer.size();
+			pg_copy_append16(m_buffer, 0);
+		}
+	} else if (m_row_fields > 0) {
+		m_buffer += '\t';
+	}
+
+	m_row_fields++;
+}
+
+void PostgreSQLCopyWriter::write_binary_field(const char *data, int32_t len)
+{
+	begin_field();
+	pg_copy_append32(m_buffer, len);
+	m_buffer.append(data, (size_t) len);
+}
+
+void PostgreSQLCopyWriter::write_text_escaped(const char *data, size_t len)
+{
+	size_t last = 0;
+	for (size_t i = 0; i < len; i++) {
+		char escaped;
+		switch (data[i]) {
+			case '\\': escaped = '\\'; break;
+			case '\n': escaped = 'n'; break;
+			case '\r': escaped = 'r'; break;
+			case '\t': escaped = 't'; break;
+			default: continue;
+		}
+
+		m_buffer.append(data + last, i - last);
+		m_buffer += '\\';
+		m_buffer += escaped;
+		last = i + 1;
+	}
+
+	m_buffer.append(data + last, len - last);
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(bool value)
+{
+	if (m_format == PG_COPY_BINARY) {
+		char v = value ? 1 : 0;
+		write_binary_field(&v, 1);
+	} else {
+		begin_field();
+		m_buffer += value ? 't' : 'f';
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(int16_t value)
+{
+	if (m_format == PG_COPY_BINARY) {
+		begin_field();
+		pg_copy_append32(m_buffer, sizeof(value));
+		pg_copy_append16(m_buffer, value);
+	} else {
+		begin_field();
+		m_buffer += std::to_string(value);
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(int32_t value)
+{
+	begin_field();
+	if (m_format == PG_COPY_BINARY) {
+		pg_copy_append32(m_buffer, sizeof(value));
+		pg_copy_append32(m_buffer, value);
+	} else {
+		m_buffer += std::to_string(value);
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(int64_t value)
+{
+	begin_field();
+	if (m_format == PG_COPY_BINARY) {
+		pg_copy_append32(m_buffer, sizeof(value));
+		pg_copy_append64(m_buffer, value);
+	} else {
+		m_buffer += std::to_string(value);
+	}
+	return *this;
+}
+
+/**
+ * Text representation of floating values accepted by all PostgreSQL versions
+ */
+static void pg_copy_format_float(std::string &buf, double value, int precision)
+{
+	if (std::isnan(value)) {
+		buf += "NaN";
+	} else if (std::isinf(value)) {
+		buf += value > 0 ? "Infinity" : "-Infinity";
+	} else {
+		char tmp[32];
+		int len = snprintf(tmp, sizeof(tmp), "%.*g", precision, value);
+		buf.append(tmp, (size_t) len);
+	}
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(float value)
+{
+	begin_field();
+	if (m_format == PG_COPY_BINARY) {
+		uint32_t n;
+		memcpy(&n, &value, sizeof(n));
+		pg_copy_append32(m_buffer, sizeof(value));
+		pg_copy_append32(m_buffer, (int32_t) n);
+	} else {
+		pg_copy_format_float(m_buffer, value, 9);
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(double value)
+{
+	begin_field();
+	if (m_format == PG_COPY_BINARY) {
+		uint64_t n;
+		memcpy(&n, &value, sizeof(n));
+		pg_copy_append32(m_buffer, sizeof(value));
+		pg_copy_append64(m_buffer, (int64_t) n);
+	} else {
+		pg_copy_format_float(m_buffer, value, 17);
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write(const char *value, size_t len)
+{
+	if (m_format == PG_COPY_BINARY) {
+		write_binary_field(value, (int32_t) len);
+	} else {
+		begin_field();
+		write_text_escaped(value, len);
+	}
+	return *this;
+}
+
+PostgreSQLCopyWriter &PostgreSQLCopyWriter::write_null()
+{
+	begin_field();
+	if (m_format == PG_COPY_BINARY) {
+		pg_copy_append32(m_buffer, -1);
+	} else {
+		m_buffer += "\\N";
+	}
+	return *this;
+}
+
+void PostgreSQLCopyWriter::end_row()
+{
+	if (!m_running) {
+		throw PostgreSQLException("PostgreSQL COPY: writer is not running");
+	}
+
+	if (m_format == PG_COPY_BINARY) {
+		if (m_row_fields == 0) {
+			pg_copy_append16(m_buffer, 0);
+		} else {
+			uint16_t n = htons((uint16_t) m_row_fields);
+			memcpy(&m_buffer[m_row_start], &n, sizeof(n));
+		}
+	} else {
+		m_buffer += '\n';
+	}
+
+	m_row_fields = 0;
+	m_rows++;
+
+	if (m_buffer.size() >= m_buffer_size) {
+		flush();
+	}
+}
+
+void PostgreSQLCopyWriter::flush()
+{
+	if (m_buffer.empty()) {
+		return;
+	}
+
+	if (PQputCopyData(m_conn, m_buffer.data(), (int) m_buffer.size()) != 1) {
+		throw PostgreSQLException(std::string("PostgreSQL COPY: unable to send data: ") +
+			PQerrorMessage(m_conn));
+	}
+
+	m_buffer.clear();
+}
+
+uint64_t PostgreSQLCopyWriter::end()
+{
+	if (!m_running) {
+		throw PostgreSQLException("PostgreSQL COPY: writer is not running");
+	}
+
+	if (m_row_fields != 0) {
+		throw PostgreSQLException("PostgreSQL COPY: last row was not closed");
+	}
+
+	if (m_format == PG_COPY_BINARY) {
+		// File trailer
+		pg_copy_append16(m_buffer, -1);
+	}
+
+	flush();
+
+	m_running = false;
+	if (PQputCopyEnd(m_conn, nullptr) != 1) {
+		throw PostgreSQLException(std::string("PostgreSQL COPY: unable to end COPY: ") +
+			PQerrorMessage(m_conn));
+	}
+
+	PostgreSQLResult result(pg_copy_collect_result(m_conn));
+	return std::strtoull(PQcmdTuples(*result), nullptr, 10);
+}
+
+void PostgreSQLCopyWriter::abort(const std::string &reason)
+{
+	if (!m_running) {
+		return;
+	}
+
+	m_running = false;
+	m_buffer.clear();
+	m_row_fields = 0;
+
+	if (PQputCopyEnd(m_conn, reason.c_str()) == 1) {
+		// The error result reporting the abort is expected, drop it
+		PQclear(pg_copy_collect_result(m_conn));
+	}
+}
+
+PostgreSQLCopyReader::PostgreSQLCopyReader(PostgreSQLClient &client,
+	const std::string &query, PostgreSQLCopyFormat format):
+	m_format(format)
+{
+	std::string copy_query = "COPY (" + query + ") TO STDOUT";
+	if (m_format == PG_COPY_BINARY) {
+		copy_query += " (FORMAT binary)";
+	}
+
+	PostgreSQLResult result = client.exec(copy_query.c_str());
+	if (result.get_status() != PGRES_COPY_OUT) {
+		throw PostgreSQLException("PostgreSQL COPY: server didn't switch to COPY OUT "
+			"mode");
+	}
+
+	m_conn = client.m_conn;
+	m_running = true;
+}
+
+PostgreSQLCopyReader::~PostgreSQLCopyReader()
+{
+	if (m_row) {
+		PQfreemem(m_row);
+	}
+
+	if (!m_running) {
+		return;
+	}
+
+	// Read and drop remaining rows, connection is usable afterwards
+	char *buf = nullptr;
+	while (PQgetCopyData(m_conn, &buf, 0) > 0) {
+		PQfreemem(buf);
+		buf = nullptr;
+	}
+
+	PQclear(pg_copy_collect_result(m_conn));
+}
+
+bool PostgreSQLCopyReader::next()
+{
+	if (m_row) {
+		PQfreemem(m_row);
+		m_row = nullptr;
+	}
+
+	m_fields.clear();
+
+	while (m_running) {
+		int len = PQgetCopyData(m_conn, &m_row, 0);
+		if (len < 0) {
+			// -1 means COPY is done, -2 an error, final result reports it
+			finish();
+			return false;
+		}
+
+		if (m_format == PG_COPY_BINARY) {
+			if (parse_binary_row(m_row, len)) {
+				m_rows++;
+				return true;
+			}
+
+			// Trailer, next call returns end of COPY
+			PQfreemem(m_row);
+			m_row = nullptr;
+			continue;
+		}
+
+		parse_text_row(m_row, len);
+		m_rows++;
+		return true;
+	}
+
+	return false;
+}
+
+void PostgreSQLCopyReader::finish()
+{
+	m_running = false;
+	PostgreSQLResult result(pg_copy_collect_result(m_conn));
+}
+
+void PostgreSQLCopyReader::parse_text_row(const char *row, int len)
+{
+	if (len > 0 && row[len - 1] == '\n') {
+		len--;
+	}
+
+	size_t field_count = 0;
+	const char *end = row + len;
+	const char *p = row;
+	while (true) {
+		const char *field_end = p;
+		while (field_end < end && *field_end != '\t') {
+			field_end++;
+		}
+
+		if (m_text_fields.size() <= field_count) {
+			m_text_fields.emplace_back();
+		}
+
+		std::string &field = m_text_fields[field_count];
+		field.clear();
+
+		Field f = {nullptr, 0};
+		if (field_end - p == 2 && p[0] == '\\' && p[1] == 'N') {
+			f.len = -1;
+		} else {
+			for (const char *c = p; c < field_end; c++) {
+				if (*c != '\\' || c + 1 == field_end) {
+					field += *c;
+					continue;
+				}
+
+				c++;
+				switch (*c) {
+					case 'b': field += '\b'; break;
+					case 'f': field += '\f'; break;
+					case 'n': field += '\n'; break;
+					case 'r': field += '\r'; break;
+					case 't': field += '\t'; break;
+					case 'v': field += '\v'; break;
+					case 'x': {
+						int v = 0, digits = 0;
+						while (digits < 2 && c + 1 < field_end && isxdigit(c[1])) {
+							c++;
+							v = v * 16 + (isdigit(*c) ? *c - '0' : (tolower(*c) - 'a' + 10));
+							digits++;
+						}
+						field += (char) v;
+						break;
+					}
+					default:
+						if (*c >= '0' && *c <= '7') {
+							int v = *c - '0', digits = 1;
+							while (digits < 3 && c + 1 < field_end && c[1] >= '0' && c[1] <= '7') {
+								c++;
+								v = v * 8 + (*c - '0');
+								digits++;
+							}
+							field += (char) v;
+						} else {
+							field += *c;
+						}
+						break;
+				}
+			}
+			f.len = (int) field.size();
+		}
+
+		m_fields.push_back(f);
+		field_count++;
+
+		if (field_end >= end) {
+			break;
+		}
+		p = field_end + 1;
+	}
+
+	// Strings are stable now, point fields to them
+	for (size_t i = 0; i < m_fields.size(); i++) {
+		m_fields[i].data = m_text_fields[i].c_str();
+	}
+}
+
+bool PostgreSQLCopyReader::parse_binary_row(const char *row, int len)
+{
+	const char *p = row;
+	const char *end = row + len;
+
+	if (m_rows == 0 && !m_header_read) {
+		if (len < (int) PGCOPY_SIGNATURE_LEN + 8 ||
+			memcmp(p, PGCOPY_SIGNATURE, PGCOPY_SIGNATURE_LEN) != 0) {
+			throw PostgreSQLException("PostgreSQL COPY: invalid binary header");
+		}
+
+		p += PGCOPY_SIGNATURE_LEN + 4;
+		int32_t extension_len = pg_copy_read32(p);
+		p += 4;
+		if (extension_len < 0 || end - p < extension_len) {
+			throw PostgreSQLException("PostgreSQL COPY: invalid binary header");
+		}
+		p += extension_len;
+		m_header_read = true;
+	}
+
+	if (end - p < 2) {
+		throw PostgreSQLException("PostgreSQL COPY: truncated binary row");
+	}
+
+	int16_t field_count = pg_copy_read16(p);
+	p += 2;
+	if (field_count < 0) {
+		return false;
+	}
+
+	for (int16_t i = 0; i < field_count; i++) {
+		if (end - p < 4) {
+			throw PostgreSQLException("PostgreSQL COPY: truncated binary row");
+		}
+
+		Field f = {nullptr, pg_copy_read32(p)};
+		p += 4;
+		if (f.len >= 0) {
+			if (end - p < f.len) {
+				throw PostgreSQLException("PostgreSQL COPY: truncated binary row");
+			}
+			f.data = p;
+			p += f.len;
+		}
+		m_fields.push_back(f);
+	}
+
+	return true;
+}
+
+uint64_t PostgreSQLCopyReader::read_all(
+	const std::function<void(const PostgreSQLCopyReader &)> &callback)
+{
+	uint64_t count = 0;
+	while (next()) {
+		callback(*this);
+		count++;
+	}
+
+	return count;
+}
+
+}
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqllistener.h"
+#include "databases/log.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace winterwind
+{
+namespace db
+{
+
+PostgreSQLListener::PostgreSQLListener(const std::string &connect_string,
+	std::chrono::milliseconds reconnect_interval, size_t max_queue_size):
+	m_client(std::make_unique<PostgreSQLClient>(connect_string)),
+	m_reconnect_interval(reconnect_interval),
+	m_max_queue_size(max_queue_size),
+	m_ready(false),
+	m_reconnections(0)
+{
+	if (pipe(m_wakeup_pipe) != 0) {
+		throw PostgreSQLException("PostgreSQL listener: unable to create wakeup pipe");
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+}
+
+PostgreSQLListener::~PostgreSQLListener()
+{
+	stop_and_wait();
+
+	for (int fd : m_wakeup_pipe) {
+		close(fd);
+	}
+}
+
+void PostgreSQLListener::stop()
+{
+	Thread::stop();
+	wakeup();
+}
+
+void PostgreSQLListener::wakeup()
+{
+	char c = 0;
+	// Pipe full means listener thread has already been woken up
+	ssize_t unused = write(m_wakeup_pipe[1], &c, 1);
+	(void) unused;
+}
+
+void PostgreSQLListener::listen(const std::string &channel, const Callback &callback)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_channels_mutex);
+		m_channels[channel] = callback;
+	}
+	wakeup();
+}
+
+void PostgreSQLListener::unlisten(const std::string &channel)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_channels_mutex);
+		m_channels.erase(channel);
+	}
+	wakeup();
+}
+
+void PostgreSQLListener::add_reconnect_callback(const std::function<void()> &callback)
+{
+	std::unique_lock<std::mutex> lock(m_channels_mutex);
+	m_reconnect_callbacks.push_back(callback);
+}
+
+bool PostgreSQLListener::pop_notification(PostgreSQLNotification &notification)
+{
+	try {
+		notification = m_queue.pop_front();
+	}
+	catch (ThreadSafeQueueEmptyException &) {
+		return false;
+	}
+
+	return true;
+}
+
+void *PostgreSQLListener::run()
+{
+	Thread::set_thread_name("PostgreSQLListen");
+
+	ThreadStarted();
+
+	while (!is_stopping()) {
+		int timeout = -1;
+		if (!m_connected) {
+			try {
+				m_client->check_connection();
+				m_connected = true;
+				m_reconnections++;
+				m_reconnected = true;
+				log_info(db_log, "PostgreSQL listener: connection restored");
+			}
+			catch (PostgreSQLException &e) {
+				timeout = (int) m_reconnect_interval.count();
+			}
+		}
+
+		if (m_connected && !sync_channels()) {
+			connection_lost();
+			continue;
+		}
+
+		if (m_connected && m_reconnected) {
+			m_reconnected = false;
+			std::vector<std::function<void()>> callbacks;
+			{
+				std::unique_lock<std::mutex> lock(m_channels_mutex);
+				callbacks = m_reconnect_callbacks;
+			}
+
+			for (const auto &callback : callbacks) {
+				try {
+					callback();
+				}
+				catch (std::exception &e) {
+					log_error(db_log, "PostgreSQL listener: reconnect callback thrown "
+						"exception: " << e.what());
+				}
+			}
+		}
+
+		pollfd fds[2] = {
+			{m_wakeup_pipe[0], POLLIN, 0},
+			{m_connected ? PQsocket(m_client->m_conn) : -1, POLLIN, 0},
+		};
+
+		if (poll(fds, 2, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			log_error(db_log, "PostgreSQL listener: poll failed, errno " << errno);
+			break;
+		}
+
+		if (fds[0].revents) {
+			char buf[64];
+			while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+		}
+
+		if (fds[1].revents) {
+			if (!PQconsumeInput(m_client->m_conn)) {
+				connection_lost();
+				continue;
+			}
+
+			dispatch_notifications();
+		}
+	}
+
+	m_ready = false;
+	return nullptr;
+}
+
+bool PostgreSQLListener::sync_channels()
+{
+	std::vector<std::string> to_listen, to_unlisten;
+	{
+		std::unique_lock<std::mutex> lock(m_channels_mutex);
+		for (const auto &channel : m_channels) {
+			if (m_listening.find(channel.first) == m_listening.end()) {
+				to_listen.push_back(channel.first);
+			}
+		}
+
+		for (const auto &channel : m_listening) {
+			if (m_channels.find(channel) == m_channels.end()) {
+				to_unlisten.push_back(channel);
+			}
+		}
+	}
+
+	PGconn *conn = m_client->m_conn;
+	auto channel_command = [&](const char *command, const std::string &channel) -> bool {
+		char *identifier = PQescapeIdentifier(conn, channel.c_str(), channel.length());
+		if (!identifier) {
+			return false;
+		}
+
+		std::string query = std::string(command) + " " + identifier;
+		PQfreemem(identifier);
+
+		try {
+			m_client->exec(query.c_str());
+		}
+		catch (PostgreSQLException &e) {
+			return false;
+		}
+
+		return true;
+	};
+
+	for (const auto &channel : to_listen) {
+		if (channel_command("LISTEN", channel)) {
+			m_listening.insert(channel);
+			continue;
+		}
+
+		if (PQstatus(conn) != CONNECTION_OK) {
+			return false;
+		}
+
+		// Channel is invalid, retrying is useless
+		log_error(db_log, "PostgreSQL listener: unable to listen on channel " << channel
+			<< ": " << PQerrorMessage(conn));
+		std::unique_lock<std::mutex> lock(m_channels_mutex);
+		m_channels.erase(channel);
+	}
+
+	for (const auto &channel : to_unlisten) {
+		if (!channel_command("UNLISTEN", channel) && PQstatus(conn) != CONNECTION_OK) {
+			return false;
+		}
+
+		m_listening.erase(channel);
+	}
+
+	m_ready = true;
+
+	// Notifications may have been received during commands
+	dispatch_notifications();
+	return true;
+}
+
+void PostgreSQLListener::dispatch_notifications()
+{
+	PGnotify *notify = nullptr;
+	while ((notify = PQnotifies(m_client->m_conn)) != nullptr) {
+		PostgreSQLNotification notification{notify->relname,
+			notify->extra ? notify->extra : "", notify->be_pid};
+		PQfreemem(notify);
+
+		Callback callback;
+		{
+			std::unique_lock<std::mutex> lock(m_channels_mutex);
+			const auto it = m_channels.find(notification.channel);
+			if (it == m_channels.end()) {
+				// Channel was unlistened meanwhile
+				continue;
+			}
+			callback = it->second;
+		}
+
+		if (!callback) {
+			if (m_queue.size() >= m_max_queue_size) {
+				log_warn(db_log, "PostgreSQL listener: queue is full, dropping notification "
+					"on channel " << notification.channel);
+				continue;
+			}
+
+			m_queue.push_back(notification);
+			continue;
+		}
+
+		try {
+			callback(notification);
+		}
+		catch (std::exception &e) {
+			log_error(db_log, "PostgreSQL listener: callback thrown exception: " << e.what());
+		}
+	}
+}
+
+void PostgreSQLListener::connection_lost()
+{
+	log_warn(db_log, "PostgreSQL listener: connection lost: "
+		<< PQerrorMessage(m_client->m_conn));
+	m_connected = false;
+	m_ready = false;
+	m_listening.clear();
+}
+
+}
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqlresultcache.h"
+#include "databases/postgresqllistener.h"
+#include <cctype>
+
+namespace winterwind
+{
+namespace db
+{
+
+PostgreSQLResultCache::PostgreSQLResultCache(const PostgreSQLResultCacheConfig &config):
+	m_config(config)
+{
+}
+
+std::string PostgreSQLResultCache::make_key(const std::string &stn,
+	const PostgreSQLParams &params)
+{
+	// Length prefixed values, no separator can be forged by parameters
+	std::string key = stn;
+	for (int i = 0; i < params.size(); i++) {
+		if (params.is_null(i)) {
+			key += "|N";
+			continue;
+		}
+
+		const std::string &value = params.get_value(i);
+		key += '|';
+		key += std::to_string(value.size());
+		key += ':';
+		key += value;
+	}
+
+	return key;
+}
+
+size_t PostgreSQLResultCache::estimate_size(const PGresult *result)
+{
+	static const size_t result_overhead = 512;
+	static const size_t cell_overhead = 16;
+
+	const int rows = PQntuples(result);
+	const int fields = PQnfields(result);
+	size_t size = result_overhead + (size_t) rows * fields * cell_overhead;
+	for (int row = 0; row < rows; row++) {
+		for (int col = 0; col < fields; col++) {
+			size += (size_t) PQgetlength(result, row, col) + 1;
+		}
+	}
+
+	return size;
+}
+
+PostgreSQLResultCache::ResultPtr PostgreSQLResultCache::exec_prepared(
+	PostgreSQLClient &client, const std::string &stn, const std::vector<std::string> &tags,
+	PostgreSQLParams &params, std::chrono::milliseconds ttl)
+{
+	const std::string key = make_key(stn, params);
+	uint64_t start_generation = 0;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const auto it = m_entries.find(key);
+		if (it != m_entries.end()) {
+			if (it->second.expires > std::chrono::steady_clock::now()) {
+				m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+				m_metrics.hits++;
+				return it->second.result;
+			}
+
+			m_metrics.expirations++;
+			remove(it);
+		}
+
+		m_metrics.misses++;
+		start_generation = m_generation;
+	}
+
+	ResultPtr result = std::make_shared<const PostgreSQLResult>(
+		client.exec_statement(stn, params));
+	const size_t size = estimate_size(**result) + key.size();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (size > m_config.max_memory || m_clear_generation > start_generation) {
+		return result;
+	}
+
+	// Data may have changed while query was running
+	for (const auto &tag : tags) {
+		const auto generation = m_tag_generations.find(tag);
+		if (generation != m_tag_generations.end() && generation->second > start_generation) {
+			return result;
+		}
+	}
+
+	// Another thread may have cached the same query meanwhile
+	const auto existing = m_entries.find(key);
+	if (existing != m_entries.end()) {
+		remove(existing);
+	}
+
+	while (m_metrics.memory + size > m_config.max_memory && !m_lru.empty()) {
+		remove(m_entries.find(*m_lru.back()));
+		m_metrics.evictions++;
+	}
+
+	const auto expires = std::chrono::steady_clock::now() +
+		(ttl.count() > 0 ? ttl : m_config.ttl);
+	const auto inserted = m_entries.emplace(key, Entry{result, expires, size, tags, {}}).first;
+	m_lru.push_front(&inserted->first);
+	inserted->second.lru = m_lru.begin();
+	for (const auto &tag : tags) {
+		m_tags[tag].insert(&inserted->first);
+	}
+
+	m_metrics.memory += size;
+	return result;
+}
+
+void PostgreSQLResultCache::remove(EntryMap::iterator it)
+{
+	m_lru.erase(it->second.lru);
+	for (const auto &tag : it->second.tags) {
+		const auto tag_it = m_tags.find(tag);
+		if (tag_it == m_tags.end()) {
+			continue;
+		}
+
+		tag_it->second.erase(&it->first);
+		if (tag_it->second.empty()) {
+			m_tags.erase(tag_it);
+		}
+	}
+
+	m_metrics.memory -= it->second.size;
+	m_entries.erase(it);
+}
+
+void PostgreSQLResultCache::invalidate_tag(const std::string &tag)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_tag_generations[tag] = ++m_generation;
+
+	const auto tag_it = m_tags.find(tag);
+	if (tag_it == m_tags.end()) {
+		return;
+	}
+
+	// remove() modifies the tag set
+	const std::unordered_set<const std::string *> keys = tag_it->second;
+	for (const std::string *key : keys) {
+		remove(m_entries.find(*key));
+		m_metrics.invalidations++;
+	}
+}
+
+void PostgreSQLResultCache::clear()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_clear_generation = ++m_generation;
+	m_metrics.invalidations += m_entries.size();
+	m_lru.clear();
+	m_tags.clear();
+	m_entries.clear();
+	m_metrics.memory = 0;
+}
+
+void PostgreSQLResultCache::attach(PostgreSQLListener &listener)
+{
+	listener.listen(m_config.channel, [this](const PostgreSQLNotification &notification) {
+		invalidate_tag(notification.payload);
+	});
+
+	listener.add_reconnect_callback([this]() { clear(); });
+}
+
+void PostgreSQLResultCache::install_invalidation_trigger(PostgreSQLClient &client,
+	const std::string &table, const std::string &tag)
+{
+	client.exec("CREATE OR REPLACE FUNCTION winterwind_cache_notify() RETURNS trigger AS $$\n"
+		"BEGIN\n"
+		"	PERFORM pg_notify(TG_ARGV[0], TG_ARGV[1]);\n"
+		"	RETURN NULL;\n"
+		"END;\n"
+		"$$ LANGUAGE plpgsql");
+
+	std::string channel_esc, tag_esc;
+	client.escape_string(m_config.channel, channel_esc);
+	client.escape_string(tag.empty() ? table : tag, tag_esc);
+
+	std::string trigger = "winterwind_cache_" + table;
+	for (char &c : trigger) {
+		if (!isalnum((unsigned char) c)) {
+			c = '_';
+		}
+	}
+
+	client.exec(("DROP TRIGGER IF EXISTS " + trigger + " ON " + table).c_str());
+	client.exec(("CREATE TRIGGER " + trigger + " AFTER INSERT OR UPDATE OR DELETE OR "
+		"TRUNCATE ON " + table + " FOR EACH STATEMENT EXECUTE PROCEDURE "
+		"winterwind_cache_notify('" + channel_esc + "', '" + tag_esc + "')").c_str());
+}
+
+PostgreSQLResultCacheMetrics PostgreSQLResultCache::get_metrics()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_metrics.entries = m_entries.size();
+	return m_metrics;
+}
+
+}
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqlresultstream.h"
+#include <atomic>
+
+namespace winterwind
+{
+namespace db
+{
+
+PostgreSQLResultStream::PostgreSQLResultStream(PostgreSQLClient &client,
+	const std::string &query, const std::vector<std::string> &params,
+	PostgreSQLStreamMode mode, int fetch_size, bool binary_results):
+	m_mode(mode),
+	m_fetch_size(fetch_size > 0 ? fetch_size : 1),
+	m_binary_results(binary_results)
+{
+	client.check_connection();
+	m_conn = client.m_conn;
+	m_in_transaction = client.in_transaction();
+
+	std::vector<const char *> values;
+	values.reserve(params.size());
+	for (const auto &param : params) {
+		values.push_back(param.c_str());
+	}
+
+	if (m_mode == PG_STREAM_CURSOR) {
+		static std::atomic<uint64_t> s_cursor_id(0);
+		m_cursor = "winterwind_stream_" + std::to_string(++s_cursor_id);
+
+		// Cursors only live in a transaction
+		m_own_transaction = PQtransactionStatus(m_conn) == PQTRANS_IDLE;
+		if (m_own_transaction) {
+			client.begin();
+		}
+
+		std::string declare = "DECLARE " + m_cursor + " NO SCROLL CURSOR FOR " + query;
+		try {
+			PostgreSQLResult result(PQexecParams(m_conn, declare.c_str(), (int) values.size(),
+				NULL, values.data(), NULL, NULL, 0));
+		}
+		catch (PostgreSQLException &) {
+			if (m_own_transaction) {
+				PQclear(PQexec(m_conn, "ROLLBACK;"));
+			}
+			throw;
+		}
+
+		m_running = true;
+		return;
+	}
+
+	if (!PQsendQueryParams(m_conn, query.c_str(), (int) values.size(), NULL, values.data(),
+		NULL, NULL, m_binary_results ? 1 : 0)) {
+		throw PostgreSQLException(std::string("PostgreSQL database error: ") +
+			PQerrorMessage(m_conn));
+	}
+
+	m_running = true;
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if (!PQsetChunkedRowsMode(m_conn, m_fetch_size)) {
+#else
+	if (!PQsetSingleRowMode(m_conn)) {
+#endif
+		close(false);
+		throw PostgreSQLException("PostgreSQL database error: unable to enable row "
+			"streaming mode");
+	}
+}
+
+PostgreSQLResultStream::~PostgreSQLResultStream()
+{
+	m_result.reset();
+	close(true);
+}
+
+bool PostgreSQLResultStream::next()
+{
+	if (m_result && m_row + 1 < PQntuples(**m_result)) {
+		m_row++;
+		m_rows++;
+		return true;
+	}
+
+	if (!m_running) {
+		return false;
+	}
+
+	if (m_mode == PG_STREAM_CURSOR ? fetch_cursor() : fetch_rows()) {
+		m_rows++;
+		return true;
+	}
+
+	return false;
+}
+
+bool PostgreSQLResultStream::fetch_rows()
+{
+	// Release previous rows before waiting for next ones
+	m_result.reset();
+
+	PGresult *result = nullptr;
+	while ((result = PQgetResult(m_conn)) != nullptr) {
+		switch (PQresultStatus(result)) {
+			case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+			case PGRES_TUPLES_CHUNK:
+#endif
+				keep_fields(result);
+				m_result.reset(new PostgreSQLResult(result));
+				m_row = 0;
+				if (PQntuples(result) > 0) {
+					return true;
+				}
+				m_result.reset();
+				break;
+			case PGRES_TUPLES_OK:
+			case PGRES_COMMAND_OK:
+				// Final result, without rows in streaming mode
+				keep_fields(result);
+				PQclear(result);
+				break;
+			default: {
+				PGresult *extra = nullptr;
+				while ((extra = PQgetResult(m_conn)) != nullptr) {
+					PQclear(extra);
+				}
+				m_running = false;
+
+				// Throws the error contained in result
+				PostgreSQLResult failed(result);
+				return false;
+			}
+		}
+	}
+
+	m_running = false;
+	return false;
+}
+
+bool PostgreSQLResultStream::fetch_cursor()
+{
+	m_result.reset();
+
+	std::string fetch = "FETCH FORWARD " + std::to_string(m_fetch_size) + " FROM " + m_cursor;
+	try {
+		m_result.reset(new PostgreSQLResult(PQexecParams(m_conn, fetch.c_str(), 0, NULL,
+			NULL, NULL, NULL, m_binary_results ? 1 : 0)));
+	}
+	catch (PostgreSQLException &) {
+		close(false);
+		throw;
+	}
+
+	keep_fields(**m_result);
+	m_row = 0;
+	if (PQntuples(**m_result) > 0) {
+		return true;
+	}
+
+	m_result.reset();
+	close(true);
+	return false;
+}
+
+void PostgreSQLResultStream::keep_fields(const PGresult *result)
+{
+	if (m_has_fields) {
+		return;
+	}
+
+	int fields = PQnfields(result);
+	m_fields.reserve((size_t) fields);
+	for (int i = 0; i < fields; i++) {
+		m_fields.emplace_back(PQfname(result, i));
+	}
+
+	m_has_fields = true;
+}
+
+int PostgreSQLResultStream::get_field_count() const
+{
+	if (!m_has_fields) {
+		throw PostgreSQLException("PostgreSQL result stream: no result fetched yet");
+	}
+
+	return (int) m_fields.size();
+}
+
+const std::string &PostgreSQLResultStream::get_field_name(int col) const
+{
+	if (col < 0 || col >= get_field_count()) {
+		throw PostgreSQLException("PostgreSQL result stream: invalid field index "
+			+ std::to_string(col));
+	}
+
+	return m_fields[col];
+}
+
+void PostgreSQLResultStream::close(bool success)
+{
+	if (!m_running) {
+		return;
+	}
+
+	m_running = false;
+
+	if (m_mode == PG_STREAM_CURSOR) {
+		if (m_own_transaction) {
+			PQclear(PQexec(m_conn, success ? "COMMIT;" : "ROLLBACK;"));
+		} else {
+			PQclear(PQexec(m_conn, ("CLOSE " + m_cursor).c_str()));
+		}
+		return;
+	}
+
+	// Stop server sending remaining rows, then drop what was already sent.
+	// Cancelling would abort caller transaction, read all rows in that case
+	PGcancel *cancel = m_in_transaction ? nullptr : PQgetCancel(m_conn);
+	if (cancel) {
+		char errbuf[256];
+		PQcancel(cancel, errbuf, sizeof(errbuf));
+		PQfreeCancel(cancel);
+	}
+
+	PGresult *result = nullptr;
+	while ((result = PQgetResult(m_conn)) != nullptr) {
+		PQclear(result);
+	}
+}
+
+}
+}
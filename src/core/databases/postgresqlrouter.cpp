@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqlrouter.h"
+#include "databases/log.h"
+#include "databases/sqlutils.h"
+#include <algorithm>
+
+namespace winterwind
+{
+namespace db
+{
+
+PostgreSQLRouter::PostgreSQLRouter(const std::string &primary,
+	const std::vector<std::string> &replicas, const PostgreSQLRouterConfig &config):
+	m_config(config),
+	m_primary(std::make_unique<PostgreSQLClient>(primary))
+{
+	m_replicas.resize(replicas.size());
+	for (size_t i = 0; i < replicas.size(); i++) {
+		m_replicas[i].connect_string = replicas[i];
+	}
+
+	check_health(true);
+}
+
+bool PostgreSQLRouter::in_primary_transaction() const
+{
+	return m_primary->in_transaction();
+}
+
+void PostgreSQLRouter::check_health(bool force)
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (!force && now - m_last_health_check < m_config.health_check_interval) {
+		return;
+	}
+
+	m_last_health_check = now;
+	for (auto &replica : m_replicas) {
+		check_replica(replica);
+	}
+}
+
+void PostgreSQLRouter::check_replica(Replica &replica)
+{
+	// Lag is zero when a streaming replica replayed everything it received. Without
+	// a streaming WAL receiver (receiver died, archive recovery or status hidden to
+	// unprivileged users) received WAL can be old: use last replayed transaction
+	// age, which grows when primary is idle. NULL means lag is unknown.
+	static const char *lag_query_10 = "SELECT pg_is_in_recovery(), "
+		"CASE WHEN NOT pg_is_in_recovery() THEN 0 "
+		"WHEN COALESCE((SELECT status = 'streaming' FROM pg_stat_wal_receiver LIMIT 1), "
+		"false) AND pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+		"ELSE EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) "
+		"END::float8";
+	static const char *lag_query_96 = "SELECT pg_is_in_recovery(), "
+		"CASE WHEN NOT pg_is_in_recovery() THEN 0 "
+		"WHEN COALESCE((SELECT status = 'streaming' FROM pg_stat_wal_receiver LIMIT 1), "
+		"false) AND pg_last_xlog_receive_location() = pg_last_xlog_replay_location() "
+		"THEN 0 "
+		"ELSE EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) "
+		"END::float8";
+	// No pg_stat_wal_receiver before 9.6
+	static const char *lag_query_95 = "SELECT pg_is_in_recovery(), "
+		"CASE WHEN NOT pg_is_in_recovery() THEN 0 "
+		"ELSE EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) "
+		"END::float8";
+
+	const bool was_healthy = replica.healthy;
+	try {
+		if (!replica.client) {
+			replica.client = std::make_unique<PostgreSQLClient>(replica.connect_string);
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const int32_t version = replica.client->get_server_version();
+		PostgreSQLResult res = replica.client->exec(version >= 100000 ? lag_query_10 :
+			(version >= 90600 ? lag_query_96 : lag_query_95));
+		const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start);
+
+		replica.latency = replica.latency.count() == 0 ? rtt : (replica.latency * 7 + rtt) / 8;
+		// Replica which never replayed a transaction has an unknown lag
+		if (res.is_null(0, 1)) {
+			replica.lag = std::chrono::milliseconds::max();
+			replica.healthy = false;
+			if (was_healthy) {
+				log_warn(db_log, "PostgreSQL router: replica " << replica.connect_string
+					<< " lag is unknown, disabling it");
+			}
+			return;
+		}
+
+		replica.lag = std::chrono::milliseconds((int64_t) (res.get<double>(0, 1) * 1000));
+		replica.healthy = replica.lag <= m_config.max_lag;
+		if (!replica.healthy && was_healthy) {
+			log_warn(db_log, "PostgreSQL router: replica " << replica.connect_string
+				<< " lag is " << replica.lag.count() << "ms, disabling it");
+		}
+	}
+	catch (PostgreSQLException &e) {
+		replica.healthy = false;
+		if (was_healthy || !replica.client) {
+			log_warn(db_log, "PostgreSQL router: replica " << replica.connect_string
+				<< " is unreachable: " << e.what());
+		}
+	}
+}
+
+PostgreSQLRouter::Replica *PostgreSQLRouter::select_replica()
+{
+	check_health();
+
+	if (m_replicas.empty()) {
+		return nullptr;
+	}
+
+	if (m_config.selection == PG_REPLICA_LEAST_LATENCY) {
+		Replica *best = nullptr;
+		for (auto &replica : m_replicas) {
+			if (replica.healthy && (!best || replica.latency < best->latency)) {
+				best = &replica;
+			}
+		}
+		return best;
+	}
+
+	for (size_t i = 0; i < m_replicas.size(); i++) {
+		const size_t index = (m_next_replica + i) % m_replicas.size();
+		if (m_replicas[index].healthy) {
+			m_next_replica = index + 1;
+			return &m_replicas[index];
+		}
+	}
+
+	return nullptr;
+}
+
+PostgreSQLClient &PostgreSQLRouter::get_reader()
+{
+	if (in_primary_transaction()) {
+		return *m_primary;
+	}
+
+	Replica *replica = select_replica();
+	if (!replica) {
+		m_failovers++;
+		return *m_primary;
+	}
+
+	replica->queries++;
+	return *replica->client;
+}
+
+PostgreSQLResult PostgreSQLRouter::exec(const std::string &query)
+{
+	return is_read_only_query(query) ? exec_read(query) : exec_write(query);
+}
+
+PostgreSQLResult PostgreSQLRouter::exec_read(const std::string &query)
+{
+	if (in_primary_transaction()) {
+		return m_primary->exec(query.c_str());
+	}
+
+	Replica *replica = nullptr;
+	while ((replica = select_replica()) != nullptr) {
+		try {
+			replica->queries++;
+			return replica->client->exec(query.c_str());
+		}
+		catch (PostgreSQLException &e) {
+			// Query errors are returned, connection errors retried elsewhere
+			if (replica->client->is_connected()) {
+				throw;
+			}
+
+			log_warn(db_log, "PostgreSQL router: replica " << replica->connect_string
+				<< " failed: " << e.what());
+			replica->healthy = false;
+		}
+	}
+
+	m_failovers++;
+	return m_primary->exec(query.c_str());
+}
+
+std::vector<PostgreSQLReplicaStatus> PostgreSQLRouter::get_replicas_status() const
+{
+	std::vector<PostgreSQLReplicaStatus> status;
+	for (const auto &replica : m_replicas) {
+		status.push_back({replica.connect_string, replica.healthy, replica.latency,
+			replica.lag, replica.queries});
+	}
+
+	return status;
+}
+
+}
+}
@@ -0,0 +1,764 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/postgresqltypes.h"
+#include "databases/database.h"
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace winterwind
+{
+namespace db
+{
+
+// Microseconds between UNIX epoch and PostgreSQL epoch (2000-01-01)
+static const int64_t PG_EPOCH_OFFSET_US = 946684800LL * 1000000LL;
+
+static inline uint16_t read_be16(const char *d)
+{
+	const auto *u = (const unsigned char *) d;
+	return (uint16_t) ((u[0] << 8) | u[1]);
+}
+
+static inline uint32_t read_be32(const char *d)
+{
+	const auto *u = (const unsigned char *) d;
+	return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16) | ((uint32_t) u[2] << 8) |
+		(uint32_t) u[3];
+}
+
+static inline uint64_t read_be64(const char *d)
+{
+	return ((uint64_t) read_be32(d) << 32) | read_be32(d + 4);
+}
+
+/*
+ * Calendar helpers (proleptic gregorian calendar, see
+ * http://howardhinnant.github.io/date_algorithms.html)
+ */
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const auto yoe = (unsigned) (y - era * 400);
+	const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t) doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t &y, unsigned &m, unsigned &d)
+{
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const auto doe = (unsigned) (z - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = (int64_t) yoe + era * 400 + (m <= 2);
+}
+
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static std::string format_timestamp(int64_t unix_us, bool with_tz)
+{
+	if (unix_us == INT64_MAX) {
+		return "infinity";
+	} else if (unix_us == INT64_MIN) {
+		return "-infinity";
+	}
+
+	const int64_t secs = floor_div(unix_us, 1000000);
+	const int64_t usecs = unix_us - secs * 1000000;
+	const int64_t days = floor_div(secs, 86400);
+	const int64_t day_secs = secs - days * 86400;
+
+	int64_t y;
+	unsigned m, d;
+	civil_from_days(days, y, m, d);
+
+	char buf[64];
+	int len = snprintf(buf, sizeof(buf), "%04lld-%02u-%02u %02d:%02d:%02d",
+		(long long) y, m, d, (int) (day_secs / 3600), (int) (day_secs % 3600 / 60),
+		(int) (day_secs % 60));
+
+	std::string res(buf, (size_t) len);
+	if (usecs != 0) {
+		snprintf(buf, sizeof(buf), ".%06lld", (long long) usecs);
+		res += buf;
+		// Like PostgreSQL, strip trailing zeros
+		res.erase(res.find_last_not_of('0') + 1);
+	}
+
+	if (with_tz) {
+		res += "+00";
+	}
+
+	return res;
+}
+
+static PostgreSQLTimestamp unix_us_to_timestamp(int64_t us)
+{
+	if (us == INT64_MAX) {
+		return PostgreSQLTimestamp::max();
+	} else if (us == INT64_MIN) {
+		return PostgreSQLTimestamp::min();
+	}
+
+	return PostgreSQLTimestamp(std::chrono::duration_cast<PostgreSQLTimestamp::duration>(
+		std::chrono::microseconds(us)));
+}
+
+static std::string double_to_string(double v, bool single_precision)
+{
+	if (std::isnan(v)) {
+		return "NaN";
+	} else if (std::isinf(v)) {
+		return v > 0 ? "Infinity" : "-Infinity";
+	}
+
+	// Shortest representation which round-trips
+	char buf[32];
+	const int max_precision = single_precision ? 9 : 17;
+	for (int p = 1; p <= max_precision; p++) {
+		snprintf(buf, sizeof(buf), "%.*g", p, v);
+		const double r = strtod(buf, nullptr);
+		if (single_precision ? (float) r == (float) v : r == v) {
+			break;
+		}
+	}
+
+	return std::string(buf);
+}
+
+/*
+ * Text format decoders, PostgreSQL text values are always NUL terminated
+ */
+
+static int64_t text_int(const char *d, int)
+{
+	return strtoll(d, nullptr, 10);
+}
+
+static double text_float(const char *d, int)
+{
+	return strtod(d, nullptr);
+}
+
+static bool text_bool(const char *d, int)
+{
+	return d[0] == 't';
+}
+
+static std::string text_raw(const char *d, int len)
+{
+	return std::string(d, (size_t) len);
+}
+
+static std::string text_bytea(const char *d, int)
+{
+	size_t len = 0;
+	unsigned char *raw = PQunescapeBytea((const unsigned char *) d, &len);
+	if (!raw) {
+		return "";
+	}
+
+	std::string res((const char *) raw, len);
+	PQfreemem(raw);
+	return res;
+}
+
+/**
+ * Parse ISO timestamp, with optional timezone offset. Timestamps without offset are
+ * considered as UTC.
+ */
+static int64_t text_timestamp_unix_us(const char *d, int)
+{
+	if (strcmp(d, "infinity") == 0) {
+		return INT64_MAX;
+	} else if (strcmp(d, "-infinity") == 0) {
+		return INT64_MIN;
+	}
+
+	int y = 0, mo = 0, da = 0, h = 0, mi = 0, s = 0, n = 0;
+	if (sscanf(d, "%d-%d-%d %d:%d:%d%n", &y, &mo, &da, &h, &mi, &s, &n) < 6) {
+		return 0;
+	}
+
+	const char *p = d + n;
+	int64_t us = 0;
+	if (*p == '.') {
+		p++;
+		int digits = 0;
+		for (; isdigit(*p); p++) {
+			if (digits < 6) {
+				us = us * 10 + (*p - '0');
+				digits++;
+			}
+		}
+
+		for (; digits < 6; digits++) {
+			us *= 10;
+		}
+	}
+
+	int64_t offset = 0;
+	if (*p == '+' || *p == '-') {
+		const int sign = (*p == '-') ? -1 : 1;
+		int parts[3] = {0, 0, 0};
+		p++;
+		for (int i = 0; i < 3; i++) {
+			if (!isdigit(p[0]) || !isdigit(p[1])) {
+				break;
+			}
+
+			parts[i] = (p[0] - '0') * 10 + (p[1] - '0');
+			p += 2;
+			if (*p == ':') {
+				p++;
+			}
+		}
+
+		offset = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+	}
+
+	const int64_t secs = days_from_civil(y, (unsigned) mo, (unsigned) da) * 86400 +
+		h * 3600 + mi * 60 + s - offset;
+	return secs * 1000000 + us;
+}
+
+/**
+ * Parse text array representation (ex: {1,NULL,"a b"}). Multi dimension arrays are
+ * flattened.
+ */
+static void text_array_elements(const char *d, int len, std::vector<std::string> &elems,
+	std::vector<bool> &nulls)
+{
+	const char *p = d;
+	const char *end = d + len;
+
+	// Skip optional dimensions decoration ([1:3]={...})
+	if (p < end && *p == '[') {
+		while (p < end && *p != '=') {
+			p++;
+		}
+		p++;
+	}
+
+	while (p < end) {
+		if (*p == '{' || *p == '}' || *p == ',') {
+			p++;
+			continue;
+		}
+
+		std::string elem;
+		bool quoted = false;
+		if (*p == '"') {
+			quoted = true;
+			p++;
+			while (p < end && *p != '"') {
+				if (*p == '\\' && p + 1 < end) {
+					p++;
+				}
+				elem += *p++;
+			}
+			p++;
+		} else {
+			while (p < end && *p != ',' && *p != '}') {
+				if (*p == '\\' && p + 1 < end) {
+					p++;
+				}
+				elem += *p++;
+			}
+		}
+
+		nulls.push_back(!quoted && elem == "NULL");
+		elems.push_back(std::move(elem));
+	}
+}
+
+template<typename T>
+static std::vector<T> text_array(const char *d, int len)
+{
+	std::vector<std::string> elems;
+	std::vector<bool> nulls;
+	text_array_elements(d, len, elems, nulls);
+
+	typename PostgreSQLDecoder<T>::Func decoder = PostgreSQLDecoder<T>::resolve(
+		PG_TEXTOID, 0);
+
+	std::vector<T> res;
+	res.reserve(elems.size());
+	for (size_t i = 0; i < elems.size(); i++) {
+		if (nulls[i]) {
+			throw DatabaseException("PostgreSQL: cannot decode NULL array element");
+		}
+
+		res.push_back(decoder(elems[i].c_str(), (int) elems[i].size()));
+	}
+
+	return res;
+}
+
+/*
+ * Binary format decoders
+ */
+
+static int64_t bin_int2(const char *d, int)
+{
+	return (int16_t) read_be16(d);
+}
+
+static int64_t bin_int4(const char *d, int)
+{
+	return (int32_t) read_be32(d);
+}
+
+static int64_t bin_int8(const char *d, int)
+{
+	return (int64_t) read_be64(d);
+}
+
+static int64_t bin_oid(const char *d, int)
+{
+	return read_be32(d);
+}
+
+static double bin_float4(const char *d, int)
+{
+	uint32_t v = read_be32(d);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static double bin_float8(const char *d, int)
+{
+	uint64_t v = read_be64(d);
+	double f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static bool bin_bool(const char *d, int len)
+{
+	return len > 0 && d[0] != 0;
+}
+
+/**
+ * Numeric binary representation: ndigits, weight, sign & dscale (int16) followed by
+ * ndigits base 10000 digits (int16)
+ */
+static std::string bin_numeric(const char *d, int len)
+{
+	if (len < 8) {
+		return "";
+	}
+
+	const auto ndigits = (int16_t) read_be16(d);
+	const auto weight = (int16_t) read_be16(d + 2);
+	const uint16_t sign = read_be16(d + 4);
+	const auto dscale = (int16_t) read_be16(d + 6);
+
+	switch (sign) {
+		case 0xC000: return "NaN";
+		case 0xD000: return "Infinity";
+		case 0xF000: return "-Infinity";
+		default: break;
+	}
+
+	auto digit = [&](int i) -> int {
+		if (i < 0 || i >= ndigits || 8 + (i + 1) * 2 > len) {
+			return 0;
+		}
+		return read_be16(d + 8 + i * 2);
+	};
+
+	std::string res;
+	if (sign == 0x4000) {
+		res += '-';
+	}
+
+	char buf[8];
+	if (weight < 0) {
+		res += '0';
+	} else {
+		for (int i = 0; i <= weight; i++) {
+			snprintf(buf, sizeof(buf), i == 0 ? "%d" : "%04d", digit(i));
+			res += buf;
+		}
+	}
+
+	if (dscale > 0) {
+		std::string fraction;
+		for (int i = weight + 1; (int) fraction.size() < dscale; i++) {
+			snprintf(buf, sizeof(buf), "%04d", digit(i));
+			fraction += buf;
+		}
+
+		fraction.resize((size_t) dscale);
+		res += '.' + fraction;
+	}
+
+	return res;
+}
+
+static int64_t bin_numeric_int(const char *d, int len)
+{
+	return strtoll(bin_numeric(d, len).c_str(), nullptr, 10);
+}
+
+static double bin_numeric_float(const char *d, int len)
+{
+	return strtod(bin_numeric(d, len).c_str(), nullptr);
+}
+
+static std::string bin_uuid(const char *d, int len)
+{
+	if (len != 16) {
+		return "";
+	}
+
+	static const char hex[] = "0123456789abcdef";
+	std::string res;
+	res.reserve(36);
+	for (int i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			res += '-';
+		}
+
+		res += hex[(d[i] >> 4) & 0x0F];
+		res += hex[d[i] & 0x0F];
+	}
+
+	return res;
+}
+
+static int64_t bin_timestamp_unix_us(const char *d, int)
+{
+	const auto v = (int64_t) read_be64(d);
+	if (v == INT64_MAX || v == INT64_MIN) {
+		return v;
+	}
+
+	return v + PG_EPOCH_OFFSET_US;
+}
+
+static std::string bin_timestamp_string(const char *d, int len)
+{
+	return format_timestamp(bin_timestamp_unix_us(d, len), false);
+}
+
+static std::string bin_timestamptz_string(const char *d, int len)
+{
+	return format_timestamp(bin_timestamp_unix_us(d, len), true);
+}
+
+static std::string bin_bool_string(const char *d, int len)
+{
+	return bin_bool(d, len) ? "t" : "f";
+}
+
+static std::string bin_float4_string(const char *d, int len)
+{
+	return double_to_string(bin_float4(d, len), true);
+}
+
+static std::string bin_float8_string(const char *d, int len)
+{
+	return double_to_string(bin_float8(d, len), false);
+}
+
+static std::string bin_jsonb_string(const char *d, int len)
+{
+	// First byte is jsonb format version
+	return len > 0 ? std::string(d + 1, (size_t) len - 1) : "";
+}
+
+/**
+ * Array binary representation: ndim, has_null flag & element type OID, then size &
+ * lower bound for each dimension, then length prefixed elements (-1 for NULL)
+ */
+template<typename T>
+static std::vector<T> bin_array(const char *d, int len)
+{
+	std::vector<T> res;
+	if (len < 12) {
+		return res;
+	}
+
+	const auto ndim = (int32_t) read_be32(d);
+	const Oid elem_type = read_be32(d + 8);
+	if (ndim <= 0 || len < 12 + ndim * 8) {
+		return res;
+	}
+
+	typename PostgreSQLDecoder<T>::Func decoder = PostgreSQLDecoder<T>::resolve(
+		elem_type, 1);
+	if (!decoder) {
+		throw DatabaseException("PostgreSQL: unsupported array element type "
+			+ std::to_string(elem_type));
+	}
+
+	const char *p = d + 12;
+	int64_t count = 1;
+	for (int32_t i = 0; i < ndim; i++, p += 8) {
+		count *= (int32_t) read_be32(p);
+	}
+
+	const char *end = d + len;
+	res.reserve((size_t) count);
+	for (int64_t i = 0; i < count && p + 4 <= end; i++) {
+		const auto elem_len = (int32_t) read_be32(p);
+		p += 4;
+		if (elem_len < 0) {
+			throw DatabaseException("PostgreSQL: cannot decode NULL array element");
+		}
+
+		res.push_back(decoder(p, elem_len));
+		p += elem_len;
+	}
+
+	return res;
+}
+
+/*
+ * Decoders adapters
+ */
+
+template<typename T, int64_t (*F)(const char *, int)>
+static T int_cast(const char *d, int len)
+{
+	return (T) F(d, len);
+}
+
+template<typename T, double (*F)(const char *, int)>
+static T float_cast(const char *d, int len)
+{
+	return (T) F(d, len);
+}
+
+template<int64_t (*F)(const char *, int)>
+static double int_to_float(const char *d, int len)
+{
+	return (double) F(d, len);
+}
+
+template<int64_t (*F)(const char *, int)>
+static std::string int_to_string(const char *d, int len)
+{
+	return std::to_string(F(d, len));
+}
+
+template<int64_t (*F)(const char *, int)>
+static PostgreSQLTimestamp to_timestamp(const char *d, int len)
+{
+	return unix_us_to_timestamp(F(d, len));
+}
+
+template<typename T>
+static typename PostgreSQLDecoder<T>::Func resolve_integer(Oid type, int format)
+{
+	if (format == 0) {
+		return int_cast<T, text_int>;
+	}
+
+	switch (type) {
+		case PG_INT2OID: return int_cast<T, bin_int2>;
+		case PG_INT4OID: return int_cast<T, bin_int4>;
+		case PG_INT8OID: return int_cast<T, bin_int8>;
+		case PG_OIDOID: return int_cast<T, bin_oid>;
+		case PG_NUMERICOID: return int_cast<T, bin_numeric_int>;
+		default: return nullptr;
+	}
+}
+
+template<typename T>
+static typename PostgreSQLDecoder<T>::Func resolve_float(Oid type, int format)
+{
+	if (format == 0) {
+		return float_cast<T, text_float>;
+	}
+
+	switch (type) {
+		case PG_FLOAT4OID: return float_cast<T, bin_float4>;
+		case PG_FLOAT8OID: return float_cast<T, bin_float8>;
+		case PG_INT2OID: return float_cast<T, int_to_float<bin_int2>>;
+		case PG_INT4OID: return float_cast<T, int_to_float<bin_int4>>;
+		case PG_INT8OID: return float_cast<T, int_to_float<bin_int8>>;
+		case PG_NUMERICOID: return float_cast<T, bin_numeric_float>;
+		default: return nullptr;
+	}
+}
+
+template<typename T>
+static typename PostgreSQLDecoder<std::vector<T>>::Func resolve_array(Oid, int format)
+{
+	// Binary arrays embed their element type, decoder is checked when reading
+	return format == 0 ? text_array<T> : bin_array<T>;
+}
+
+template<>
+PostgreSQLDecoder<bool>::Func PostgreSQLDecoder<bool>::resolve(Oid type, int format)
+{
+	if (format == 0) {
+		return text_bool;
+	}
+
+	return type == PG_BOOLOID ? bin_bool : nullptr;
+}
+
+template<>
+PostgreSQLDecoder<int16_t>::Func PostgreSQLDecoder<int16_t>::resolve(Oid type, int format)
+{
+	return resolve_integer<int16_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<int32_t>::Func PostgreSQLDecoder<int32_t>::resolve(Oid type, int format)
+{
+	return resolve_integer<int32_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<int64_t>::Func PostgreSQLDecoder<int64_t>::resolve(Oid type, int format)
+{
+	return resolve_integer<int64_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<uint32_t>::Func PostgreSQLDecoder<uint32_t>::resolve(Oid type,
+	int format)
+{
+	return resolve_integer<uint32_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<uint64_t>::Func PostgreSQLDecoder<uint64_t>::resolve(Oid type,
+	int format)
+{
+	return resolve_integer<uint64_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<float>::Func PostgreSQLDecoder<float>::resolve(Oid type, int format)
+{
+	return resolve_float<float>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<double>::Func PostgreSQLDecoder<double>::resolve(Oid type, int format)
+{
+	return resolve_float<double>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<std::string>::Func PostgreSQLDecoder<std::string>::resolve(Oid type,
+	int format)
+{
+	if (format == 0) {
+		return type == PG_BYTEAOID ? text_bytea : text_raw;
+	}
+
+	switch (type) {
+		case PG_BOOLOID: return bin_bool_string;
+		case PG_INT2OID: return int_to_string<bin_int2>;
+		case PG_INT4OID: return int_to_string<bin_int4>;
+		case PG_INT8OID: return int_to_string<bin_int8>;
+		case PG_OIDOID: return int_to_string<bin_oid>;
+		case PG_FLOAT4OID: return bin_float4_string;
+		case PG_FLOAT8OID: return bin_float8_string;
+		case PG_NUMERICOID: return bin_numeric;
+		case PG_UUIDOID: return bin_uuid;
+		case PG_TIMESTAMPOID: return bin_timestamp_string;
+		case PG_TIMESTAMPTZOID: return bin_timestamptz_string;
+		case PG_JSONBOID: return bin_jsonb_string;
+		// Text types binary representation is the text itself, bytea is raw
+		default: return text_raw;
+	}
+}
+
+template<>
+PostgreSQLDecoder<PostgreSQLTimestamp>::Func
+PostgreSQLDecoder<PostgreSQLTimestamp>::resolve(Oid type, int format)
+{
+	if (format == 0) {
+		return to_timestamp<text_timestamp_unix_us>;
+	}
+
+	switch (type) {
+		case PG_TIMESTAMPOID:
+		case PG_TIMESTAMPTZOID:
+			return to_timestamp<bin_timestamp_unix_us>;
+		default: return nullptr;
+	}
+}
+
+template<>
+PostgreSQLDecoder<std::vector<int16_t>>::Func
+PostgreSQLDecoder<std::vector<int16_t>>::resolve(Oid type, int format)
+{
+	return resolve_array<int16_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<std::vector<int32_t>>::Func
+PostgreSQLDecoder<std::vector<int32_t>>::resolve(Oid type, int format)
+{
+	return resolve_array<int32_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<std::vector<int64_t>>::Func
+PostgreSQLDecoder<std::vector<int64_t>>::resolve(Oid type, int format)
+{
+	return resolve_array<int64_t>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<std::vector<double>>::Func
+PostgreSQLDecoder<std::vector<double>>::resolve(Oid type, int format)
+{
+	return resolve_array<double>(type, format);
+}
+
+template<>
+PostgreSQLDecoder<std::vector<std::string>>::Func
+PostgreSQLDecoder<std::vector<std::string>>::resolve(Oid type, int format)
+{
+	return resolve_array<std::string>(type, format);
+}
+
+}
+}
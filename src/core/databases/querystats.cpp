@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/querystats.h"
+#include "databases/database.h"
+#include "databases/log.h"
+#include "utils/semaphore.h"
+#include "utils/threads.h"
+#include "utils/threadsafequeue.h"
+#include <algorithm>
+#include <cmath>
+
+namespace winterwind
+{
+namespace db
+{
+
+const std::array<std::chrono::microseconds, 17> DatabaseStatementStats::latency_buckets = {{
+	std::chrono::microseconds(50), std::chrono::microseconds(100),
+	std::chrono::microseconds(250), std::chrono::microseconds(500),
+	std::chrono::milliseconds(1), std::chrono::microseconds(2500),
+	std::chrono::milliseconds(5), std::chrono::milliseconds(10),
+	std::chrono::milliseconds(25), std::chrono::milliseconds(50),
+	std::chrono::milliseconds(100), std::chrono::milliseconds(250),
+	std::chrono::milliseconds(500), std::chrono::seconds(1),
+	std::chrono::milliseconds(2500), std::chrono::seconds(5),
+	std::chrono::seconds(10),
+}};
+
+std::chrono::microseconds DatabaseStatementStats::percentile(double p) const
+{
+	const uint64_t target = (uint64_t) std::ceil(p * count);
+	uint64_t cumulated = 0;
+	for (size_t i = 0; i < latency_buckets.size(); i++) {
+		cumulated += histogram[i];
+		if (cumulated >= target && cumulated > 0) {
+			return std::min(latency_buckets[i], max_time);
+		}
+	}
+
+	return max_time;
+}
+
+class DatabaseQueryStats::ExplainThread : public Thread
+{
+public:
+	ExplainThread(DatabaseQueryStats *stats, const ExplainFunction &explain_function):
+		m_stats(stats),
+		m_explain_function(explain_function),
+		m_semaphore(0)
+	{}
+
+	~ExplainThread() override
+	{
+		stop_and_wait();
+	}
+
+	void stop() override
+	{
+		Thread::stop();
+		m_semaphore.post();
+	}
+
+	/**
+	 * @return false if queue is full
+	 */
+	bool push(const DatabaseSlowQuery &query)
+	{
+		if (m_queue.size() >= m_stats->m_config.max_explain_queue) {
+			return false;
+		}
+
+		m_queue.push_back(query);
+		m_semaphore.post();
+		return true;
+	}
+
+	void *run() override
+	{
+		ThreadStarted();
+		set_thread_name("db-explain");
+
+		while (!is_stopping()) {
+			m_semaphore.wait();
+
+			try {
+				DatabaseSlowQuery query = m_queue.pop_front();
+				explain(query);
+			}
+			catch (ThreadSafeQueueEmptyException &) {}
+		}
+
+		return nullptr;
+	}
+
+private:
+	void explain(DatabaseSlowQuery &query)
+	{
+		try {
+			query.plan = m_explain_function(query);
+			log_warn(db_log, "Slow query plan (" << query.statement << "):" << std::endl
+				<< query.plan);
+		}
+		catch (DatabaseException &e) {
+			log_error(db_log, "Unable to explain slow query (" << query.statement
+				<< "): " << e.what());
+		}
+
+		m_stats->notify_slow_query(query);
+	}
+
+	DatabaseQueryStats *m_stats;
+	ExplainFunction m_explain_function;
+	ThreadSafeQueue<DatabaseSlowQuery> m_queue;
+	Semaphore m_semaphore;
+};
+
+DatabaseQueryStats::DatabaseQueryStats(const DatabaseQueryStatsConfig &config):
+	m_config(config)
+{
+}
+
+DatabaseQueryStats::~DatabaseQueryStats()
+{
+	// Stop explain thread before members it uses are destroyed
+	m_explain_thread.reset();
+}
+
+void DatabaseQueryStats::record(const std::string &statement,
+	std::chrono::microseconds duration, uint64_t rows, bool error)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_statements.find(statement);
+	if (it == m_statements.end()) {
+		static const std::string other = "<other>";
+		it = m_statements.emplace(m_statements.size() < m_config.max_statements ?
+			statement : other, DatabaseStatementStats()).first;
+	}
+
+	DatabaseStatementStats &stats = it->second;
+	stats.count++;
+	stats.rows += rows;
+	if (error) {
+		stats.errors++;
+	}
+
+	stats.total_time += duration;
+	stats.max_time = std::max(stats.max_time, duration);
+
+	const auto &buckets = DatabaseStatementStats::latency_buckets;
+	stats.histogram[std::lower_bound(buckets.begin(), buckets.end(), duration) -
+		buckets.begin()]++;
+}
+
+void DatabaseQueryStats::report_slow_query(DatabaseSlowQuery &&query)
+{
+	log_warn(db_log, "Slow query (" << query.duration.count() / 1000.0f << "ms, "
+		<< query.rows << " rows): " << query.query);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_explain_thread && query.explainable) {
+			if (m_explain_thread->push(query)) {
+				return;
+			}
+
+			log_warn(db_log, "Slow query explain queue is full, query not explained");
+		}
+	}
+
+	notify_slow_query(query);
+}
+
+void DatabaseQueryStats::notify_slow_query(const DatabaseSlowQuery &query)
+{
+	SlowQueryCallback callback;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		callback = m_slow_query_callback;
+	}
+
+	if (callback) {
+		callback(query);
+	}
+}
+
+void DatabaseQueryStats::set_explain_function(const ExplainFunction &explain_function)
+{
+	std::unique_ptr<ExplainThread> thread;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		thread = std::move(m_explain_thread);
+		if (explain_function) {
+			m_explain_thread = std::make_unique<ExplainThread>(this, explain_function);
+			m_explain_thread->start();
+		}
+	}
+
+	// Previous thread is stopped outside of lock, it can notify a slow query
+	thread.reset();
+}
+
+void DatabaseQueryStats::set_slow_query_callback(const SlowQueryCallback &callback)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_slow_query_callback = callback;
+}
+
+std::unordered_map<std::string, DatabaseStatementStats>
+	DatabaseQueryStats::get_statements_stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_statements;
+}
+
+DatabaseStatementStats DatabaseQueryStats::get_statement_stats(
+	const std::string &statement) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const auto it = m_statements.find(statement);
+	return it != m_statements.end() ? it->second : DatabaseStatementStats();
+}
+
+void DatabaseQueryStats::reset()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_statements.clear();
+}
+
+}
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "databases/sqlutils.h"
+#include <cctype>
+#include <vector>
+
+namespace winterwind
+{
+namespace db
+{
+
+bool is_read_only_query(const std::string &query)
+{
+	// Split query into upper case words, comments are skipped. Quoted strings
+	// are not parsed, their words can only make query be sent to primary.
+	std::vector<std::string> words;
+	std::string word;
+	for (size_t i = 0; i < query.size(); i++) {
+		const char c = query[i];
+		if (c == '-' && i + 1 < query.size() && query[i + 1] == '-') {
+			i = query.find('\n', i);
+			if (i == std::string::npos) {
+				break;
+			}
+		} else if (c == '/' && i + 1 < query.size() && query[i + 1] == '*') {
+			i = query.find("*/", i + 2);
+			if (i == std::string::npos) {
+				break;
+			}
+			i++;
+		} else if (isalnum((unsigned char) c) || c == '_') {
+			word += (char) toupper((unsigned char) c);
+			continue;
+		}
+
+		if (!word.empty()) {
+			words.push_back(word);
+			word.clear();
+		}
+	}
+
+	if (!word.empty()) {
+		words.push_back(word);
+	}
+
+	if (words.empty()) {
+		return false;
+	}
+
+	const std::string &command = words[0];
+	if (command != "SELECT" && command != "WITH" && command != "SHOW" &&
+		command != "VALUES" && command != "TABLE") {
+		return false;
+	}
+
+	for (size_t i = 1; i < words.size(); i++) {
+		const std::string &w = words[i];
+		// SELECT INTO creates a table
+		if (w == "INTO") {
+			return false;
+		}
+
+		// Locking clauses: FOR UPDATE, FOR NO KEY UPDATE, FOR SHARE, FOR KEY SHARE
+		if (w == "FOR" && i + 1 < words.size() && (words[i + 1] == "UPDATE" ||
+			words[i + 1] == "SHARE" || words[i + 1] == "NO" || words[i + 1] == "KEY")) {
+			return false;
+		}
+
+		// Data modifying CTE
+		if (command == "WITH" && (w == "INSERT" || w == "UPDATE" || w == "DELETE" ||
+			w == "MERGE")) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+std::string normalize_query(const std::string &query, size_t max_length)
+{
+	std::string res;
+	size_t i = 0;
+	for (; i < query.size() && res.size() < max_length; i++) {
+		const char c = query[i];
+		if (c == '\'' || c == '"') {
+			// Quotes are escaped by doubling them or with a backslash
+			for (i++; i < query.size(); i++) {
+				if (query[i] == '\\') {
+					i++;
+				} else if (query[i] == c) {
+					if (i + 1 < query.size() && query[i + 1] == c) {
+						i++;
+					} else {
+						break;
+					}
+				}
+			}
+			res += '?';
+		} else if (isdigit((unsigned char) c) && (i == 0 ||
+			(!isalnum((unsigned char) query[i - 1]) && query[i - 1] != '_'))) {
+			// Numbers, including decimals, exponents & hexadecimal
+			while (i + 1 < query.size() && (isalnum((unsigned char) query[i + 1]) ||
+				query[i + 1] == '.')) {
+				i++;
+			}
+			res += '?';
+		} else if (isspace((unsigned char) c)) {
+			if (!res.empty() && res.back() != ' ') {
+				res += ' ';
+			}
+		} else {
+			res += c;
+		}
+	}
+
+	if (!res.empty() && res.back() == ' ') {
+		res.pop_back();
+	}
+
+	if (i < query.size()) {
+		res += "...";
+	}
+
+	return res;
+}
+
+}
+}
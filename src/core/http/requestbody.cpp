@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "core/http/requestbody.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace winterwind
+{
+namespace http
+{
+
+FileRequestBody::FileRequestBody(int fd, bool close_fd) :
+	m_fd(fd), m_close_fd(close_fd)
+{
+	struct stat st = {};
+	if (fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		m_size = st.st_size;
+	}
+}
+
+FileRequestBody::FileRequestBody(const std::string &path) :
+	m_close_fd(true)
+{
+	m_fd = open(path.c_str(), O_RDONLY);
+	if (m_fd < 0) {
+		throw RequestBodyException("Unable to open " + path + ": " + strerror(errno));
+	}
+
+	struct stat st = {};
+	if (fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		m_size = st.st_size;
+	}
+}
+
+FileRequestBody::~FileRequestBody()
+{
+	if (m_close_fd && m_fd >= 0) {
+		close(m_fd);
+	}
+}
+
+size_t FileRequestBody::read(char *buf, size_t len)
+{
+	ssize_t r;
+	// Regular files are read at offset to permit rewind, pipes & sockets are read
+	// sequentially
+	do {
+		r = (m_size >= 0) ? pread(m_fd, buf, len, m_offset) : ::read(m_fd, buf, len);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0) {
+		return READ_ERROR;
+	}
+
+	m_offset += r;
+	return (size_t) r;
+}
+
+bool FileRequestBody::rewind()
+{
+	if (m_size < 0) {
+		return false;
+	}
+
+	m_offset = 0;
+	return true;
+}
+
+MmapRequestBody::MmapRequestBody(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw RequestBodyException("Unable to open " + path + ": " + strerror(errno));
+	}
+
+	struct stat st = {};
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw RequestBodyException("Unable to stat " + path + ": " + strerror(errno));
+	}
+
+	m_size = (size_t) st.st_size;
+
+	// mmap doesn't support empty mappings
+	if (m_size > 0) {
+		void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			throw RequestBodyException("Unable to map " + path + ": " + strerror(errno));
+		}
+
+		m_data = (char *) data;
+		madvise(m_data, m_size, MADV_SEQUENTIAL);
+	}
+
+	// Mapping stays valid after closing descriptor
+	close(fd);
+}
+
+MmapRequestBody::~MmapRequestBody()
+{
+	if (m_data) {
+		munmap(m_data, m_size);
+	}
+}
+
+size_t MmapRequestBody::read(char *buf, size_t len)
+{
+	size_t to_read = std::min(len, m_size - m_offset);
+	if (to_read > 0) {
+		memcpy(buf, m_data + m_offset, to_read);
+		m_offset += to_read;
+	}
+
+	return to_read;
+}
+
+bool MmapRequestBody::rewind()
+{
+	m_offset = 0;
+	return true;
+}
+
+}
+}
@@ -76,55 +76,67 @@ size_t HTTPClient::curl_writer(char *data, size_t size, size_t nmemb, void *read
 	return realsize;
 }
 
-void HTTPClient::request(const Query &query, std::string &res)
+size_t HTTPClient::curl_reader(char *data, size_t size, size_t nmemb, void *body)
+{
+	size_t r = ((RequestBody *) body)->read(data, size * nmemb);
+	return r == RequestBody::READ_ERROR ? CURL_READFUNC_ABORT : r;
+}
+
+int HTTPClient::curl_seeker(void *body, curl_off_t offset, int origin)
+{
+	if (offset != 0 || origin != SEEK_SET || !((RequestBody *) body)->rewind()) {
+		return CURL_SEEKFUNC_CANTSEEK;
+	}
+
+	return CURL_SEEKFUNC_OK;
+}
+
+static const char *method_str[METHOD_MAX] = {
+	"DELETE",
+	"GET",
+	"HEAD",
+	"PATCH",
+	"POST",
+	"PROPFIND",
+	"PUT",
+};
+
+CURL *HTTPClient::prepare_request(const Query &query, CurlRequest &req)
 {
 	assert(query.get_method() < METHOD_MAX);
 
-	std::string url = query.get_url();
+	req.url = query.get_url();
 
 	CURL *curl = curl_easy_init();
-	m_http_code = 0;
 
 	{
 		std::string buf;
 		bool first_param = true;
 		for (const auto &p : m_uri_params) {
 			if (first_param) {
-				url.append("?");
+				req.url.append("?");
 				first_param = false;
 			} else {
-				url.append("&");
+				req.url.append("&");
 			}
 
 			http_string_escape(p.first, buf);
-			url += buf + "=";
+			req.url += buf + "=";
 			http_string_escape(p.second, buf);
-			url += buf;
+			req.url += buf;
 		}
 	}
 
-	struct curl_slist *chunk = NULL;
-
-	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_URL, req.url.c_str());
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(curl, CURLOPT_MAXFILESIZE,
 		m_maxfilesize); // Limit request size to 20ko
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_writer);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &res);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, req.response);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER,
 		(query.get_flag() & Query::FLAG_NO_VERIFY_PEER) ? 0 : 1);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 1);
 
-	static const char *method_str[METHOD_MAX] = {
-		"DELETE",
-		"GET",
-		"HEAD",
-		"PATCH",
-		"POST",
-		"PROPFIND",
-		"PUT",
-	};
-
 	switch (query.get_method()) {
 		case DELETE:
 		case HEAD:
@@ -146,40 +158,60 @@ void HTTPClient::request(const Query &query, std::string &res)
 
 	for (const auto &h : m_http_headers) {
 		const std::string header = std::string(h.first + ": " + h.second);
-		chunk = curl_slist_append(chunk, header.c_str());
-	}
-
-	if (chunk != nullptr) {
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+		req.headers = curl_slist_append(req.headers, header.c_str());
 	}
 
-	std::string post_data = query.get_post_data();
+	req.post_data = query.get_post_data();
 
 	if (!m_form_params.empty()) {
 		if (!query.get_post_data().empty()) {
 			log_error(httpc_log, "HTTPClient: post_data is not empty while form_params "
 				"storage has elements. This will ignore "
-				" post_data. (url was: " << url << ").");
+				" post_data. (url was: " << req.url << ").");
 		}
-		post_data.clear();
+		req.post_data.clear();
 		std::string buf;
 		bool first_param = true;
 		for (const auto &p : m_form_params) {
 			if (first_param) {
 				first_param = false;
 			} else {
-				post_data.append("&");
+				req.post_data.append("&");
 			}
 
 			http_string_escape(p.first, buf);
-			post_data += buf + "=";
+			req.post_data += buf + "=";
 			http_string_escape(p.second, buf);
-			post_data += buf;
+			req.post_data += buf;
 		}
 	}
 
-	if (!post_data.empty()) {
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data.c_str());
+	if (query.get_body()) {
+		if (!req.post_data.empty()) {
+			log_error(httpc_log, "HTTPClient: post_data is not empty while a body "
+				"source is set. This will ignore post_data. (url was: " << req.url << ").");
+		}
+
+		// Keep body alive until transfer is released
+		req.body = query.get_body();
+		curl_easy_setopt(curl, CURLOPT_POST, 1L);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, curl_reader);
+		curl_easy_setopt(curl, CURLOPT_READDATA, req.body.get());
+		curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, curl_seeker);
+		curl_easy_setopt(curl, CURLOPT_SEEKDATA, req.body.get());
+
+		if (req.body->size() >= 0) {
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+				(curl_off_t) req.body->size());
+		} else {
+			req.headers = curl_slist_append(req.headers, "Transfer-Encoding: chunked");
+		}
+	} else if (!req.post_data.empty()) {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req.post_data.c_str());
+	}
+
+	if (req.headers != nullptr) {
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req.headers);
 	}
 
 // @TODO add flag to add custom headers
@@ -189,28 +221,46 @@ void HTTPClient::request(const Query &query, std::string &res)
 	curl_easy_setopt(curl, CURLOPT_CAINFO, "/etc/ssl/cert.pem");
 #endif
 
-	CURLcode r = curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &m_http_code);
-
-	if (chunk) {
-		curl_slist_free_all(chunk);
+	if ((query.get_flag() & Query::FLAG_KEEP_HEADER_CACHE_AFTER_REQUEST) == 0) {
+		m_http_headers.clear();
 	}
 
-	if (r != CURLE_OK) {
-		log_error(httpc_log, "HTTPClient: curl_easy_perform failed to do request! "
-			"Error was: " << curl_easy_strerror(r));
+	m_uri_params.clear();
+	m_form_params.clear();
+
+	log_debug(httpc_log, "request: " << method_str[query.get_method()] << " " << req.url);
+
+	return curl;
+}
+
+void HTTPClient::release_request(CURL *curl, CurlRequest &req)
+{
+	if (req.headers) {
+		curl_slist_free_all(req.headers);
+		req.headers = nullptr;
 	}
 
+	req.body = nullptr;
+
 	curl_easy_cleanup(curl);
+}
 
-	if ((query.get_flag() & Query::FLAG_KEEP_HEADER_CACHE_AFTER_REQUEST) == 0) {
-		m_http_headers.clear();
-	}
+void HTTPClient::request(const Query &query, std::string &res)
+{
+	m_http_code = 0;
 
-	m_uri_params.clear();
-	m_form_params.clear();
+	CurlRequest req(&res);
+	CURL *curl = prepare_request(query, req);
+
+	CURLcode r = curl_easy_perform(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &m_http_code);
+
+	if (r != CURLE_OK) {
+		log_error(httpc_log, "HTTPClient: curl_easy_perform failed to do request! "
+			"Error was: " << curl_easy_strerror(r));
+	}
 
-	log_debug(httpc_log, "request: " << method_str[query.get_method()] << " " << url);
+	release_request(curl, req);
 }
 
 void HTTPClient::get_html_tag_value(const std::string &url, const std::string &xpath,
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "httpmulticlient.h"
+#include "http/query.h"
+#include <mutex>
+
+namespace winterwind
+{
+namespace http
+{
+
+HTTPMultiClient::HTTPMultiClient(uint32_t max_concurrent_streams,
+	uint32_t max_host_connections, uint32_t max_file_size) :
+	HTTPClient(max_file_size)
+{
+	m_multi = curl_multi_init();
+	curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) max_host_connections);
+#if LIBCURL_VERSION_NUM >= 0x074300
+	curl_multi_setopt(m_multi, CURLMOPT_MAX_CONCURRENT_STREAMS,
+		(long) max_concurrent_streams);
+#else
+	static std::once_flag old_curl_warned;
+	std::call_once(old_curl_warned, [] {
+		log_warn(httpc_log, "HTTPMultiClient: cURL is too old to limit concurrent "
+			"streams, using cURL default (100).");
+	});
+#endif
+}
+
+HTTPMultiClient::~HTTPMultiClient()
+{
+	for (auto &t : m_transfers) {
+		curl_multi_remove_handle(m_multi, t.first);
+		release_request(t.first, t.second->req);
+	}
+
+	m_transfers.clear();
+	curl_multi_cleanup(m_multi);
+}
+
+void HTTPMultiClient::add_request(const Query &query, const RequestCallback &cb)
+{
+	std::unique_ptr<Transfer> transfer = std::make_unique<Transfer>();
+	transfer->callback = cb;
+
+	CURL *curl = prepare_request(query, transfer->req);
+
+	// Prefer HTTP/2 over TLS and wait for an existing connection to be multiplexed
+	// instead of opening a new one
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+	CURLMcode mc = curl_multi_add_handle(m_multi, curl);
+	if (mc != CURLM_OK) {
+		log_error(httpc_log, "HTTPMultiClient: unable to queue request "
+			<< transfer->req.url << ", error was: " << curl_multi_strerror(mc));
+		release_request(curl, transfer->req);
+		if (transfer->callback) {
+			transfer->callback(CURLE_FAILED_INIT, 0, transfer->response);
+		}
+		return;
+	}
+
+	m_transfers[curl] = std::move(transfer);
+}
+
+void HTTPMultiClient::perform()
+{
+	int running = 0;
+	do {
+		CURLMcode mc = curl_multi_perform(m_multi, &running);
+		if (mc == CURLM_OK && running > 0) {
+			mc = curl_multi_wait(m_multi, nullptr, 0, 1000, nullptr);
+		}
+
+		if (mc != CURLM_OK) {
+			log_error(httpc_log, "HTTPMultiClient: curl_multi_perform failed! "
+				"Error was: " << curl_multi_strerror(mc));
+			break;
+		}
+
+		// Callbacks may add new requests, loop until every transfer is done
+		process_completed_transfers();
+	} while (running > 0 || !m_transfers.empty());
+}
+
+void HTTPMultiClient::process_completed_transfers()
+{
+	CURLMsg *msg = nullptr;
+	int msgs_left = 0;
+	while ((msg = curl_multi_info_read(m_multi, &msgs_left))) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+
+		CURL *curl = msg->easy_handle;
+		CURLcode rc = msg->data.result;
+
+		auto it = m_transfers.find(curl);
+		if (it == m_transfers.end()) {
+			continue;
+		}
+
+		std::unique_ptr<Transfer> transfer = std::move(it->second);
+		m_transfers.erase(it);
+
+		long http_code = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+		m_http_code = http_code;
+
+		curl_multi_remove_handle(m_multi, curl);
+		release_request(curl, transfer->req);
+
+		if (rc != CURLE_OK) {
+			log_error(httpc_log, "HTTPMultiClient: request to " << transfer->req.url
+				<< " failed! Error was: " << curl_easy_strerror(rc));
+		}
+
+		if (transfer->callback) {
+			transfer->callback(rc, http_code, transfer->response);
+		}
+	}
+}
+}
+}
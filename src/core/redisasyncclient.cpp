@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redisasyncclient.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+namespace winterwind
+{
+RedisAsyncClient::RedisAsyncClient(const std::string &host, uint16_t port,
+	uint32_t cb_interval) :
+	m_host(host),
+	m_port(port),
+	m_circuit_breaker_interval(cb_interval),
+	m_pending(0)
+{
+	if (pipe(m_wakeup_pipe) != 0) {
+		throw RedisException("Redis async client: unable to create wakeup pipe");
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+}
+
+RedisAsyncClient::~RedisAsyncClient()
+{
+	stop_and_wait();
+
+	// Event loop was never started
+	for (const auto &command : m_queue) {
+		notify(*command, nullptr, "Redis async client stopped");
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		close(fd);
+	}
+}
+
+void RedisAsyncClient::stop()
+{
+	Thread::stop();
+	wakeup();
+}
+
+void RedisAsyncClient::command(const std::vector<std::string> &args,
+	const CommandCallback &callback)
+{
+	std::unique_ptr<Command> command(new Command{this, args, callback});
+	m_pending++;
+	{
+		std::unique_lock<std::mutex> lock(m_queue_mutex);
+		// Event loop drains the queue a last time once stopping, it won't see this one
+		if (!is_stopping()) {
+			m_queue.push_back(std::move(command));
+		}
+	}
+
+	if (command) {
+		notify(*command, nullptr, "Redis async client stopped");
+		return;
+	}
+
+	wakeup();
+}
+
+std::future<std::string> RedisAsyncClient::command(const std::vector<std::string> &args)
+{
+	// std::function must be copyable, share the promise
+	auto promise = std::make_shared<std::promise<std::string>>();
+	std::future<std::string> future = promise->get_future();
+	command(args, [promise](const redisReply *reply, const std::string &error) {
+		if (!reply) {
+			promise->set_exception(std::make_exception_ptr(RedisException(error)));
+			return;
+		}
+
+		switch (reply->type) {
+			case REDIS_REPLY_ERROR:
+				promise->set_exception(std::make_exception_ptr(
+					RedisException(std::string(reply->str, (size_t) reply->len))));
+				break;
+			case REDIS_REPLY_STRING:
+			case REDIS_REPLY_STATUS:
+				promise->set_value(std::string(reply->str, (size_t) reply->len));
+				break;
+			case REDIS_REPLY_INTEGER:
+				promise->set_value(std::to_string(reply->integer));
+				break;
+			case REDIS_REPLY_NIL:
+				promise->set_value("");
+				break;
+			default:
+				promise->set_exception(std::make_exception_ptr(RedisException(
+					"Redis async client: unhandled reply type " +
+						std::to_string(reply->type))));
+				break;
+		}
+	});
+
+	return future;
+}
+
+void RedisAsyncClient::wakeup()
+{
+	char c = 0;
+	// Pipe full means event loop has already been woken up
+	ssize_t unused = write(m_wakeup_pipe[1], &c, 1);
+	(void) unused;
+}
+
+bool RedisAsyncClient::connect()
+{
+	// Circuit breaker
+	if ((time(nullptr) - m_last_failed_connection) < m_circuit_breaker_interval) {
+		return false;
+	}
+
+	redisAsyncContext *ac = redisAsyncConnect(m_host.c_str(), m_port);
+	if (ac == nullptr || ac->err != 0) {
+		m_last_failed_connection = time(nullptr);
+		std::cerr << "Redis async client: connection error: "
+			<< (ac ? ac->errstr : "unable to allocate context") << std::endl;
+		if (ac) {
+			redisAsyncFree(ac);
+		}
+		return false;
+	}
+
+	ac->data = this;
+	ac->ev.data = this;
+	ac->ev.addRead = &RedisAsyncClient::add_read;
+	ac->ev.delRead = &RedisAsyncClient::del_read;
+	ac->ev.addWrite = &RedisAsyncClient::add_write;
+	ac->ev.delWrite = &RedisAsyncClient::del_write;
+	ac->ev.cleanup = &RedisAsyncClient::cleanup;
+	redisAsyncSetConnectCallback(ac, &RedisAsyncClient::on_connect);
+	redisAsyncSetDisconnectCallback(ac, &RedisAsyncClient::on_disconnect);
+
+	m_context = ac;
+	// Non blocking connect completes when socket becomes writable
+	m_want_write = true;
+	return true;
+}
+
+void *RedisAsyncClient::run()
+{
+	Thread::set_thread_name("RedisAsync");
+
+	ThreadStarted();
+
+	std::vector<pollfd> fds;
+	while (!is_stopping()) {
+		dispatch();
+
+		fds.clear();
+		fds.push_back({m_wakeup_pipe[0], POLLIN, 0});
+		if (m_context && (m_want_read || m_want_write)) {
+			fds.push_back({m_context->c.fd,
+				(short) ((m_want_read ? POLLIN : 0) | (m_want_write ? POLLOUT : 0)), 0});
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			std::cerr << "Redis async client: poll failed, errno " << errno << std::endl;
+			break;
+		}
+
+		if (fds[0].revents) {
+			char buf[64];
+			while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+		}
+
+		// Context may be freed by any handler through on_disconnect
+		if (fds.size() > 1 && m_context &&
+			(fds[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+			redisAsyncHandleRead(m_context);
+		}
+
+		if (fds.size() > 1 && m_context && (fds[1].revents & POLLOUT)) {
+			redisAsyncHandleWrite(m_context);
+		}
+	}
+
+	// Sent commands are failed by hiredis through their callbacks
+	if (m_context) {
+		redisAsyncFree(m_context);
+		m_context = nullptr;
+	}
+
+	std::deque<std::unique_ptr<Command>> queue;
+	{
+		std::unique_lock<std::mutex> lock(m_queue_mutex);
+		queue.swap(m_queue);
+	}
+
+	for (const auto &command : queue) {
+		notify(*command, nullptr, "Redis async client stopped");
+	}
+
+	return nullptr;
+}
+
+void RedisAsyncClient::dispatch()
+{
+	std::deque<std::unique_ptr<Command>> queue;
+	{
+		std::unique_lock<std::mutex> lock(m_queue_mutex);
+		queue.swap(m_queue);
+	}
+
+	if (queue.empty()) {
+		return;
+	}
+
+	if (!m_context && !connect()) {
+		for (const auto &command : queue) {
+			notify(*command, nullptr, "Redis async client: unable to connect to " +
+				m_host + ":" + std::to_string(m_port));
+		}
+		return;
+	}
+
+	// Commands are only buffered here, written at once when socket is writable
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	for (auto &command : queue) {
+		argv.clear();
+		argvlen.clear();
+		for (const auto &arg : command->args) {
+			argv.push_back(arg.data());
+			argvlen.push_back(arg.size());
+		}
+
+		if (redisAsyncCommandArgv(m_context, &RedisAsyncClient::on_reply, command.get(),
+			(int) argv.size(), argv.data(), argvlen.data()) != REDIS_OK) {
+			notify(*command, nullptr, "Redis async client: unable to send command");
+			continue;
+		}
+
+		// Arguments have been serialized, owned by hiredis until reply
+		command->args.clear();
+		command.release();
+	}
+}
+
+void RedisAsyncClient::notify(const Command &command, const redisReply *reply,
+	const std::string &error)
+{
+	m_pending--;
+	if (!command.callback) {
+		return;
+	}
+
+	try {
+		command.callback(reply, error);
+	}
+	catch (std::exception &e) {
+		std::cerr << "Redis async client: command callback thrown exception: "
+			<< e.what() << std::endl;
+	}
+}
+
+void RedisAsyncClient::on_reply(redisAsyncContext *ac, void *reply, void *privdata)
+{
+	std::unique_ptr<Command> command((Command *) privdata);
+	// No reply when context is freed or connection is lost
+	std::string error;
+	if (!reply) {
+		error = std::string("Redis async client: ") +
+			(ac->err ? ac->errstr : "connection lost");
+	}
+
+	command->client->notify(*command, (const redisReply *) reply, error);
+}
+
+void RedisAsyncClient::on_connect(const redisAsyncContext *ac, int status)
+{
+	if (status == REDIS_OK) {
+		return;
+	}
+
+	// hiredis frees the context after this call
+	auto *client = (RedisAsyncClient *) ac->data;
+	std::cerr << "Redis async client: connection error: " << ac->errstr << std::endl;
+	client->m_last_failed_connection = time(nullptr);
+	client->m_context = nullptr;
+}
+
+void RedisAsyncClient::on_disconnect(const redisAsyncContext *ac, int status)
+{
+	// hiredis frees the context after this call
+	auto *client = (RedisAsyncClient *) ac->data;
+	if (status != REDIS_OK) {
+		std::cerr << "Redis async client: connection lost: " << ac->errstr << std::endl;
+		client->m_last_failed_connection = time(nullptr);
+	}
+
+	client->m_context = nullptr;
+}
+
+void RedisAsyncClient::add_read(void *privdata)
+{
+	((RedisAsyncClient *) privdata)->m_want_read = true;
+}
+
+void RedisAsyncClient::del_read(void *privdata)
+{
+	((RedisAsyncClient *) privdata)->m_want_read = false;
+}
+
+void RedisAsyncClient::add_write(void *privdata)
+{
+	((RedisAsyncClient *) privdata)->m_want_write = true;
+}
+
+void RedisAsyncClient::del_write(void *privdata)
+{
+	((RedisAsyncClient *) privdata)->m_want_write = false;
+}
+
+void RedisAsyncClient::cleanup(void *privdata)
+{
+	auto *client = (RedisAsyncClient *) privdata;
+	client->m_want_read = false;
+	client->m_want_write = false;
+}
+}
@@ -68,10 +68,12 @@ void RedisClient::connect()
 		}
 
 		std::cerr << "Unable to set redis context." << std::endl;
-
+		return;
 	}
 
 	redisEnableKeepAlive(m_context);
+	m_connect_count++;
+	m_last_activity = std::chrono::steady_clock::now();
 }
 
 // This function permits to test connect & reconnect or fail
@@ -83,35 +85,35 @@ void RedisClient::connect()
         }                                                                                \
     }
 
-#define REDIS_REPLY_HANDLER                                                              \
-    if (!reply) {                                                                        \
-        std::cerr << "Redis " << __FUNCTION__ << " error: " << m_context->errstr         \
-              << std::endl;                                                              \
-        return false;                                                                    \
-    }
+bool RedisClient::ping()
+{
+	REDIS_CONNECT;
+	RedisReply reply = command({"PING"});
+	return reply && !reply.is_error();
+}
 
 bool RedisClient::type(const std::string &key, std::string &res)
 {
 	REDIS_CONNECT;
-	auto *reply = (redisReply *) redisCommand(m_context, "TYPE %s", key.c_str());
-	REDIS_REPLY_HANDLER;
+	RedisReply reply = command({"TYPE", key});
+	if (!reply) {
+		return false;
+	}
+
 	switch (reply->type) {
 		case REDIS_REPLY_STRING:
 		case REDIS_REPLY_ERROR:
 		case REDIS_REPLY_STATUS:
-			res = std::string(reply->str, (unsigned long) reply->len);
+			res.assign(reply.data(), reply.size());
 			break;
 		case REDIS_REPLY_NIL:
-			freeReplyObject(reply);
 			return false;
 		default:
 			std::cerr << "Redis " << __FUNCTION__ << " error: unhandled response type "
 				<< reply->type << std::endl;
-			freeReplyObject(reply);
 			return false;
 	}
 
-	freeReplyObject(reply);
 	return true;
 }
 
@@ -119,139 +121,329 @@ bool RedisClient::set(const std::string &key, const std::string &value,
 	const uint32_t expire_value)
 {
 	REDIS_CONNECT;
-	auto *reply =
-		(redisReply *) redisCommand(m_context, "SET %s %s", key.c_str(), value.c_str());
-	REDIS_REPLY_HANDLER;
-	freeReplyObject(reply);
-	return expire_value == 0 || expire(key, expire_value);
+	const std::string expire_str = std::to_string(expire_value);
+	RedisReply reply = expire_value == 0 ? command({"SET", key, value}) :
+		command({"SET", key, value, "EX", expire_str});
+	if (!reply) {
+		return false;
+	}
+
+	if (reply.is_error()) {
+		std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		return false;
+	}
+
+	return true;
 }
 
 bool RedisClient::get(const std::string &key, std::string &res)
 {
 	REDIS_CONNECT;
-	auto *reply = (redisReply *) redisCommand(m_context, "GET %s", key.c_str());
-	REDIS_REPLY_HANDLER;
+	RedisReply reply = command({"GET", key});
+	if (!reply) {
+		return false;
+	}
+
 	switch (reply->type) {
 		case REDIS_REPLY_STRING:
 		case REDIS_REPLY_ERROR:
-			res = std::string(reply->str, (unsigned long) reply->len);
+			res.assign(reply.data(), reply.size());
 			break;
 		case REDIS_REPLY_NIL:
-			freeReplyObject(reply);
 			return false;
 		default:
 			std::cerr << "Redis " << __FUNCTION__ << " error: unhandled response type "
 				<< reply->type << std::endl;
-			freeReplyObject(reply);
 			return false;
 	}
 
-	freeReplyObject(reply);
 	return true;
 }
 
+RedisReply RedisClient::get_reply(const RedisArg &key)
+{
+	return command({"GET", key});
+}
+
 bool RedisClient::del(const std::string &key)
 {
 	REDIS_CONNECT;
-	auto *reply = (redisReply *) redisCommand(m_context, "DEL %s", key.c_str());
-	REDIS_REPLY_HANDLER;
-	freeReplyObject(reply);
-	return true;
+	return (bool) command({"DEL", key});
 }
 
 bool RedisClient::expire(const std::string &key, const uint32_t value)
 {
 	REDIS_CONNECT;
-	auto *reply = (redisReply *) redisCommand(m_context, "EXPIRE %s %d",
-		key.c_str(), value);
-	REDIS_REPLY_HANDLER;
-	freeReplyObject(reply);
-	return true;
+	return (bool) command({"EXPIRE", key, std::to_string(value)});
 }
 
+// Replace key if it's not a hash, set field & refresh expiration in one call
+static const std::string HSET_SCRIPT =
+	"local t = redis.call('TYPE', KEYS[1]).ok\n"
+	"if t ~= 'hash' and t ~= 'none' then redis.call('DEL', KEYS[1]) end\n"
+	"redis.call('HSET', KEYS[1], ARGV[1], ARGV[2])\n"
+	"if tonumber(ARGV[3]) > 0 then redis.call('EXPIRE', KEYS[1], ARGV[3]) end\n"
+	"return 1";
+
 bool RedisClient::hset(const std::string &key, const std::string &skey,
 	const std::string &value,
 	const uint32_t expire_value)
 {
-	REDIS_CONNECT;
-	// Verify type & del wrong key type
-	std::string type_verification;
-	type(key, type_verification);
-	if (type_verification != "hash" && type_verification != "none") {
-		del(key);
-	}
-
-	auto *reply = (redisReply *) redisCommand(m_context, "HSET %s %s %s",
-		key.c_str(),
-		skey.c_str(), value.c_str());
-	REDIS_REPLY_HANDLER;
-	freeReplyObject(reply);
-	return expire_value == 0 || expire(key, expire_value);
+	RedisReply reply = eval(HSET_SCRIPT, {key}, {skey, value, std::to_string(expire_value)});
+	if (!reply) {
+		return false;
+	}
+
+	if (reply.is_error()) {
+		std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		return false;
+	}
+
+	return true;
 }
 
 bool RedisClient::hdel(const std::string &key, const std::string &skey)
 {
 	REDIS_CONNECT;
-	auto *reply =
-		(redisReply *) redisCommand(m_context, "HDEL %s %s", key.c_str(), skey.c_str());
-	REDIS_REPLY_HANDLER;
-	freeReplyObject(reply);
-	return true;
+	return (bool) command({"HDEL", key, skey});
 }
 
 bool RedisClient::hget(const std::string &key, const std::string &skey, std::string &res)
 {
 	REDIS_CONNECT;
-	auto *reply =
-		(redisReply *) redisCommand(m_context, "HGET %s %s", key.c_str(), skey.c_str());
-	REDIS_REPLY_HANDLER;
+	RedisReply reply = command({"HGET", key, skey});
+	if (!reply) {
+		return false;
+	}
+
 	switch (reply->type) {
 		case REDIS_REPLY_STRING:
 		case REDIS_REPLY_ERROR:
-			res = std::string(reply->str, (unsigned long) reply->len);
+			res.assign(reply.data(), reply.size());
 			break;
 		case REDIS_REPLY_NIL:
-			freeReplyObject(reply);
 			return false;
 		default:
 			std::cerr << "Redis " << __FUNCTION__ << " error: unhandled response type "
 				<< reply->type << std::endl;
-			freeReplyObject(reply);
 			return false;
 	}
 
-	freeReplyObject(reply);
 	return true;
 }
 
+RedisReply RedisClient::hget_reply(const RedisArg &key, const RedisArg &skey)
+{
+	return command({"HGET", key, skey});
+}
+
 bool RedisClient::hkeys(const std::string &key, std::vector<std::string> &res)
 {
 	REDIS_CONNECT;
-	auto *reply = (redisReply *) redisCommand(m_context, "HKEYS %s", key.c_str());
-	REDIS_REPLY_HANDLER;
+	RedisReply reply = command({"HKEYS", key});
+	if (!reply) {
+		return false;
+	}
+
 	switch (reply->type) {
 		case REDIS_REPLY_ERROR:
-			std::cerr << "Redis " << __FUNCTION__ << " error: "
-				<< std::string(reply->str, (unsigned long) reply->len)
+			std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str()
 				<< std::endl;
 			break;
 		case REDIS_REPLY_ARRAY:
-			for (int i = 0; i < reply->elements; i++) {
+			res.reserve(res.size() + reply->elements);
+			for (size_t i = 0; i < reply->elements; i++) {
 				res.emplace_back(reply->element[i]->str,
-					(unsigned long) reply->element[i]->len);
+					(size_t) reply->element[i]->len);
 			}
 			break;
 		case REDIS_REPLY_NIL:
-			freeReplyObject(reply);
 			return false;
 		default:
 			std::cerr << "Redis " << __FUNCTION__ << " error: unhandled response type "
 				<< reply->type << std::endl;
-			freeReplyObject(reply);
 			return false;
 	}
 
-	freeReplyObject(reply);
 	return true;
 }
+
+void RedisClient::on_connection_error(const char *function)
+{
+	std::cerr << "Redis " << function << " error: " << m_context->errstr << std::endl;
+	// hiredis context cannot be reused after an I/O or protocol error
+	redisFree(m_context);
+	m_context = nullptr;
+}
+
+RedisReply RedisClient::command(const std::vector<RedisArg> &args)
+{
+	if (!m_context) {
+		connect();
+		if (!m_context) {
+			return RedisReply();
+		}
+	}
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	argv.reserve(args.size());
+	argvlen.reserve(args.size());
+	for (const RedisArg &arg : args) {
+		argv.push_back(arg.data);
+		argvlen.push_back(arg.size);
+	}
+
+	RedisReply reply((redisReply *) redisCommandArgv(m_context, (int) argv.size(),
+		argv.data(), argvlen.data()));
+	if (!reply) {
+		on_connection_error(__FUNCTION__);
+	} else {
+		m_last_activity = std::chrono::steady_clock::now();
+	}
+
+	return reply;
+}
+
+bool RedisClient::mget(const std::vector<std::string> &keys,
+	std::unordered_map<std::string, std::string> &res)
+{
+	if (keys.empty()) {
+		return true;
+	}
+
+	REDIS_CONNECT;
+	std::vector<RedisArg> args = {"MGET"};
+	args.reserve(keys.size() + 1);
+	args.insert(args.end(), keys.begin(), keys.end());
+
+	RedisReply reply = command(args);
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != keys.size()) {
+		if (reply) {
+			std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		}
+		return false;
+	}
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		const redisReply *value = reply->element[i];
+		if (value->type == REDIS_REPLY_STRING) {
+			res[keys[i]] = std::string(value->str, value->len);
+		}
+	}
+
+	return true;
+}
+
+bool RedisClient::mset(const std::unordered_map<std::string, std::string> &values)
+{
+	if (values.empty()) {
+		return true;
+	}
+
+	REDIS_CONNECT;
+	std::vector<RedisArg> args = {"MSET"};
+	args.reserve(values.size() * 2 + 1);
+	for (const auto &value : values) {
+		args.emplace_back(value.first);
+		args.emplace_back(value.second);
+	}
+
+	RedisReply reply = command(args);
+	if (!reply || reply.is_error()) {
+		if (reply) {
+			std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+bool RedisClient::hmget(const std::string &key, const std::vector<std::string> &skeys,
+	std::unordered_map<std::string, std::string> &res)
+{
+	if (skeys.empty()) {
+		return true;
+	}
+
+	REDIS_CONNECT;
+	std::vector<RedisArg> args = {"HMGET", key};
+	args.reserve(skeys.size() + 2);
+	args.insert(args.end(), skeys.begin(), skeys.end());
+
+	RedisReply reply = command(args);
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != skeys.size()) {
+		if (reply) {
+			std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		}
+		return false;
+	}
+
+	for (size_t i = 0; i < skeys.size(); i++) {
+		const redisReply *value = reply->element[i];
+		if (value->type == REDIS_REPLY_STRING) {
+			res[skeys[i]] = std::string(value->str, value->len);
+		}
+	}
+
+	return true;
+}
+
+bool RedisClient::load_script(const std::string &script, std::string &sha)
+{
+	REDIS_CONNECT;
+	RedisReply reply = command({"SCRIPT", "LOAD", script});
+	if (!reply) {
+		return false;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		std::cerr << "Redis " << __FUNCTION__ << " error: " << reply.str() << std::endl;
+		return false;
+	}
+
+	sha = reply.str();
+	m_scripts[script] = sha;
+	return true;
+}
+
+RedisReply RedisClient::eval(const std::string &script,
+	const std::vector<std::string> &keys, const std::vector<std::string> &args)
+{
+	if (!m_context) {
+		connect();
+		if (!m_context) {
+			return RedisReply();
+		}
+	}
+
+	std::string sha;
+	auto script_it = m_scripts.find(script);
+	if (script_it != m_scripts.end()) {
+		sha = script_it->second;
+	} else if (!load_script(script, sha)) {
+		return RedisReply();
+	}
+
+	const std::string numkeys = std::to_string(keys.size());
+	std::vector<RedisArg> argv = {"EVALSHA", sha, numkeys};
+	argv.reserve(3 + keys.size() + args.size());
+	argv.insert(argv.end(), keys.begin(), keys.end());
+	argv.insert(argv.end(), args.begin(), args.end());
+
+	RedisReply reply = command(argv);
+	// Script cache was flushed on server side, load it again and retry once
+	if (reply.is_error() && reply.str().compare(0, 8, "NOSCRIPT") == 0) {
+		m_scripts.erase(script);
+		if (!load_script(script, sha)) {
+			return RedisReply();
+		}
+
+		argv[1] = sha;
+		reply = command(argv);
+	}
+
+	return reply;
+}
 }
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redisnearcache.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+namespace winterwind
+{
+// Approximate per entry bookkeeping (hash node, LRU node, Entry)
+static const size_t ENTRY_OVERHEAD = 128;
+static const size_t FIELD_OVERHEAD = 64;
+
+RedisNearCache::RedisNearCache(const std::string &host, uint16_t port,
+	const RedisNearCacheConfig &config) :
+	m_host(host),
+	m_port(port),
+	m_config(config),
+	m_client(host, port, config.cb_interval)
+{
+	if (pipe(m_wakeup_pipe) != 0) {
+		throw RedisException("Redis near cache: unable to create wakeup pipe");
+	}
+
+	for (int fd : m_wakeup_pipe) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+}
+
+RedisNearCache::~RedisNearCache()
+{
+	stop_and_wait();
+
+	for (int fd : m_wakeup_pipe) {
+		close(fd);
+	}
+}
+
+void RedisNearCache::stop()
+{
+	Thread::stop();
+	wakeup();
+}
+
+void RedisNearCache::wakeup()
+{
+	char c = 0;
+	// Pipe full means thread has already been woken up
+	ssize_t unused = write(m_wakeup_pipe[1], &c, 1);
+	(void) unused;
+}
+
+bool RedisNearCache::get(const std::string &key, std::string &res)
+{
+	return lookup(key, nullptr, res) || fetch(key, nullptr, res);
+}
+
+bool RedisNearCache::hget(const std::string &key, const std::string &skey,
+	std::string &res)
+{
+	return lookup(key, &skey, res) || fetch(key, &skey, res);
+}
+
+bool RedisNearCache::lookup(const std::string &key, const std::string *skey,
+	std::string &res)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto entry_it = m_entries.find(key);
+	if (entry_it == m_entries.end()) {
+		m_metrics.misses++;
+		return false;
+	}
+
+	Entry &entry = entry_it->second;
+	if (skey) {
+		auto field_it = entry.fields.find(*skey);
+		if (field_it == entry.fields.end()) {
+			m_metrics.misses++;
+			return false;
+		}
+
+		res = field_it->second;
+	} else if (entry.has_value) {
+		res = entry.value;
+	} else {
+		m_metrics.misses++;
+		return false;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+	m_metrics.hits++;
+	return true;
+}
+
+bool RedisNearCache::fetch(const std::string &key, const std::string *skey,
+	std::string &res)
+{
+	std::unique_lock<std::mutex> lock(m_client_mutex);
+	const bool tracked = enable_tracking();
+	const uint64_t invalidation_seq = m_invalidation_seq;
+
+	RedisReply reply = skey ? m_client.command({"HGET", key, *skey}) :
+		m_client.command({"GET", key});
+	lock.unlock();
+
+	if (!reply) {
+		return false;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		if (reply.is_error()) {
+			std::cerr << "Redis near cache: " << (skey ? "HGET" : "GET") << " error: "
+				<< reply.str() << std::endl;
+		}
+		return false;
+	}
+
+	res.assign(reply.data(), reply.size());
+	if (tracked) {
+		store(key, skey, res, invalidation_seq);
+	}
+
+	return true;
+}
+
+void RedisNearCache::store(const std::string &key, const std::string *skey,
+	const std::string &value, uint64_t invalidation_seq)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_invalidation_seq != invalidation_seq) {
+		return;
+	}
+
+	auto entry_it = m_entries.find(key);
+	if (entry_it == m_entries.end()) {
+		m_lru.push_front(key);
+		entry_it = m_entries.emplace(key, Entry()).first;
+		entry_it->second.lru = m_lru.begin();
+		entry_it->second.memory = ENTRY_OVERHEAD + key.size();
+		m_metrics.memory += entry_it->second.memory;
+	} else {
+		m_lru.splice(m_lru.begin(), m_lru, entry_it->second.lru);
+	}
+
+	Entry &entry = entry_it->second;
+	size_t added = value.size(), removed = 0;
+	if (skey) {
+		auto field_it = entry.fields.find(*skey);
+		if (field_it != entry.fields.end()) {
+			removed = field_it->second.size();
+			field_it->second = value;
+		} else {
+			added += FIELD_OVERHEAD + skey->size();
+			entry.fields.emplace(*skey, value);
+		}
+	} else {
+		removed = entry.value.size();
+		entry.value = value;
+		entry.has_value = true;
+	}
+
+	entry.memory = entry.memory + added - removed;
+	m_metrics.memory = m_metrics.memory + added - removed;
+
+	while (!m_lru.empty() && (m_entries.size() > m_config.max_entries ||
+		m_metrics.memory > m_config.max_memory)) {
+		erase(m_lru.back());
+		m_metrics.evictions++;
+	}
+}
+
+bool RedisNearCache::enable_tracking()
+{
+	const int64_t redirect = m_redirect_id;
+	if (redirect == 0) {
+		return false;
+	}
+
+	// Reconnect now, a reconnection during the read would lose tracking
+	if (!m_client.is_connected() && !m_client.ping()) {
+		return false;
+	}
+
+	if (m_client.get_connect_count() == m_tracking_connect_count &&
+		redirect == m_tracking_redirect) {
+		return true;
+	}
+
+	RedisReply reply = m_client.command({"CLIENT", "TRACKING", "on", "REDIRECT",
+		std::to_string(redirect)});
+	if (!reply || reply.is_error()) {
+		if (reply) {
+			std::cerr << "Redis near cache: unable to enable tracking: " << reply.str()
+				<< std::endl;
+		}
+		return false;
+	}
+
+	m_tracking_connect_count = m_client.get_connect_count();
+	m_tracking_redirect = redirect;
+
+	// Invalidations for values read before tracking was enabled were never sent
+	std::unique_lock<std::mutex> lock(m_mutex);
+	flush();
+	return true;
+}
+
+void RedisNearCache::invalidate(const std::string &key)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_invalidation_seq++;
+	erase(key);
+}
+
+void RedisNearCache::clear()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	flush();
+}
+
+void RedisNearCache::erase(const std::string &key)
+{
+	auto entry_it = m_entries.find(key);
+	if (entry_it == m_entries.end()) {
+		return;
+	}
+
+	m_metrics.memory -= entry_it->second.memory;
+	m_lru.erase(entry_it->second.lru);
+	m_entries.erase(entry_it);
+}
+
+void RedisNearCache::flush()
+{
+	m_invalidation_seq++;
+	m_entries.clear();
+	m_lru.clear();
+	m_metrics.memory = 0;
+	m_metrics.flushes++;
+}
+
+RedisNearCacheMetrics RedisNearCache::get_metrics() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	RedisNearCacheMetrics metrics = m_metrics;
+	metrics.entries = m_entries.size();
+	return metrics;
+}
+
+bool RedisNearCache::connect_invalidation(redisContext *&ctx)
+{
+	// Circuit breaker
+	if ((time(nullptr) - m_last_failed_connection) < m_config.cb_interval) {
+		return false;
+	}
+
+	ctx = redisConnect(m_host.c_str(), m_port);
+	if (ctx == nullptr || ctx->err != 0) {
+		std::cerr << "Redis near cache: connection error: "
+			<< (ctx ? ctx->errstr : "unable to allocate context") << std::endl;
+		if (ctx) {
+			redisFree(ctx);
+			ctx = nullptr;
+		}
+		m_last_failed_connection = time(nullptr);
+		return false;
+	}
+
+	redisEnableKeepAlive(ctx);
+
+	int64_t id = 0;
+	auto *reply = (redisReply *) redisCommand(ctx, "CLIENT ID");
+	if (reply && reply->type == REDIS_REPLY_INTEGER) {
+		id = reply->integer;
+	}
+
+	if (reply) {
+		freeReplyObject(reply);
+		reply = (redisReply *) redisCommand(ctx, "SUBSCRIBE __redis__:invalidate");
+	}
+
+	if (id == 0 || !reply || reply->type != REDIS_REPLY_ARRAY) {
+		std::cerr << "Redis near cache: unable to subscribe to invalidations"
+			<< (ctx->err ? std::string(": ") + ctx->errstr : "") << std::endl;
+		if (reply) {
+			freeReplyObject(reply);
+		}
+		redisFree(ctx);
+		ctx = nullptr;
+		m_last_failed_connection = time(nullptr);
+		return false;
+	}
+
+	freeReplyObject(reply);
+
+	// Invalidations were lost while not subscribed
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		flush();
+	}
+
+	m_redirect_id = id;
+	return true;
+}
+
+void RedisNearCache::handle_invalidation(const redisReply *reply)
+{
+	// Pub/sub message: ["message", channel, keys or nil when server flushed]
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+		reply->element[0]->type != REDIS_REPLY_STRING ||
+		std::string(reply->element[0]->str, reply->element[0]->len) != "message") {
+		return;
+	}
+
+	const redisReply *keys = reply->element[2];
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (keys->type != REDIS_REPLY_ARRAY) {
+		flush();
+		return;
+	}
+
+	m_invalidation_seq++;
+	for (size_t i = 0; i < keys->elements; i++) {
+		const redisReply *key = keys->element[i];
+		if (key->type == REDIS_REPLY_STRING) {
+			erase(std::string(key->str, key->len));
+			m_metrics.invalidations++;
+		}
+	}
+}
+
+void *RedisNearCache::run()
+{
+	Thread::set_thread_name("RedisNearCache");
+
+	ThreadStarted();
+
+	redisContext *ctx = nullptr;
+	while (!is_stopping()) {
+		pollfd fds[2] = {{m_wakeup_pipe[0], POLLIN, 0}, {-1, POLLIN, 0}};
+		const bool connected = ctx || connect_invalidation(ctx);
+		if (connected) {
+			fds[1].fd = ctx->fd;
+		}
+
+		// Not connected: wait for circuit breaker interval or stop
+		if (poll(fds, connected ? 2 : 1,
+			connected ? -1 : (int) std::max<uint32_t>(m_config.cb_interval, 1) * 1000) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			std::cerr << "Redis near cache: poll failed, errno " << errno << std::endl;
+			break;
+		}
+
+		if (fds[0].revents) {
+			char buf[64];
+			while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+		}
+
+		if (!connected || !fds[1].revents) {
+			continue;
+		}
+
+		bool failed = redisBufferRead(ctx) != REDIS_OK;
+		while (!failed) {
+			void *reply = nullptr;
+			if (redisGetReplyFromReader(ctx, &reply) != REDIS_OK) {
+				failed = true;
+				break;
+			}
+
+			if (!reply) {
+				break;
+			}
+
+			handle_invalidation((const redisReply *) reply);
+			freeReplyObject(reply);
+		}
+
+		if (failed) {
+			std::cerr << "Redis near cache: invalidation connection lost: " << ctx->errstr
+				<< std::endl;
+			redisFree(ctx);
+			ctx = nullptr;
+			m_redirect_id = 0;
+			m_last_failed_connection = time(nullptr);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			flush();
+		}
+	}
+
+	m_redirect_id = 0;
+	if (ctx) {
+		redisFree(ctx);
+	}
+
+	return nullptr;
+}
+}
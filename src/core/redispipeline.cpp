@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redispipeline.h"
+#include <iostream>
+
+namespace winterwind
+{
+void RedisPipeline::begin_command(size_t argc)
+{
+	m_buffer += '*';
+	m_buffer += std::to_string(argc);
+	m_buffer += "\r\n";
+	m_commands++;
+}
+
+void RedisPipeline::append_arg(const char *data, size_t len)
+{
+	m_buffer += '$';
+	m_buffer += std::to_string(len);
+	m_buffer += "\r\n";
+	m_buffer.append(data, len);
+	m_buffer += "\r\n";
+}
+
+RedisPipeline &RedisPipeline::get(const std::string &key)
+{
+	begin_command(2);
+	append_arg("GET", 3);
+	append_arg(key);
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::set(const std::string &key, const std::string &value,
+	uint32_t expire_value)
+{
+	begin_command(expire_value == 0 ? 3 : 5);
+	append_arg("SET", 3);
+	append_arg(key);
+	append_arg(value);
+	if (expire_value != 0) {
+		append_arg("EX", 2);
+		append_arg(std::to_string(expire_value));
+	}
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::del(const std::string &key)
+{
+	begin_command(2);
+	append_arg("DEL", 3);
+	append_arg(key);
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::expire(const std::string &key, uint32_t value)
+{
+	begin_command(3);
+	append_arg("EXPIRE", 6);
+	append_arg(key);
+	append_arg(std::to_string(value));
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::hget(const std::string &key, const std::string &skey)
+{
+	begin_command(3);
+	append_arg("HGET", 4);
+	append_arg(key);
+	append_arg(skey);
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::hset(const std::string &key, const std::string &skey,
+	const std::string &value)
+{
+	begin_command(4);
+	append_arg("HSET", 4);
+	append_arg(key);
+	append_arg(skey);
+	append_arg(value);
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::hdel(const std::string &key, const std::string &skey)
+{
+	begin_command(3);
+	append_arg("HDEL", 4);
+	append_arg(key);
+	append_arg(skey);
+	return *this;
+}
+
+RedisPipeline &RedisPipeline::command(const std::vector<std::string> &args)
+{
+	begin_command(args.size());
+	for (const auto &arg : args) {
+		append_arg(arg);
+	}
+	return *this;
+}
+
+void RedisPipeline::clear()
+{
+	m_buffer.clear();
+	m_commands = 0;
+}
+
+bool RedisPipeline::exec(std::vector<RedisReply> &replies)
+{
+	if (m_commands == 0) {
+		return true;
+	}
+
+	const size_t commands = m_commands;
+	if (!m_client.m_context) {
+		m_client.connect();
+		if (!m_client.m_context) {
+			clear();
+			return false;
+		}
+	}
+
+	// Whole buffer is written by first redisGetReply call
+	if (redisAppendFormattedCommand(m_client.m_context, m_buffer.data(),
+		m_buffer.size()) != REDIS_OK) {
+		clear();
+		m_client.on_connection_error(__FUNCTION__);
+		return false;
+	}
+
+	clear();
+	replies.reserve(replies.size() + commands);
+	for (size_t i = 0; i < commands; i++) {
+		void *reply = nullptr;
+		if (redisGetReply(m_client.m_context, &reply) != REDIS_OK) {
+			m_client.on_connection_error(__FUNCTION__);
+			return false;
+		}
+
+		replies.emplace_back((redisReply *) reply);
+	}
+
+	m_client.m_last_activity = std::chrono::steady_clock::now();
+	return true;
+}
+}
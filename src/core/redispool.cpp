@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redispool.h"
+
+namespace winterwind
+{
+RedisPool::RedisPool(const std::string &host, uint16_t port,
+	const db::ConnectionPoolConfig &config, uint32_t cb_interval,
+	std::chrono::milliseconds ping_interval) :
+	m_host(host),
+	m_port(port),
+	m_circuit_breaker_interval(cb_interval),
+	m_max_size(config.max_size),
+	m_ping_interval(ping_interval),
+	m_pool([this] { return create_client(); }, config,
+		[this](RedisClient &client) { validate_client(client); })
+{
+}
+
+std::unique_ptr<RedisClient> RedisPool::create_client()
+{
+	// Circuit breaker, shared by all pool clients
+	if ((time(nullptr) - m_last_failed_connection) < m_circuit_breaker_interval) {
+		throw db::DatabaseException("RedisPool: connection to " + m_host + ":"
+			+ std::to_string(m_port) + " disabled by circuit breaker");
+	}
+
+	auto client = std::make_unique<RedisClient>(m_host, m_port, m_circuit_breaker_interval);
+	if (!client->is_connected()) {
+		m_last_failed_connection = time(nullptr);
+		throw db::DatabaseException("RedisPool: unable to connect to " + m_host + ":"
+			+ std::to_string(m_port));
+	}
+
+	return client;
+}
+
+void RedisPool::validate_client(RedisClient &client) const
+{
+	// Clients drop their context on I/O errors
+	if (!client.is_connected()) {
+		throw db::DatabaseException("RedisPool: connection lost");
+	}
+
+	// Server may have closed an idle connection (timeout, failover)
+	if (std::chrono::steady_clock::now() - client.get_last_activity() >= m_ping_interval &&
+		!client.ping()) {
+		throw db::DatabaseException("RedisPool: connection lost");
+	}
+}
+
+float RedisPool::get_utilization() const
+{
+	const db::ConnectionPoolMetrics metrics = m_pool.get_metrics();
+	return (float) metrics.in_use / m_max_size;
+}
+}
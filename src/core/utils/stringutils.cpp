@@ -140,3 +140,37 @@ bool replace(std::string &str, const std::string &from, const std::string &to)
 	str.replace(start_pos, from.length(), to);
 	return true;
 }
+
+void json_append_string(std::string &buf, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	buf += '"';
+	size_t last = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char) str[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		buf.append(str + last, i - last);
+		last = i + 1;
+		switch (c) {
+			case '"': buf += "\\\""; break;
+			case '\\': buf += "\\\\"; break;
+			case '\n': buf += "\\n"; break;
+			case '\r': buf += "\\r"; break;
+			case '\t': buf += "\\t"; break;
+			case '\b': buf += "\\b"; break;
+			case '\f': buf += "\\f"; break;
+			default: {
+				const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+				buf.append(escaped, sizeof(escaped));
+				break;
+			}
+		}
+	}
+
+	buf.append(str + last, len - last);
+	buf += '"';
+}
@@ -34,6 +34,7 @@
 #include "test_threads.h"
 #include "test_mysql.h"
 #include "test_rabbitmq.h"
+#include "test_redis.h"
 
 #include <thread>
 #include <log4cplus/consoleappender.h>
@@ -57,6 +58,7 @@ int main(int argc, const char *argv[])
 		runner.addTest(winterwind::unittests::Test_MySQL::suite());
 		runner.addTest(winterwind::unittests::Test_PostgreSQL::suite());
 		runner.addTest(winterwind::unittests::Test_RabbitMQ::suite());
+		runner.addTest(winterwind::unittests::Test_Redis::suite());
 		runner.addTest(winterwind::unittests::Test_Twitter::suite());
 	}
 
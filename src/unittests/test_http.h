@@ -33,7 +33,10 @@
 #include <cppunit/ui/text/TestRunner.h>
 
 #include <core/httpserver.h>
+#include <core/httpmulticlient.h>
 #include <core/http/query.h>
+#include <cstring>
+#include <unistd.h>
 
 #include "cmake_config.h"
 
@@ -50,6 +53,11 @@ class Test_HTTP : public CppUnit::TestFixture
 	CPPUNIT_TEST(httpserver_getparam);
 	CPPUNIT_TEST(httpserver_handle_post);
 	CPPUNIT_TEST(httpserver_handle_post_json);
+	CPPUNIT_TEST(httpserver_handle_post_json_stream);
+	CPPUNIT_TEST(httpserver_handle_post_json_chunked);
+	CPPUNIT_TEST(httpserver_handle_post_json_file);
+	CPPUNIT_TEST(httpserver_handle_post_json_mmap);
+	CPPUNIT_TEST(httpmulticlient_handle_get);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -185,6 +193,150 @@ protected:
 		CPPUNIT_ASSERT(res.isMember("status") && res["status"] == "yes");
 	}
 
+	void httpserver_handle_post_json_stream()
+	{
+		HTTPClient cli;
+		const std::string body = "{\"json_param\": \"catsarebeautiful\"}";
+		size_t offset = 0;
+		http::Query query("http://localhost:58080/unittest5.html", http::POST);
+		query.set_body(std::make_shared<GeneratorRequestBody>(
+			[&](char *buf, size_t len) {
+				// Send body by small chunks
+				size_t to_send = std::min(std::min(len, (size_t) 8), body.size() - offset);
+				memcpy(buf, body.data() + offset, to_send);
+				offset += to_send;
+				return to_send;
+			}, body.size()));
+
+		std::string res;
+		cli.add_http_header("Content-Type", "application/json");
+		cli.request(query, res);
+		CPPUNIT_ASSERT(offset == body.size());
+		CPPUNIT_ASSERT(res.find("yes") != std::string::npos);
+	}
+
+	void httpserver_handle_post_json_chunked()
+	{
+		const std::string body = "{\"json_param\": \"catsarebeautiful\"}";
+		size_t offset = 0;
+		// Unknown size, body is sent using chunked transfer encoding
+		std::string res = post_json_body(std::make_shared<GeneratorRequestBody>(
+			[&](char *buf, size_t len) {
+				size_t to_send = std::min(std::min(len, (size_t) 8), body.size() - offset);
+				memcpy(buf, body.data() + offset, to_send);
+				offset += to_send;
+				return to_send;
+			}));
+
+		CPPUNIT_ASSERT(offset == body.size());
+		CPPUNIT_ASSERT(res.find("yes") != std::string::npos);
+	}
+
+	void httpserver_handle_post_json_file()
+	{
+		const std::string body = "{\"json_param\": \"catsarebeautiful\"}";
+		const std::string path = write_temp_file(body);
+
+		// Body is read at its own offset, rewind restarts from the beginning
+		FileRequestBody file_body(path);
+		CPPUNIT_ASSERT(file_body.size() == (int64_t) body.size());
+		char buf[64];
+		CPPUNIT_ASSERT(file_body.read(buf, 8) == 8);
+		CPPUNIT_ASSERT(file_body.rewind());
+		CPPUNIT_ASSERT(file_body.read(buf, sizeof(buf)) == body.size());
+		CPPUNIT_ASSERT(std::string(buf, body.size()) == body);
+		CPPUNIT_ASSERT(file_body.read(buf, sizeof(buf)) == 0);
+
+		std::string res = post_json_body(std::make_shared<FileRequestBody>(path));
+		unlink(path.c_str());
+		CPPUNIT_ASSERT(res.find("yes") != std::string::npos);
+
+		bool missing_file = false;
+		try {
+			FileRequestBody missing(path);
+		} catch (const RequestBodyException &) {
+			missing_file = true;
+		}
+		CPPUNIT_ASSERT(missing_file);
+	}
+
+	void httpserver_handle_post_json_mmap()
+	{
+		const std::string body = "{\"json_param\": \"catsarebeautiful\"}";
+		const std::string path = write_temp_file(body);
+
+		MmapRequestBody mmap_body(path);
+		CPPUNIT_ASSERT(mmap_body.size() == (int64_t) body.size());
+		char buf[64];
+		CPPUNIT_ASSERT(mmap_body.read(buf, 8) == 8);
+		CPPUNIT_ASSERT(mmap_body.rewind());
+		CPPUNIT_ASSERT(mmap_body.read(buf, sizeof(buf)) == body.size());
+		CPPUNIT_ASSERT(std::string(buf, body.size()) == body);
+		CPPUNIT_ASSERT(mmap_body.read(buf, sizeof(buf)) == 0);
+
+		std::string res = post_json_body(std::make_shared<MmapRequestBody>(path));
+		unlink(path.c_str());
+		CPPUNIT_ASSERT(res.find("yes") != std::string::npos);
+
+		// Empty files are not mapped
+		const std::string empty_path = write_temp_file("");
+		MmapRequestBody empty_body(empty_path);
+		unlink(empty_path.c_str());
+		CPPUNIT_ASSERT(empty_body.size() == 0);
+		CPPUNIT_ASSERT(empty_body.read(buf, sizeof(buf)) == 0);
+	}
+
+	void httpmulticlient_handle_get()
+	{
+		HTTPMultiClient cli;
+		uint32_t success = 0;
+		for (uint8_t i = 0; i < 10; i++) {
+			cli.add_request(http::Query("http://localhost:58080/unittest.html"),
+				[&](CURLcode rc, long, const std::string &res) {
+					if (rc == CURLE_OK && res == HTTPSERVER_TEST01_STR) {
+						success++;
+					}
+				});
+		}
+
+		CPPUNIT_ASSERT(cli.pending_requests() == 10);
+		cli.perform();
+		CPPUNIT_ASSERT(cli.pending_requests() == 0);
+		CPPUNIT_ASSERT(success == 10);
+	}
+
+	/**
+	 * Write content to a new temporary file
+	 *
+	 * @return file path, caller removes the file
+	 */
+	static std::string write_temp_file(const std::string &content)
+	{
+		char path[] = "/tmp/winterwind_unittest_XXXXXX";
+		int fd = mkstemp(path);
+		CPPUNIT_ASSERT(fd >= 0);
+		CPPUNIT_ASSERT(write(fd, content.data(), content.size()) == (ssize_t) content.size());
+		close(fd);
+		return path;
+	}
+
+	/**
+	 * Post a JSON body to unittest5.html
+	 *
+	 * @return server response
+	 */
+	static std::string post_json_body(const RequestBodyPtr &body)
+	{
+		HTTPClient cli;
+		http::Query query("http://localhost:58080/unittest5.html", http::POST);
+		query.set_body(body);
+
+		std::string res;
+		cli.add_http_header("Content-Type", "application/json");
+		cli.request(query, res);
+		return res;
+	}
+
 private:
 	Server *m_http_server = nullptr;
 	std::string HTTPSERVER_TEST01_STR = "<h1>unittest_result</h1>";
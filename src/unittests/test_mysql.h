@@ -32,7 +32,14 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cppunit/ui/text/TestRunner.h>
 
+#include <core/databases/mysqlbulk.h>
 #include <core/databases/mysqlclient.h>
+#include <core/databases/sqlutils.h>
+#include <core/utils/time.h>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 namespace winterwind {
 
@@ -50,6 +57,11 @@ class Test_MySQL : public CppUnit::TestFixture
 	CPPUNIT_TEST(mysql_insert);
 	CPPUNIT_TEST(mysql_transaction_insert);
 	CPPUNIT_TEST(mysql_drop_table);
+	CPPUNIT_TEST(mysql_query_stats);
+	CPPUNIT_TEST(mysql_prepared_statement);
+	CPPUNIT_TEST(mysql_check_connection);
+	CPPUNIT_TEST(mysql_result_stream);
+	CPPUNIT_TEST(mysql_bulk_insert);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -138,6 +150,361 @@ protected:
 
 		CPPUNIT_ASSERT(drop_table_ok);
 	}
+
+	void mysql_query_stats()
+	{
+		mysql_create_table();
+
+		INIT_MYSQL_CLIENT;
+
+		db::DatabaseQueryStatsConfig config;
+		config.slow_query_threshold = std::chrono::milliseconds(100);
+		auto stats = std::make_shared<db::DatabaseQueryStats>(config);
+		stats->set_explain_function(mysql.create_explain_function());
+
+		std::mutex slow_query_mutex;
+		std::vector<db::DatabaseSlowQuery> slow_queries;
+		stats->set_slow_query_callback([&](const db::DatabaseSlowQuery &query) {
+			std::lock_guard<std::mutex> lock(slow_query_mutex);
+			slow_queries.push_back(query);
+		});
+
+		mysql.set_query_stats(stats);
+
+		// Unprepared queries differing only by their values share their statistics
+		mysql.exec("INSERT INTO " + MYSQL_TEST_TABLE + "(i,s) VALUES (1, 'test'), "
+			"(2, 'it''s')");
+		mysql.exec("INSERT INTO " + MYSQL_TEST_TABLE + "(i,s)  VALUES (3, \"a\\\"b\"),\n"
+			"(4.5e1, 'test')");
+
+		db::DatabaseStatementStats insert_stats = stats->get_statement_stats(
+			"INSERT INTO " + MYSQL_TEST_TABLE + "(i,s) VALUES (?, ?), (?, ?)");
+		CPPUNIT_ASSERT(insert_stats.count == 2 && insert_stats.rows == 4);
+		CPPUNIT_ASSERT(db::normalize_query("SELECT a1 FROM t2 WHERE b = 0x1F", 100) ==
+			"SELECT a1 FROM t2 WHERE b = ?");
+		CPPUNIT_ASSERT(db::normalize_query("SELECT a, b FROM t", 8) == "SELECT a...");
+
+		mysql.exec("SELECT 1", "ut_select_one");
+		CPPUNIT_ASSERT(stats->get_statement_stats("ut_select_one").count == 1);
+
+		// Batch inserts are recorded under their INSERT prefix
+		{
+			db::MySQLBatchInserter inserter(mysql, MYSQL_TEST_TABLE, {"i", "s"}, 64);
+			for (int64_t i = 0; i < 10; i++) {
+				inserter.write(i).write("batch").end_row();
+			}
+
+			CPPUNIT_ASSERT(inserter.end() == 10);
+			CPPUNIT_ASSERT(stats->get_statement_stats(inserter.get_statement_name()).rows
+				== 10);
+		}
+
+		static const std::string error_query = "SELECT * FROM ut_missing_table";
+		bool query_failed = false;
+		try {
+			mysql.exec(error_query);
+		}
+		catch (db::MySQLException &) {
+			query_failed = true;
+		}
+
+		CPPUNIT_ASSERT(query_failed);
+
+		CPPUNIT_ASSERT(stats->get_statement_stats(error_query).errors == 1);
+
+		// Slow query is logged then explained from another connection
+		static const std::string slow_query = "SELECT * FROM " + MYSQL_TEST_TABLE
+			+ " WHERE SLEEP(0.1) = 0";
+		mysql.exec(slow_query);
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		size_t slow_query_count = 0;
+		while (slow_query_count == 0 && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			std::lock_guard<std::mutex> lock(slow_query_mutex);
+			slow_query_count = slow_queries.size();
+		}
+
+		CPPUNIT_ASSERT(slow_query_count == 1 && slow_queries[0].query == slow_query);
+		CPPUNIT_ASSERT(slow_queries[0].statement == "SELECT * FROM " + MYSQL_TEST_TABLE
+			+ " WHERE SLEEP(?) = ?");
+		CPPUNIT_ASSERT(slow_queries[0].plan.find(MYSQL_TEST_TABLE) != std::string::npos);
+	}
+
+	void mysql_prepared_statement()
+	{
+		mysql_create_table();
+
+		INIT_MYSQL_CLIENT;
+
+		static const std::string insert_query = "INSERT INTO " + MYSQL_TEST_TABLE
+			+ "(i,s) VALUES (?, ?)";
+		for (int32_t i = 0; i < 10; i++) {
+			db::MySQLStatement &stmt = mysql.exec_prepared(insert_query, i,
+				"test" + std::to_string(i));
+			CPPUNIT_ASSERT(stmt.get_row_count() == 1);
+		}
+
+		mysql.exec_prepared(insert_query, nullptr, nullptr);
+		CPPUNIT_ASSERT(mysql.get_statements_count() == 1);
+
+		db::MySQLStatement &select = mysql.exec_prepared("SELECT i, s FROM "
+			+ MYSQL_TEST_TABLE + " WHERE i >= ? ORDER BY i", 5);
+		CPPUNIT_ASSERT(select.get_row_count() == 5 && select.get_field_count() == 2);
+
+		int32_t expected = 5;
+		while (select.fetch()) {
+			CPPUNIT_ASSERT(select.get<int32_t>(0) == expected);
+			CPPUNIT_ASSERT(select.get<std::string>(1) == "test" + std::to_string(expected));
+			expected++;
+		}
+
+		CPPUNIT_ASSERT(expected == 10);
+
+		db::MySQLStatement &null_select = mysql.exec_prepared("SELECT i, s FROM "
+			+ MYSQL_TEST_TABLE + " WHERE i IS NULL");
+		CPPUNIT_ASSERT(null_select.fetch() && null_select.is_null(0) && null_select.is_null(1));
+		CPPUNIT_ASSERT(!null_select.fetch());
+
+		// Values larger than result buffer
+		db::MySQLStatement &repeat = mysql.exec_prepared("SELECT REPEAT('a', ?), ?", 1000,
+			1.5);
+		CPPUNIT_ASSERT(repeat.fetch());
+		CPPUNIT_ASSERT(repeat.get<std::string>(0) == std::string(1000, 'a'));
+		CPPUNIT_ASSERT(repeat.get<double>(1) == 1.5);
+
+		bool bind_failed = false;
+		try {
+			mysql.exec_prepared(insert_query, 1);
+		}
+		catch (db::MySQLException &) {
+			bind_failed = true;
+		}
+
+		CPPUNIT_ASSERT(bind_failed);
+
+		mysql.set_statements_capacity(1);
+		CPPUNIT_ASSERT(mysql.get_statements_count() == 1);
+	}
+
+	void mysql_check_connection()
+	{
+		INIT_MYSQL_CLIENT;
+
+		static const std::string connection_id_query = "SELECT CONNECTION_ID()";
+		static const int32_t query_count = 1000;
+
+		db::MySQLStatement &stmt = mysql.exec_prepared(connection_id_query);
+		CPPUNIT_ASSERT(stmt.fetch());
+		const int64_t connection_id = stmt.get<int64_t>(0);
+
+		// Recently used connection is not pinged
+		double check_duration = 0;
+		{
+			START_CHRONO
+			for (int32_t i = 0; i < query_count; i++) {
+				mysql.check_connection();
+			}
+			END_CHRONO
+			chrono_duration(start_time, end_time, check_duration);
+			std::cout << "MySQL check_connection: " << query_count << " checks in "
+				<< CHRONO_DURATION_STR << std::endl;
+		}
+
+		// Ping before each query as reference
+		mysql.set_ping_interval(std::chrono::milliseconds(0));
+		double ping_duration = 0;
+		{
+			START_CHRONO
+			for (int32_t i = 0; i < query_count; i++) {
+				mysql.check_connection();
+			}
+			END_CHRONO
+			chrono_duration(start_time, end_time, ping_duration);
+			std::cout << "MySQL check_connection with ping: " << query_count
+				<< " checks in " << CHRONO_DURATION_STR << std::endl;
+		}
+
+		CPPUNIT_ASSERT(check_duration < ping_duration);
+
+		// Queries don't reconnect
+		db::MySQLStatement &same_stmt = mysql.exec_prepared(connection_id_query);
+		CPPUNIT_ASSERT(same_stmt.fetch() && same_stmt.get<int64_t>(0) == connection_id);
+
+		// Killed connection is restored on next query
+		mysql.set_ping_interval(std::chrono::seconds(5));
+		{
+			INIT_MYSQL_CLIENT;
+			mysql.exec("KILL " + std::to_string(connection_id));
+		}
+
+		bool query_failed = false;
+		try {
+			mysql.exec("SELECT 1");
+		}
+		catch (db::MySQLException &) {
+			query_failed = true;
+		}
+
+		CPPUNIT_ASSERT(query_failed);
+
+		db::MySQLStatement &new_stmt = mysql.exec_prepared(connection_id_query);
+		CPPUNIT_ASSERT(new_stmt.fetch() && new_stmt.get<int64_t>(0) != connection_id);
+	}
+
+	void mysql_result_stream()
+	{
+		mysql_transaction_insert();
+
+		INIT_MYSQL_CLIENT;
+
+		{
+			db::MySQLResult res = mysql.exec("SELECT i, s FROM " + MYSQL_TEST_TABLE
+				+ " ORDER BY i");
+			CPPUNIT_ASSERT(res.get_field_count() == 2);
+			CPPUNIT_ASSERT(res.get_field_index("s") == 1);
+
+			int32_t expected = 0;
+			while (res.next()) {
+				CPPUNIT_ASSERT(res.get<int32_t>("i") == expected);
+				CPPUNIT_ASSERT(res.get<std::string>(1) == "test");
+				expected++;
+			}
+
+			CPPUNIT_ASSERT(expected == 100 && res.get_row_count() == 100);
+		}
+
+		mysql.exec_prepared("INSERT INTO " + MYSQL_TEST_TABLE + "(i,s) VALUES (?, ?)",
+			nullptr, "a,\"b\"\n");
+
+		static const std::string export_query = "SELECT i, s FROM " + MYSQL_TEST_TABLE
+			+ " WHERE i IS NULL OR i < 2 ORDER BY i";
+		{
+			std::stringstream ss;
+			mysql.exec(export_query).toJsonStream(ss);
+			CPPUNIT_ASSERT(ss.str() == "[[null,\"a,\\\"b\\\"\\n\"],[0,\"test\"],[1,\"test\"]]");
+		}
+
+		{
+			std::stringstream ss;
+			mysql.exec(export_query).toJsonStream(ss, true);
+			CPPUNIT_ASSERT(ss.str().find("{\"i\":0,\"s\":\"test\"}") != std::string::npos);
+		}
+
+		{
+			std::stringstream ss;
+			mysql.exec(export_query).toCsvStream(ss);
+			CPPUNIT_ASSERT(ss.str() == "i,s\r\n,\"a,\"\"b\"\"\n\"\r\n0,test\r\n1,test\r\n");
+		}
+	}
+
+	int64_t mysql_count_rows(db::MySQLClient &mysql)
+	{
+		db::MySQLResult res = mysql.exec("SELECT COUNT(*) FROM " + MYSQL_TEST_TABLE);
+		return res.next() ? res.get<int64_t>(0) : -1;
+	}
+
+	void mysql_bulk_insert()
+	{
+		mysql_create_table();
+
+		INIT_MYSQL_CLIENT;
+
+		static const int32_t insert_rows = 1000;
+		static const int32_t bulk_rows = 100000;
+		static const std::string special_value = "a\tb\nc\\d\re'f";
+		// UTF-8 "café €"
+		static const std::string unicode_value = "caf\xc3\xa9 \xe2\x82\xac";
+
+		// Row by row INSERT as reference
+		{
+			START_CHRONO
+			mysql.begin();
+			for (int32_t i = 0; i < insert_rows; i++) {
+				mysql.exec("INSERT INTO " + MYSQL_TEST_TABLE + "(i,s) VALUES ("
+					+ std::to_string(i) + ", 'test')");
+			}
+			mysql.commit();
+			END_CHRONO
+			std::cout << "MySQL INSERT: " << insert_rows << " rows in "
+				<< CHRONO_DURATION_STR << std::endl;
+		}
+
+		mysql.exec("TRUNCATE TABLE " + MYSQL_TEST_TABLE);
+
+		{
+			// Small statements to verify packing
+			db::MySQLBatchInserter inserter(mysql, MYSQL_TEST_TABLE, {"i", "s"}, 64 * 1024);
+			CPPUNIT_ASSERT(inserter.get_max_statement_size() == 64 * 1024);
+
+			START_CHRONO
+			for (int32_t i = 0; i < bulk_rows; i++) {
+				inserter.write_row(i, "test");
+			}
+			inserter.write_row(nullptr, special_value);
+			inserter.write_row(-1, unicode_value);
+			CPPUNIT_ASSERT(inserter.end() == bulk_rows + 2);
+			END_CHRONO
+			std::cout << "MySQL batch INSERT: " << bulk_rows << " rows in "
+				<< CHRONO_DURATION_STR << std::endl;
+		}
+
+		CPPUNIT_ASSERT(mysql_count_rows(mysql) == bulk_rows + 2);
+		{
+			db::MySQLResult res = mysql.exec("SELECT s FROM " + MYSQL_TEST_TABLE
+				+ " WHERE i IS NULL");
+			CPPUNIT_ASSERT(res.next() && res.get<std::string>(0) == special_value);
+			db::MySQLResult unicode_res = mysql.exec("SELECT s FROM " + MYSQL_TEST_TABLE
+				+ " WHERE i = -1");
+			CPPUNIT_ASSERT(unicode_res.next() && unicode_res.get<std::string>(0) == unicode_value);
+		}
+
+		mysql.exec("TRUNCATE TABLE " + MYSQL_TEST_TABLE);
+
+		bool loader_refused = false;
+		try {
+			db::MySQLBulkLoader loader(mysql, MYSQL_TEST_TABLE);
+		}
+		catch (db::MySQLException &) {
+			loader_refused = true;
+		}
+
+		CPPUNIT_ASSERT(loader_refused);
+
+		mysql.set_local_infile(true);
+		{
+			db::MySQLBulkLoader loader(mysql, MYSQL_TEST_TABLE, {"i", "s"});
+
+			START_CHRONO
+			for (int32_t i = 0; i < bulk_rows; i++) {
+				loader.write_row(i, "test");
+			}
+			loader.write_row(nullptr, special_value);
+			loader.write_row(-1, unicode_value);
+
+			bool empty_row_refused = false;
+			try {
+				loader.end_row();
+			}
+			catch (db::MySQLException &) {
+				empty_row_refused = true;
+			}
+
+			CPPUNIT_ASSERT(empty_row_refused);
+			CPPUNIT_ASSERT(loader.end() == bulk_rows + 2);
+			END_CHRONO
+			std::cout << "MySQL LOAD DATA LOCAL INFILE: " << bulk_rows << " rows in "
+				<< CHRONO_DURATION_STR << std::endl;
+		}
+
+		CPPUNIT_ASSERT(mysql_count_rows(mysql) == bulk_rows + 2);
+		db::MySQLResult res = mysql.exec("SELECT s FROM " + MYSQL_TEST_TABLE
+			+ " WHERE i IS NULL");
+		CPPUNIT_ASSERT(res.next() && res.get<std::string>(0) == special_value);
+		db::MySQLResult unicode_res = mysql.exec("SELECT s FROM " + MYSQL_TEST_TABLE
+			+ " WHERE i = -1");
+		CPPUNIT_ASSERT(unicode_res.next() && unicode_res.get<std::string>(0) == unicode_value);
+	}
 };
 }
 }
@@ -26,17 +26,62 @@
 #include "test_postgresql.h"
 
 #include <core/databases/postgresqlclient.h>
+#include <core/databases/connectionpool.h>
+#include <core/databases/postgresqlasyncclient.h>
+#include <core/databases/postgresqlcopy.h>
+#include <core/databases/postgresqllistener.h>
+#include <core/databases/postgresqlresultcache.h>
+#include <core/databases/postgresqlresultstream.h>
+#include <core/databases/postgresqlrouter.h>
+#include <core/databases/sqlutils.h>
+#include <core/utils/time.h>
+#include <sstream>
+#include <thread>
 
 namespace winterwind {
 
 namespace unittests {
 
-#define INIT_PG_CLIENT                                                                   \
-    db::PostgreSQLClient pg("host=postgres user=unittests dbname=unittests_db "          \
-                "password=un1Ttests");
+#define PG_CONNECT_STRING "host=postgres user=unittests dbname=unittests_db "         \
+    "password=un1Ttests"
+
+#define INIT_PG_CLIENT db::PostgreSQLClient pg(PG_CONNECT_STRING);
 
 #define PG_TEST_TABLE std::string("ut_table")
 
+template<typename F>
+static bool wait_for(F condition, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+{
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+struct TestRow
+{
+	int32_t i;
+	std::string s;
+};
+}
+
+namespace db {
+template<> struct PostgreSQLRowMapper<unittests::TestRow>
+{
+	typedef std::tuple<int32_t, std::string> Columns;
+	static unittests::TestRow map(Columns &&c)
+	{
+		return unittests::TestRow{std::get<0>(c), std::move(std::get<1>(c))};
+	}
+};
+}
+
+namespace unittests {
+
 void Test_PostgreSQL::tearDown()
 {
 	INIT_PG_CLIENT;
@@ -181,5 +226,776 @@ void Test_PostgreSQL::pg_show_tables()
 	std::vector<std::string> res;
 	CPPUNIT_ASSERT(pg.show_tables("public", res) == PGRES_TUPLES_OK);
 }
+
+void Test_PostgreSQL::pg_connection_pool()
+{
+	db::ConnectionPoolConfig config;
+	config.min_size = 1;
+	config.max_size = 2;
+	config.wait_timeout = std::chrono::milliseconds(100);
+
+	db::ConnectionPool<db::PostgreSQLClient> pool([] {
+		return std::make_unique<db::PostgreSQLClient>(PG_CONNECT_STRING);
+	}, config);
+
+	{
+		auto c1 = pool.acquire();
+		auto c2 = pool.acquire();
+		c1->exec("SELECT 1");
+
+		bool timed_out = false;
+		try {
+			pool.acquire();
+		}
+		catch (db::DatabaseException &e) {
+			timed_out = true;
+		}
+
+		CPPUNIT_ASSERT(timed_out);
+	}
+
+	std::vector<std::thread> workers;
+	for (uint8_t i = 0; i < 8; i++) {
+		workers.emplace_back([&pool] {
+			for (uint8_t j = 0; j < 10; j++) {
+				auto pg = pool.acquire(std::chrono::seconds(10));
+				pg->exec("SELECT 1");
+			}
+		});
+	}
+
+	for (auto &w : workers) {
+		w.join();
+	}
+
+	db::ConnectionPoolMetrics metrics = pool.get_metrics();
+	CPPUNIT_ASSERT(metrics.created == 2);
+	CPPUNIT_ASSERT(metrics.in_use == 0);
+	CPPUNIT_ASSERT(metrics.borrowed == 82);
+	CPPUNIT_ASSERT(metrics.timeouts == 1);
+
+	// Broken connections are dropped, pool is refilled up to min_size
+	{
+		auto c1 = pool.acquire();
+		auto c2 = pool.acquire();
+		c1.invalidate();
+		c2.invalidate();
+	}
+
+	metrics = pool.get_metrics();
+	CPPUNIT_ASSERT(metrics.size == 1 && metrics.idle == 1);
+	CPPUNIT_ASSERT(metrics.created == 3);
+	CPPUNIT_ASSERT(metrics.destroyed == 2);
+}
+
+void Test_PostgreSQL::pg_typed_results()
+{
+	INIT_PG_CLIENT
+
+	static const char *query = "SELECT 9223372036854775807::int8, -2::int2, 1.5::float8, "
+		"true, 12345678901234567890.123::numeric, "
+		"'2017-05-04 12:34:56.5+00'::timestamptz, "
+		"'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid, '\\x0001ff'::bytea, "
+		"ARRAY[1,2,3]::int4[], ARRAY['a','b c']::text[], NULL::int4, "
+		"ARRAY[1,NULL,3]::int4[]";
+
+	// Text & binary results should be decoded the same way
+	for (bool binary : {false, true}) {
+		db::PostgreSQLResult res = pg.exec(query, binary);
+		CPPUNIT_ASSERT(res.get<int64_t>(0, 0) == INT64_MAX);
+		CPPUNIT_ASSERT(res.get<int16_t>(0, 1) == -2);
+		CPPUNIT_ASSERT(res.get<double>(0, 2) == 1.5);
+		CPPUNIT_ASSERT(res.get<bool>(0, 3));
+		CPPUNIT_ASSERT(res.get<std::string>(0, 4) == "12345678901234567890.123");
+		CPPUNIT_ASSERT(res.get<db::PostgreSQLTimestamp>(0, 5).time_since_epoch() ==
+			std::chrono::microseconds(1493901296500000LL));
+		CPPUNIT_ASSERT(res.get<std::string>(0, 6) == "a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11");
+		CPPUNIT_ASSERT(res.get<std::string>(0, 7) == std::string("\x00\x01\xff", 3));
+		CPPUNIT_ASSERT(res.get<std::vector<int32_t>>(0, 8) == std::vector<int32_t>({1, 2, 3}));
+		CPPUNIT_ASSERT(res.get<std::vector<std::string>>(0, 9) ==
+			std::vector<std::string>({"a", "b c"}));
+		CPPUNIT_ASSERT(res.is_null(0, 10) && res.get<int32_t>(0, 10) == 0);
+
+		// NULL elements cannot be represented in the vector
+		bool null_element = false;
+		try {
+			res.get<std::vector<int32_t>>(0, 11);
+		}
+		catch (db::DatabaseException &e) {
+			null_element = true;
+		}
+		CPPUNIT_ASSERT(null_element);
+
+		Json::Value json_res;
+		res.toJson(json_res);
+		CPPUNIT_ASSERT(json_res["results"][0][0].asInt64() == INT64_MAX);
+	}
+}
+
+void Test_PostgreSQL::pg_copy()
+{
+	pg_create_table();
+
+	INIT_PG_CLIENT
+
+	static const int32_t insert_rows = 1000;
+	static const int32_t copy_rows = 100000;
+	static const std::string special_value = "a\tb\nc\\d\re";
+
+	// Row by row INSERT as reference
+	{
+		START_CHRONO
+		pg.begin();
+		for (int32_t i = 0; i < insert_rows; i++) {
+			std::string query = "INSERT INTO " + PG_TEST_TABLE + "(i,s) VALUES ("
+				+ std::to_string(i) + ", 'test')";
+			pg.exec(query.c_str());
+		}
+		pg.commit();
+		END_CHRONO
+		std::cout << "PostgreSQL INSERT: " << insert_rows << " rows in "
+			<< CHRONO_DURATION_STR << std::endl;
+	}
+
+	for (db::PostgreSQLCopyFormat format : {db::PG_COPY_TEXT, db::PG_COPY_BINARY}) {
+		START_CHRONO
+		db::PostgreSQLCopyWriter writer(pg, PG_TEST_TABLE, {"i", "s"}, format);
+		for (int32_t i = 0; i < copy_rows; i++) {
+			writer.write_row(i, "test");
+		}
+		writer.write(copy_rows).write(special_value).end_row();
+		writer.write(copy_rows + 1).write_null().end_row();
+		CPPUNIT_ASSERT(writer.end() == (uint64_t) copy_rows + 2);
+		END_CHRONO
+		std::cout << "PostgreSQL COPY (" << (format == db::PG_COPY_BINARY ? "binary" : "text")
+			<< "): " << copy_rows << " rows in " << CHRONO_DURATION_STR << std::endl;
+	}
+
+	// Aborted COPY must not insert anything and keep connection usable
+	{
+		db::PostgreSQLCopyWriter writer(pg, PG_TEST_TABLE);
+		writer.write_row(-1, "aborted");
+		writer.abort();
+	}
+
+	std::string select_query = "SELECT i, s FROM " + PG_TEST_TABLE + " WHERE i >= "
+		+ std::to_string(copy_rows) + " OR i < 0 ORDER BY i";
+	for (db::PostgreSQLCopyFormat format : {db::PG_COPY_TEXT, db::PG_COPY_BINARY}) {
+		db::PostgreSQLCopyReader reader(pg, select_query, format);
+		Oid string_type = format == db::PG_COPY_BINARY ? db::PG_VARCHAROID : db::PG_TEXTOID;
+		uint32_t special_count = 0, null_count = 0;
+		uint64_t rows = reader.read_all([&](const db::PostgreSQLCopyReader &row) {
+			CPPUNIT_ASSERT(row.get_field_count() == 2);
+			if (row.is_null(1)) {
+				null_count++;
+				return;
+			}
+			CPPUNIT_ASSERT(row.get<int32_t>(0, db::PG_INT4OID) == copy_rows);
+			CPPUNIT_ASSERT(row.get<std::string>(1, string_type) == special_value);
+			special_count++;
+		});
+
+		CPPUNIT_ASSERT(rows == 4 && special_count == 2 && null_count == 2);
+	}
+
+	START_CHRONO
+	db::PostgreSQLCopyReader reader(pg, "SELECT i, s FROM " + PG_TEST_TABLE);
+	uint64_t rows = 0;
+	while (reader.next()) {
+		rows++;
+	}
+	END_CHRONO
+	std::cout << "PostgreSQL COPY TO: " << rows << " rows in " << CHRONO_DURATION_STR
+		<< std::endl;
+	CPPUNIT_ASSERT(rows == (uint64_t) insert_rows + 2 * (copy_rows + 2));
+}
+
+void Test_PostgreSQL::pg_batch()
+{
+	pg_create_table();
+
+	INIT_PG_CLIENT
+
+	static const int32_t batch_rows = 5000;
+	pg.register_statement("ut_batch_insert", "INSERT INTO " + PG_TEST_TABLE
+		+ " (i, s) VALUES ($1, $2)");
+	pg.register_statement("ut_batch_count", "SELECT count(*) FROM " + PG_TEST_TABLE);
+
+	db::PostgreSQLBatch batch;
+	for (int32_t i = 0; i < batch_rows; i++) {
+		batch.add("ut_batch_insert", {std::to_string(i), "batch"});
+	}
+	batch.add("ut_batch_count");
+
+	START_CHRONO
+	std::vector<db::PostgreSQLResult> results = pg.exec_batch(batch);
+	END_CHRONO
+	std::cout << "PostgreSQL batch: " << batch.size() << " queries in "
+		<< CHRONO_DURATION_STR << std::endl;
+
+	CPPUNIT_ASSERT(results.size() == batch.size());
+	CPPUNIT_ASSERT(results.back().get<int64_t>(0, 0) == batch_rows);
+
+	// Failing query must be reported, rollback whole batch and keep connection usable
+	batch.clear();
+	batch.add("ut_batch_insert", {"1", "ok"})
+		.add("ut_batch_insert", {"not_an_integer", "failure"})
+		.add("ut_batch_insert", {"2", "aborted"});
+
+	bool batch_failed = false;
+	try {
+		pg.exec_batch(batch);
+	}
+	catch (db::PostgreSQLException &e) {
+		batch_failed = true;
+	}
+
+	CPPUNIT_ASSERT(batch_failed);
+	db::PostgreSQLResult res = pg.exec(("SELECT count(*) FROM " + PG_TEST_TABLE).c_str());
+	CPPUNIT_ASSERT(res.get<int64_t>(0, 0) == batch_rows);
+
+	// Registered statements must survive a reconnection after a broken batch
+	{
+		db::PostgreSQLClient killer(PG_CONNECT_STRING);
+		db::PostgreSQLResult pid = pg.exec("SELECT pg_backend_pid()");
+		killer.exec(("SELECT pg_terminate_backend(" +
+			std::to_string(pid.get<int32_t>(0, 0)) + ")").c_str());
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	batch.clear();
+	batch.add("ut_batch_count");
+	batch_failed = false;
+	try {
+		pg.exec_batch(batch);
+	}
+	catch (db::PostgreSQLException &e) {
+		batch_failed = true;
+	}
+
+	CPPUNIT_ASSERT(batch_failed);
+	pg.check_connection();
+	db::PostgreSQLParams no_params;
+	db::PostgreSQLResult count = pg.exec_statement("ut_batch_count", no_params);
+	CPPUNIT_ASSERT(count.get<int64_t>(0, 0) == batch_rows);
+}
+
+void Test_PostgreSQL::pg_result_stream()
+{
+	INIT_PG_CLIENT
+
+	static const int64_t stream_rows = 200000;
+	static const std::string query = "SELECT i, 'row ' || i FROM generate_series(1, $1::int8) i";
+
+	for (db::PostgreSQLStreamMode mode : {db::PG_STREAM_ROWS, db::PG_STREAM_CURSOR}) {
+		for (bool binary : {false, true}) {
+			db::PostgreSQLResultStream stream(pg, query, {std::to_string(stream_rows)}, mode,
+				1000, binary);
+			int64_t sum = 0;
+			while (stream.next()) {
+				sum += stream.get<int64_t>(0);
+				if (stream.get_row_count() == 42) {
+					CPPUNIT_ASSERT(stream.get<std::string>(1) == "row 42");
+				}
+			}
+
+			CPPUNIT_ASSERT(stream.get_row_count() == (uint64_t) stream_rows);
+			CPPUNIT_ASSERT(sum == stream_rows * (stream_rows + 1) / 2);
+		}
+
+		// Stopping early must leave the connection usable
+		{
+			db::PostgreSQLResultStream stream(pg, query, {std::to_string(stream_rows)}, mode);
+			CPPUNIT_ASSERT(stream.next() && stream.get<int64_t>(0) == 1);
+		}
+
+		db::PostgreSQLResult res = pg.exec("SELECT 1");
+		CPPUNIT_ASSERT(res.get<int32_t>(0, 0) == 1);
+
+		bool query_failed = false;
+		try {
+			db::PostgreSQLResultStream stream(pg, "SELECT 1 / (i - 500) FROM "
+				"generate_series(1, 1000) i", {}, mode, 100);
+			while (stream.next()) {}
+		}
+		catch (db::PostgreSQLException &e) {
+			query_failed = true;
+		}
+
+		CPPUNIT_ASSERT(query_failed);
+	}
+
+	// Fields are known from first result and kept after last row
+	{
+		db::PostgreSQLResultStream stream(pg, "SELECT 1 AS a, 2 AS b WHERE false");
+		bool no_fields = false;
+		try {
+			stream.get_field_count();
+		}
+		catch (db::PostgreSQLException &e) {
+			no_fields = true;
+		}
+
+		CPPUNIT_ASSERT(no_fields);
+		CPPUNIT_ASSERT(!stream.next());
+		CPPUNIT_ASSERT(stream.get_field_count() == 2);
+		CPPUNIT_ASSERT(stream.get_field_name(1) == "b");
+	}
+
+	// Stopping early in a transaction must not abort it
+	pg.begin();
+	{
+		db::PostgreSQLResultStream stream(pg, query, {std::to_string(stream_rows)});
+		CPPUNIT_ASSERT(stream.next());
+	}
+
+	db::PostgreSQLResult res = pg.exec("SELECT 1");
+	CPPUNIT_ASSERT(res.get<int32_t>(0, 0) == 1);
+	pg.commit();
+}
+
+void Test_PostgreSQL::pg_async_client()
+{
+	db::PostgreSQLAsyncClient pg(PG_CONNECT_STRING " application_name=ut_async", 4);
+	pg.register_statement("ut_async_square", "SELECT $1::int4 * $1::int4");
+	pg.start();
+
+	std::vector<std::future<db::PostgreSQLResult>> futures;
+	for (int32_t i = 0; i < 200; i++) {
+		futures.push_back(pg.exec_prepared("ut_async_square", {std::to_string(i)}));
+	}
+
+	// Callbacks may be called in any order, connections run concurrently
+	std::atomic<int32_t> callback_sum(0), callback_count(0);
+	std::promise<void> callbacks_done;
+	for (int32_t i = 0; i < 10; i++) {
+		pg.exec("SELECT $1::int4", {std::to_string(i)},
+			[&](db::PostgreSQLResult *res, const std::string &) {
+				callback_sum += res->get<int32_t>(0, 0);
+				if (++callback_count == 10) {
+					callbacks_done.set_value();
+				}
+			});
+	}
+
+	for (int32_t i = 0; i < 200; i++) {
+		CPPUNIT_ASSERT(futures[i].get().get<int32_t>(0, 0) == i * i);
+	}
+
+	callbacks_done.get_future().wait();
+	CPPUNIT_ASSERT(callback_sum == 45);
+
+	START_CHRONO
+	std::vector<std::future<db::PostgreSQLResult>> sleeps;
+	for (uint8_t i = 0; i < 4; i++) {
+		sleeps.push_back(pg.exec("SELECT pg_sleep(0.5)"));
+	}
+	for (auto &f : sleeps) {
+		f.get();
+	}
+	END_CHRONO
+	double duration;
+	chrono_duration(start_time, end_time, duration);
+	CPPUNIT_ASSERT(duration < 1.5);
+
+	bool query_failed = false;
+	try {
+		pg.exec("SELECT * FROM ut_async_unknown_table").get();
+	}
+	catch (db::PostgreSQLException &e) {
+		query_failed = true;
+	}
+
+	CPPUNIT_ASSERT(query_failed);
+	CPPUNIT_ASSERT(pg.pending_queries() == 0);
+
+	// Killed connections are reset and their statements prepared again
+	{
+		db::PostgreSQLClient killer(PG_CONNECT_STRING);
+		killer.exec("SELECT pg_terminate_backend(pid) FROM pg_stat_activity "
+			"WHERE application_name = 'ut_async'");
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// A killed connection fails at most its running query
+	uint32_t reset_failures = 0;
+	for (int32_t i = 0; i < 20; i++) {
+		try {
+			db::PostgreSQLResult res = pg.exec_prepared("ut_async_square",
+				{std::to_string(i)}).get();
+			CPPUNIT_ASSERT(res.get<int32_t>(0, 0) == i * i);
+		}
+		catch (db::PostgreSQLException &e) {
+			reset_failures++;
+		}
+	}
+
+	CPPUNIT_ASSERT(reset_failures <= 4);
+	CPPUNIT_ASSERT(pg.exec_prepared("ut_async_square", {"3"}).get().get<int32_t>(0, 0) == 9);
+	pg.stop_and_wait();
+
+	// Queries queued once stopped fail instead of waiting forever
+	bool rejected = false;
+	try {
+		pg.exec("SELECT 1").get();
+	}
+	catch (db::PostgreSQLException &e) {
+		rejected = true;
+	}
+
+	CPPUNIT_ASSERT(rejected);
+	CPPUNIT_ASSERT(pg.pending_queries() == 0);
+}
+
+void Test_PostgreSQL::pg_json_writer()
+{
+	INIT_PG_CLIENT
+
+	static const char *query = "SELECT i AS id, i * 1.5::float8 AS ratio, "
+		"'row \"' || i || E'\"\\n' AS label, i % 2 = 0 AS even, NULL::int4 AS nothing "
+		"FROM generate_series(1, 100000) i";
+
+	for (bool binary : {false, true}) {
+		db::PostgreSQLResult res = pg.exec(query, binary);
+
+		std::string json_tree;
+		{
+			START_CHRONO
+			Json::Value json_res;
+			res.toJson(json_res);
+			json_tree = Json::FastWriter().write(json_res);
+			END_CHRONO
+			std::cout << "PostgreSQL JSON (Json::Value): " << CHRONO_DURATION_STR << std::endl;
+		}
+
+		std::string json_direct;
+		{
+			START_CHRONO
+			res.toJsonString(json_direct);
+			END_CHRONO
+			std::cout << "PostgreSQL JSON (direct): " << CHRONO_DURATION_STR << std::endl;
+		}
+
+		Json::Value tree_value, direct_value;
+		Json::Reader reader;
+		CPPUNIT_ASSERT(reader.parse(json_tree, tree_value));
+		CPPUNIT_ASSERT(reader.parse(json_direct, direct_value));
+		CPPUNIT_ASSERT(tree_value == direct_value);
+		CPPUNIT_ASSERT(direct_value["results"][41][2].asString() == "row \"42\"\n");
+
+		std::stringstream ss;
+		res.toJsonStream(ss, true);
+		Json::Value named_value;
+		CPPUNIT_ASSERT(reader.parse(ss.str(), named_value));
+		CPPUNIT_ASSERT(named_value["results"][41]["id"].asInt() == 42);
+		CPPUNIT_ASSERT(named_value["results"][41]["ratio"].asDouble() == 63.0);
+		CPPUNIT_ASSERT(named_value["results"][41]["even"].asBool());
+		CPPUNIT_ASSERT(named_value["results"][41]["nothing"].isNull());
+	}
+}
+
+void Test_PostgreSQL::pg_typed_query()
+{
+	pg_transaction_insert();
+
+	INIT_PG_CLIENT
+	pg.register_statement("ut_typed_query", "SELECT i, s, i * 0.5::float8 FROM "
+		+ PG_TEST_TABLE + " WHERE i >= $1 AND s = $2 ORDER BY i");
+
+	auto rows = pg.query<std::tuple<int32_t, std::string, double>>("ut_typed_query", 90,
+		"test");
+	CPPUNIT_ASSERT(rows.size() == 10);
+	CPPUNIT_ASSERT(std::get<0>(rows[0]) == 90);
+	CPPUNIT_ASSERT(std::get<1>(rows[0]) == "test");
+	CPPUNIT_ASSERT(std::get<2>(rows[9]) == 49.5);
+
+	std::vector<TestRow> test_rows = pg.query<TestRow>("ut_typed_query", 98,
+		std::string("test"));
+	CPPUNIT_ASSERT(test_rows.size() == 2 && test_rows[1].i == 99);
+
+	bool conversion_failed = false;
+	try {
+		pg.query<std::tuple<bool, bool, bool, bool>>("ut_typed_query", 0, "test");
+	}
+	catch (db::PostgreSQLException &e) {
+		conversion_failed = true;
+	}
+
+	CPPUNIT_ASSERT(conversion_failed);
+}
+
+void Test_PostgreSQL::pg_exec_params()
+{
+	INIT_PG_CLIENT
+	pg.set_auto_statements_capacity(2);
+
+	static const std::string query = "SELECT $1::int8 + $2::int8, $3::text, $4::text IS NULL";
+	for (int64_t i = 0; i < 10; i++) {
+		db::PostgreSQLResult res = pg.exec_params(query, i, 1, "it's", nullptr);
+		CPPUNIT_ASSERT(res.get<int64_t>(0, 0) == i + 1);
+		CPPUNIT_ASSERT(res.get<std::string>(0, 1) == "it's");
+		CPPUNIT_ASSERT(res.get<bool>(0, 2));
+	}
+
+	CPPUNIT_ASSERT(pg.get_auto_statements_count() == 1);
+
+	pg.exec_params("SELECT $1::int4", 1);
+	pg.exec_params("SELECT $1::int4, $2::int4", 1, 2);
+	CPPUNIT_ASSERT(pg.get_auto_statements_count() == 2);
+
+	// Statements dropped behind client back are prepared again
+	pg.exec("DEALLOCATE ALL");
+	db::PostgreSQLResult res = pg.exec_params("SELECT $1::int4, $2::int4", 3, 4);
+	CPPUNIT_ASSERT(res.get<int32_t>(0, 1) == 4);
+
+	bool query_failed = false;
+	try {
+		pg.exec_params("SELECT * FROM ut_unknown_table WHERE i = $1", 1);
+	}
+	catch (db::PostgreSQLException &e) {
+		query_failed = true;
+	}
+
+	CPPUNIT_ASSERT(query_failed);
+	CPPUNIT_ASSERT(pg.get_auto_statements_count() == 2);
+}
+
+void Test_PostgreSQL::pg_listener()
+{
+	INIT_PG_CLIENT
+
+	std::mutex payloads_mutex;
+	std::vector<std::string> payloads;
+	db::PostgreSQLListener listener(PG_CONNECT_STRING, std::chrono::milliseconds(100));
+	listener.listen("ut_channel", [&](const db::PostgreSQLNotification &n) {
+		std::unique_lock<std::mutex> lock(payloads_mutex);
+		payloads.push_back(n.payload);
+	});
+	listener.listen("ut queued channel");
+	listener.start();
+
+	auto payload_count = [&]() {
+		std::unique_lock<std::mutex> lock(payloads_mutex);
+		return payloads.size();
+	};
+
+	CPPUNIT_ASSERT(wait_for([&]() { return listener.is_ready(); }));
+	pg.notify("ut_channel", "first");
+	pg.notify("ut queued channel", "queued");
+	pg.notify("ut_unlistened_channel", "ignored");
+	CPPUNIT_ASSERT(wait_for([&]() { return payload_count() == 1; }));
+
+	db::PostgreSQLNotification notification;
+	CPPUNIT_ASSERT(wait_for([&]() { return listener.pop_notification(notification); }));
+	CPPUNIT_ASSERT(notification.channel == "ut queued channel");
+	CPPUNIT_ASSERT(notification.payload == "queued");
+
+	// Kill listener connection, channels must be listened again
+	pg.exec("SELECT pg_terminate_backend(pid) FROM pg_stat_activity "
+		"WHERE query LIKE 'LISTEN%' AND pid <> pg_backend_pid()");
+	CPPUNIT_ASSERT(wait_for([&]() {
+		return listener.get_reconnection_count() == 1 && listener.is_ready();
+	}));
+
+	pg.notify("ut_channel", "second");
+	CPPUNIT_ASSERT(wait_for([&]() { return payload_count() == 2; }));
+	CPPUNIT_ASSERT(payloads[1] == "second");
+
+	listener.stop_and_wait();
+}
+
+void Test_PostgreSQL::pg_result_cache()
+{
+	pg_transaction_insert();
+
+	INIT_PG_CLIENT
+	pg.register_statement("ut_cache_count", "SELECT count(*) FROM " + PG_TEST_TABLE
+		+ " WHERE i >= $1");
+
+	db::PostgreSQLResultCache cache;
+	cache.install_invalidation_trigger(pg, PG_TEST_TABLE);
+
+	db::PostgreSQLListener listener(PG_CONNECT_STRING);
+	cache.attach(listener);
+	listener.start();
+	CPPUNIT_ASSERT(wait_for([&]() { return listener.is_ready(); }));
+
+	db::PostgreSQLResultCache::ResultPtr first = cache.exec(pg, "ut_cache_count",
+		{PG_TEST_TABLE}, 50);
+	db::PostgreSQLResultCache::ResultPtr second = cache.exec(pg, "ut_cache_count",
+		{PG_TEST_TABLE}, 50);
+	CPPUNIT_ASSERT(first == second);
+	CPPUNIT_ASSERT(first->get<int64_t>(0, 0) == 50);
+
+	// Another parameter is another entry
+	CPPUNIT_ASSERT(cache.exec(pg, "ut_cache_count", {PG_TEST_TABLE}, 90)->get<int64_t>(0, 0)
+		== 10);
+
+	db::PostgreSQLResultCacheMetrics metrics = cache.get_metrics();
+	CPPUNIT_ASSERT(metrics.hits == 1 && metrics.misses == 2 && metrics.entries == 2);
+
+	// Table modification invalidates table tag through trigger
+	pg.exec(("INSERT INTO " + PG_TEST_TABLE + " (i, s) VALUES (200, 'new')").c_str());
+	CPPUNIT_ASSERT(wait_for([&]() { return cache.get_metrics().entries == 0; }));
+	CPPUNIT_ASSERT(cache.exec(pg, "ut_cache_count", {PG_TEST_TABLE}, 50)->get<int64_t>(0, 0)
+		== 51);
+
+	// Expired entries are refreshed
+	db::PostgreSQLParams params(90);
+	first = cache.exec_prepared(pg, "ut_cache_count", {}, params, std::chrono::milliseconds(50));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	second = cache.exec_prepared(pg, "ut_cache_count", {}, params);
+	CPPUNIT_ASSERT(first != second);
+	CPPUNIT_ASSERT(cache.get_metrics().expirations == 1);
+
+	listener.stop_and_wait();
+
+	// Memory bound evicts least recently used entries
+	db::PostgreSQLResultCacheConfig config;
+	config.max_memory = 4096;
+	db::PostgreSQLResultCache small_cache(config);
+	for (int32_t i = 0; i < 50; i++) {
+		small_cache.exec(pg, "ut_cache_count", {}, i);
+	}
+
+	metrics = small_cache.get_metrics();
+	CPPUNIT_ASSERT(metrics.memory <= config.max_memory);
+	CPPUNIT_ASSERT(metrics.evictions > 0 && metrics.entries + metrics.evictions == 50);
+}
+
+void Test_PostgreSQL::pg_router()
+{
+	pg_transaction_insert();
+
+	CPPUNIT_ASSERT(db::is_read_only_query(" /* c */ select * from t"));
+	CPPUNIT_ASSERT(db::is_read_only_query("-- c\nSHOW server_version"));
+	CPPUNIT_ASSERT(!db::is_read_only_query("SELECT * FROM t FOR UPDATE"));
+	CPPUNIT_ASSERT(!db::is_read_only_query("SELECT * INTO t2 FROM t"));
+	CPPUNIT_ASSERT(!db::is_read_only_query(
+		"WITH d AS (DELETE FROM t RETURNING *) SELECT * FROM d"));
+	CPPUNIT_ASSERT(!db::is_read_only_query("UPDATE t SET i = 1"));
+
+	// Primary isn't in recovery and has no lag, it can be used as a replica
+	static const std::string unreachable = "host=127.0.0.1 port=1 connect_timeout=1";
+	db::PostgreSQLRouter router(PG_CONNECT_STRING, {unreachable, PG_CONNECT_STRING});
+
+	std::vector<db::PostgreSQLReplicaStatus> status = router.get_replicas_status();
+	CPPUNIT_ASSERT(status.size() == 2 && !status[0].healthy && status[1].healthy);
+
+	for (int32_t i = 0; i < 4; i++) {
+		db::PostgreSQLResult res = router.exec("SELECT count(*) FROM " + PG_TEST_TABLE);
+		CPPUNIT_ASSERT(res.get<int64_t>(0, 0) == 100);
+	}
+
+	router.exec("INSERT INTO " + PG_TEST_TABLE + " (i, s) VALUES (100, 'router')");
+	status = router.get_replicas_status();
+	CPPUNIT_ASSERT(status[0].queries == 0 && status[1].queries == 4);
+
+	// Reads of a primary transaction stay on primary
+	router.begin();
+	router.exec("DELETE FROM " + PG_TEST_TABLE);
+	CPPUNIT_ASSERT(router.exec("SELECT count(*) FROM " + PG_TEST_TABLE)
+		.get<int64_t>(0, 0) == 0);
+	router.rollback();
+	CPPUNIT_ASSERT(router.get_replicas_status()[1].queries == 4);
+
+	router.read_only_transaction([&](db::PostgreSQLClient &client) {
+		CPPUNIT_ASSERT(client.exec(("SELECT count(*) FROM " + PG_TEST_TABLE).c_str())
+			.get<int64_t>(0, 0) == 101);
+	});
+
+	// Without any healthy replica, reads fail over to primary
+	db::PostgreSQLRouter failover_router(PG_CONNECT_STRING, {unreachable});
+	CPPUNIT_ASSERT(failover_router.exec("SELECT 1").get<int32_t>(0, 0) == 1);
+	CPPUNIT_ASSERT(failover_router.get_failover_count() == 1);
+}
+
+void Test_PostgreSQL::pg_query_stats()
+{
+	pg_transaction_insert();
+
+	INIT_PG_CLIENT
+
+	db::DatabaseQueryStatsConfig config;
+	config.slow_query_threshold = std::chrono::milliseconds(100);
+	auto stats = std::make_shared<db::DatabaseQueryStats>(config);
+	stats->set_explain_function(db::PostgreSQLClient::create_explain_function(
+		PG_CONNECT_STRING));
+
+	std::mutex slow_query_mutex;
+	std::vector<db::DatabaseSlowQuery> slow_queries;
+	stats->set_slow_query_callback([&](const db::DatabaseSlowQuery &query) {
+		std::lock_guard<std::mutex> lock(slow_query_mutex);
+		slow_queries.push_back(query);
+	});
+
+	pg.set_query_stats(stats);
+
+	static const std::string count_query = "SELECT count(*) FROM " + PG_TEST_TABLE +
+		" WHERE i < $1";
+	for (int32_t i = 0; i < 10; i++) {
+		pg.exec_params(count_query, i);
+	}
+
+	db::DatabaseStatementStats count_stats = stats->get_statement_stats(count_query);
+	CPPUNIT_ASSERT(count_stats.count == 10 && count_stats.rows == 10);
+	CPPUNIT_ASSERT(count_stats.errors == 0);
+	CPPUNIT_ASSERT(count_stats.percentile(0.5) <= count_stats.max_time);
+
+	// Unprepared queries are recorded without their literals
+	static const std::string update_query = "UPDATE " + PG_TEST_TABLE +
+		" SET s = 'stats' WHERE i < 10";
+	pg.exec(update_query.c_str());
+	CPPUNIT_ASSERT(stats->get_statement_stats("UPDATE " + PG_TEST_TABLE +
+		" SET s = ? WHERE i < ?").rows == 10);
+
+	static const std::string error_query = "SELECT * FROM ut_missing_table";
+	bool query_failed = false;
+	try {
+		pg.exec(error_query.c_str());
+	}
+	catch (db::PostgreSQLException &) {
+		query_failed = true;
+	}
+
+	CPPUNIT_ASSERT(query_failed);
+
+	CPPUNIT_ASSERT(stats->get_statement_stats(error_query).errors == 1);
+
+	// Slow query is logged then explained with ANALYZE from another connection
+	static const std::string slow_query = "SELECT pg_sleep($1::float8 / 1000)";
+	pg.exec_params(slow_query, 150);
+	CPPUNIT_ASSERT(stats->get_statement_stats(slow_query).percentile(0.99) >=
+		std::chrono::milliseconds(100));
+
+	CPPUNIT_ASSERT(wait_for([&]() {
+		std::lock_guard<std::mutex> lock(slow_query_mutex);
+		return slow_queries.size() == 1;
+	}));
+
+	CPPUNIT_ASSERT(slow_queries[0].query == slow_query && slow_queries[0].params[0] == "150");
+	CPPUNIT_ASSERT(slow_queries[0].plan.find("Execution Time") != std::string::npos);
+
+	// A query writing through a function is rejected in the read only transaction
+	// used by ANALYZE, it's explained without being run again
+	pg.exec("DROP SEQUENCE IF EXISTS ut_stats_seq");
+	pg.exec("CREATE SEQUENCE ut_stats_seq");
+	static const std::string writing_query =
+		"SELECT nextval('ut_stats_seq'), pg_sleep($1::float8 / 1000)";
+	pg.exec_params(writing_query, 150);
+
+	CPPUNIT_ASSERT(wait_for([&]() {
+		std::lock_guard<std::mutex> lock(slow_query_mutex);
+		return slow_queries.size() == 2;
+	}));
+
+	CPPUNIT_ASSERT(!slow_queries[1].plan.empty());
+	CPPUNIT_ASSERT(slow_queries[1].plan.find("Execution Time") == std::string::npos);
+	CPPUNIT_ASSERT(pg.exec("SELECT last_value FROM ut_stats_seq").get<int64_t>(0, 0) == 1);
+
+	pg.set_query_stats(nullptr);
+	pg.exec_params(count_query, 0);
+	CPPUNIT_ASSERT(stats->get_statement_stats(count_query).count == 10);
+}
 }
 }
@@ -51,6 +51,19 @@ class Test_PostgreSQL : public CppUnit::TestFixture
 	CPPUNIT_TEST(pg_transaction_insert);
 	CPPUNIT_TEST(pg_drop_table);
 	CPPUNIT_TEST(pg_show_tables);
+	CPPUNIT_TEST(pg_connection_pool);
+	CPPUNIT_TEST(pg_typed_results);
+	CPPUNIT_TEST(pg_copy);
+	CPPUNIT_TEST(pg_batch);
+	CPPUNIT_TEST(pg_result_stream);
+	CPPUNIT_TEST(pg_async_client);
+	CPPUNIT_TEST(pg_json_writer);
+	CPPUNIT_TEST(pg_typed_query);
+	CPPUNIT_TEST(pg_exec_params);
+	CPPUNIT_TEST(pg_listener);
+	CPPUNIT_TEST(pg_result_cache);
+	CPPUNIT_TEST(pg_router);
+	CPPUNIT_TEST(pg_query_stats);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -69,6 +82,19 @@ protected:
 	void pg_insert();
 	void pg_transaction_insert();
 	void pg_show_tables();
+	void pg_connection_pool();
+	void pg_typed_results();
+	void pg_copy();
+	void pg_batch();
+	void pg_result_stream();
+	void pg_async_client();
+	void pg_json_writer();
+	void pg_typed_query();
+	void pg_exec_params();
+	void pg_listener();
+	void pg_result_cache();
+	void pg_router();
+	void pg_query_stats();
 };
 }
 }
@@ -0,0 +1,653 @@
+/*
+ * Copyright (c) 2017, Loic Blot <loic.blot@unix-experience.fr>
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cppunit/TestAssert.h>
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <core/redisasyncclient.h>
+#include <core/redisclient.h>
+#include <core/redisnearcache.h>
+#include <core/redispipeline.h>
+#include <core/redispool.h>
+#include <core/utils/time.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <thread>
+
+namespace winterwind {
+
+namespace unittests {
+
+#define REDIS_HOST std::string("redis")
+#define REDIS_PORT 6379
+
+#define INIT_REDIS_CLIENT RedisClient redis(REDIS_HOST, REDIS_PORT);
+
+class Test_Redis : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(Test_Redis);
+	CPPUNIT_TEST(redis_pipeline);
+	CPPUNIT_TEST(redis_batch_commands);
+	CPPUNIT_TEST(redis_pipeline_reconnect);
+	CPPUNIT_TEST(redis_set_expire);
+	CPPUNIT_TEST(redis_hset_script);
+	CPPUNIT_TEST(redis_eval_noscript);
+	CPPUNIT_TEST(redis_binary_safe);
+	CPPUNIT_TEST(redis_pool);
+	CPPUNIT_TEST(redis_pool_health_check);
+	CPPUNIT_TEST(redis_pool_circuit_breaker);
+	CPPUNIT_TEST(redis_async_pipelining);
+	CPPUNIT_TEST(redis_async_errors);
+	CPPUNIT_TEST(redis_async_disconnect);
+	CPPUNIT_TEST(redis_async_stop);
+	CPPUNIT_TEST(redis_near_cache);
+	CPPUNIT_TEST(redis_near_cache_eviction);
+	CPPUNIT_TEST(redis_near_cache_flush);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() override {}
+	void tearDown() override
+	{
+		INIT_REDIS_CLIENT;
+		redis.command({"FLUSHDB"});
+	}
+
+protected:
+	/**
+	 * Close client connection from server side
+	 */
+	static void redis_kill_client(RedisClient &redis)
+	{
+		RedisReply id = redis.command({"CLIENT", "ID"});
+		CPPUNIT_ASSERT(id && id->type == REDIS_REPLY_INTEGER);
+
+		RedisClient killer(REDIS_HOST, REDIS_PORT);
+		RedisReply killed = killer.command({"CLIENT", "KILL", "ID",
+			std::to_string(id->integer)});
+		CPPUNIT_ASSERT(killed && killed->type == REDIS_REPLY_INTEGER &&
+			killed->integer == 1);
+
+		// Let the connection close reach the client
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	void redis_pipeline()
+	{
+		INIT_REDIS_CLIENT;
+		RedisPipeline pipeline(redis);
+		pipeline.set("ut_key", "value")
+			.expire("ut_key", 60)
+			.get("ut_key")
+			.hget("ut_key", "field")
+			.get("ut_missing")
+			.hset("ut_hash", "field", "hvalue")
+			.hget("ut_hash", "field");
+		CPPUNIT_ASSERT(pipeline.size() == 7);
+
+		std::vector<RedisReply> replies;
+		CPPUNIT_ASSERT(pipeline.exec(replies));
+		CPPUNIT_ASSERT(pipeline.empty());
+		CPPUNIT_ASSERT(replies.size() == 7);
+
+		CPPUNIT_ASSERT(replies[0]->type == REDIS_REPLY_STATUS && replies[0].str() == "OK");
+		CPPUNIT_ASSERT(replies[1]->type == REDIS_REPLY_INTEGER && replies[1]->integer == 1);
+		CPPUNIT_ASSERT(replies[2]->type == REDIS_REPLY_STRING && replies[2].str() == "value");
+		// HGET on a string, error must not shift next replies
+		CPPUNIT_ASSERT(replies[3].is_error());
+		CPPUNIT_ASSERT(replies[3].str().compare(0, 9, "WRONGTYPE") == 0);
+		CPPUNIT_ASSERT(replies[4].is_nil());
+		CPPUNIT_ASSERT(replies[5]->type == REDIS_REPLY_INTEGER && replies[5]->integer == 1);
+		CPPUNIT_ASSERT(replies[6].str() == "hvalue");
+
+		// Empty pipeline is a no-op
+		std::vector<RedisReply> no_replies;
+		CPPUNIT_ASSERT(pipeline.exec(no_replies));
+		CPPUNIT_ASSERT(no_replies.empty());
+	}
+
+	void redis_batch_commands()
+	{
+		INIT_REDIS_CLIENT;
+		CPPUNIT_ASSERT(redis.mset({{"ut_k1", "v1"}, {"ut_k2", "v2"}}));
+
+		std::unordered_map<std::string, std::string> values;
+		CPPUNIT_ASSERT(redis.mget({"ut_k1", "ut_missing", "ut_k2"}, values));
+		CPPUNIT_ASSERT(values.size() == 2);
+		CPPUNIT_ASSERT(values["ut_k1"] == "v1" && values["ut_k2"] == "v2");
+		CPPUNIT_ASSERT(values.find("ut_missing") == values.end());
+
+		CPPUNIT_ASSERT(redis.hset("ut_hash", "f1", "hv1"));
+		CPPUNIT_ASSERT(redis.hset("ut_hash", "f2", "hv2"));
+
+		std::unordered_map<std::string, std::string> fields;
+		CPPUNIT_ASSERT(redis.hmget("ut_hash", {"f1", "f_missing", "f2"}, fields));
+		CPPUNIT_ASSERT(fields.size() == 2);
+		CPPUNIT_ASSERT(fields["f1"] == "hv1" && fields["f2"] == "hv2");
+		CPPUNIT_ASSERT(fields.find("f_missing") == fields.end());
+	}
+
+	void redis_pipeline_reconnect()
+	{
+		INIT_REDIS_CLIENT;
+		redis_kill_client(redis);
+
+		RedisPipeline pipeline(redis);
+		pipeline.set("ut_key", "value").get("ut_key");
+
+		std::vector<RedisReply> replies;
+		CPPUNIT_ASSERT(!pipeline.exec(replies));
+		CPPUNIT_ASSERT(pipeline.empty());
+
+		// Broken connection is dropped, next pipeline reconnects
+		replies.clear();
+		pipeline.set("ut_key", "value").get("ut_key");
+		CPPUNIT_ASSERT(pipeline.exec(replies));
+		CPPUNIT_ASSERT(replies.size() == 2 && replies[1].str() == "value");
+	}
+
+	static long long redis_ttl(RedisClient &redis, const std::string &key)
+	{
+		RedisReply ttl = redis.command({"TTL", key});
+		CPPUNIT_ASSERT(ttl && ttl->type == REDIS_REPLY_INTEGER);
+		return ttl->integer;
+	}
+
+	void redis_set_expire()
+	{
+		INIT_REDIS_CLIENT;
+		CPPUNIT_ASSERT(redis.set("ut_key", "value"));
+		CPPUNIT_ASSERT(redis_ttl(redis, "ut_key") == -1);
+
+		CPPUNIT_ASSERT(redis.set("ut_key", "value2", 60));
+		long long ttl = redis_ttl(redis, "ut_key");
+		CPPUNIT_ASSERT(ttl > 0 && ttl <= 60);
+
+		std::string res;
+		CPPUNIT_ASSERT(redis.get("ut_key", res) && res == "value2");
+	}
+
+	void redis_hset_script()
+	{
+		INIT_REDIS_CLIENT;
+
+		// Key with another type is replaced by a hash
+		CPPUNIT_ASSERT(redis.set("ut_key", "string"));
+		CPPUNIT_ASSERT(redis.hset("ut_key", "field", "hvalue"));
+
+		std::string type;
+		CPPUNIT_ASSERT(redis.type("ut_key", type) && type == "hash");
+
+		std::string res;
+		CPPUNIT_ASSERT(redis.hget("ut_key", "field", res) && res == "hvalue");
+		CPPUNIT_ASSERT(redis_ttl(redis, "ut_key") == -1);
+
+		// Existing fields are kept, expiration is set
+		CPPUNIT_ASSERT(redis.hset("ut_key", "field2", "hvalue2", 60));
+		long long ttl = redis_ttl(redis, "ut_key");
+		CPPUNIT_ASSERT(ttl > 0 && ttl <= 60);
+		CPPUNIT_ASSERT(redis.hget("ut_key", "field", res) && res == "hvalue");
+		CPPUNIT_ASSERT(redis.hget("ut_key", "field2", res) && res == "hvalue2");
+	}
+
+	void redis_eval_noscript()
+	{
+		INIT_REDIS_CLIENT;
+		static const std::string script = "return redis.call('INCRBY', KEYS[1], ARGV[1])";
+
+		RedisReply reply = redis.eval(script, {"ut_counter"}, {"2"});
+		CPPUNIT_ASSERT(reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 2);
+
+		// Server forgets scripts, client must reload it
+		RedisReply flushed = redis.command({"SCRIPT", "FLUSH"});
+		CPPUNIT_ASSERT(flushed && !flushed.is_error());
+
+		reply = redis.eval(script, {"ut_counter"}, {"3"});
+		CPPUNIT_ASSERT(reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 5);
+
+		// Script errors are returned as error replies
+		reply = redis.eval("return redis.call('INCR', KEYS[1])", {"ut_counter"}, {});
+		CPPUNIT_ASSERT(reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 6);
+		reply = redis.eval("return redis.error_reply('ut failure')", {}, {});
+		CPPUNIT_ASSERT(reply.is_error() && reply.str().find("ut failure") != std::string::npos);
+	}
+
+	void redis_binary_safe()
+	{
+		INIT_REDIS_CLIENT;
+		static const std::string key("ut_\0key", 7);
+		static const std::string key2("ut_\0key\0", 8);
+		static const std::string value("va\0l\0ue\r\n", 9);
+		static const std::string value2("\0", 1);
+		static const std::string field("f\0ield", 6);
+		CPPUNIT_ASSERT(key.size() == 7 && value.size() == 9);
+
+		std::string res;
+		CPPUNIT_ASSERT(redis.set(key, value));
+		CPPUNIT_ASSERT(redis.get(key, res) && res == value);
+		// Keys truncated at NUL must not exist
+		CPPUNIT_ASSERT(!redis.get("ut_", res));
+
+		RedisReply reply = redis.get_reply(key);
+		CPPUNIT_ASSERT(reply && reply.size() == value.size());
+		CPPUNIT_ASSERT(memcmp(reply.data(), value.data(), value.size()) == 0);
+
+		CPPUNIT_ASSERT(redis.hset(key2, field, value));
+		CPPUNIT_ASSERT(redis.hget(key2, field, res) && res == value);
+		reply = redis.hget_reply(key2, field);
+		CPPUNIT_ASSERT(reply && std::string(reply.data(), reply.size()) == value);
+
+		CPPUNIT_ASSERT(redis.del(key2));
+		CPPUNIT_ASSERT(redis.mset({{key, value2}, {key2, value}}));
+		std::unordered_map<std::string, std::string> values;
+		CPPUNIT_ASSERT(redis.mget({key, key2}, values));
+		CPPUNIT_ASSERT(values.size() == 2 && values[key] == value2 && values[key2] == value);
+
+		// Arguments referencing a buffer without terminating NUL
+		static const char raw[] = {'u', 't', '_', 'r', 'a', 'w', 'X'};
+		reply = redis.command({"SET", RedisArg(raw, 6), RedisArg(raw, 7)});
+		CPPUNIT_ASSERT(reply && !reply.is_error());
+		CPPUNIT_ASSERT(redis.get("ut_raw", res) && res == "ut_rawX");
+	}
+
+	void redis_pool()
+	{
+		db::ConnectionPoolConfig config;
+		config.max_size = 2;
+		config.wait_timeout = std::chrono::milliseconds(100);
+		RedisPool pool(REDIS_HOST, REDIS_PORT, config);
+
+		{
+			auto redis = pool.acquire();
+			CPPUNIT_ASSERT(redis->set("ut_key", "value"));
+			CPPUNIT_ASSERT(pool.get_metrics().in_use == 1);
+			CPPUNIT_ASSERT(pool.get_utilization() == 0.5f);
+		}
+
+		// Lease is returned on scope exit
+		db::ConnectionPoolMetrics metrics = pool.get_metrics();
+		CPPUNIT_ASSERT(metrics.in_use == 0 && metrics.idle == 1 && metrics.created == 1);
+
+		{
+			auto c1 = pool.acquire();
+			auto c2 = pool.acquire();
+			std::string res;
+			CPPUNIT_ASSERT(c2->get("ut_key", res) && res == "value");
+
+			bool timed_out = false;
+			try {
+				pool.acquire(std::chrono::milliseconds(50));
+			}
+			catch (db::DatabaseException &e) {
+				timed_out = true;
+			}
+
+			CPPUNIT_ASSERT(timed_out);
+		}
+
+		metrics = pool.get_metrics();
+		CPPUNIT_ASSERT(metrics.timeouts == 1 && metrics.in_use == 0 && metrics.created == 2);
+
+		std::vector<std::thread> workers;
+		for (uint8_t i = 0; i < 8; i++) {
+			workers.emplace_back([&pool] {
+				for (uint8_t j = 0; j < 10; j++) {
+					auto redis = pool.acquire(std::chrono::seconds(5));
+					redis->ping();
+				}
+			});
+		}
+
+		for (auto &worker : workers) {
+			worker.join();
+		}
+
+		metrics = pool.get_metrics();
+		CPPUNIT_ASSERT(metrics.created == 2 && metrics.borrowed == 83);
+	}
+
+	void redis_pool_health_check()
+	{
+		db::ConnectionPoolConfig config;
+		config.max_size = 1;
+		// Ping clients on every borrow
+		RedisPool pool(REDIS_HOST, REDIS_PORT, config, 0, std::chrono::milliseconds(0));
+
+		{
+			auto redis = pool.acquire();
+			redis_kill_client(*redis);
+		}
+
+		// Killed client is detected and replaced before being lent
+		auto redis = pool.acquire();
+		CPPUNIT_ASSERT(redis->set("ut_key", "value"));
+
+		db::ConnectionPoolMetrics metrics = pool.get_metrics();
+		CPPUNIT_ASSERT(metrics.validation_failures == 1 && metrics.created == 2);
+	}
+
+	void redis_pool_circuit_breaker()
+	{
+		db::ConnectionPoolConfig config;
+		config.max_size = 1;
+		// Nothing listens on port 1
+		RedisPool pool("127.0.0.1", 1, config, 60);
+
+		for (uint8_t i = 0; i < 2; i++) {
+			std::string error;
+			try {
+				pool.acquire();
+			}
+			catch (db::DatabaseException &e) {
+				error = e.what();
+			}
+
+			// First connection fails, next one isn't even tried
+			CPPUNIT_ASSERT(!error.empty());
+			CPPUNIT_ASSERT((error.find("circuit breaker") != std::string::npos) == (i == 1));
+		}
+
+		CPPUNIT_ASSERT(pool.get_metrics().size == 0);
+	}
+
+	void redis_async_pipelining()
+	{
+		RedisAsyncClient redis(REDIS_HOST, REDIS_PORT);
+		redis.start();
+
+		static const int32_t commands = 10000;
+		std::vector<std::thread> workers;
+		std::atomic<int32_t> ordered(0);
+		START_CHRONO
+		for (uint8_t t = 0; t < 4; t++) {
+			workers.emplace_back([&redis, &ordered, t] {
+				const std::string key = "ut_counter_" + std::to_string(t);
+				std::vector<std::future<std::string>> futures;
+				futures.reserve(commands);
+				for (int32_t i = 0; i < commands; i++) {
+					futures.push_back(redis.command({"INCR", key}));
+				}
+
+				// Replies come in commands order
+				for (int32_t i = 0; i < commands; i++) {
+					if (futures[i].get() == std::to_string(i + 1)) {
+						ordered++;
+					}
+				}
+			});
+		}
+
+		for (auto &worker : workers) {
+			worker.join();
+		}
+		END_CHRONO
+		std::cout << "Redis async client: " << 4 * commands << " commands in "
+			<< CHRONO_DURATION_STR << std::endl;
+
+		CPPUNIT_ASSERT(ordered == 4 * commands);
+		CPPUNIT_ASSERT(redis.pending_commands() == 0);
+
+		std::promise<std::string> done;
+		redis.command({"GET", "ut_counter_0"},
+			[&done](const redisReply *reply, const std::string &error) {
+				done.set_value(reply ? std::string(reply->str, reply->len) : error);
+			});
+		CPPUNIT_ASSERT(done.get_future().get() == std::to_string(commands));
+	}
+
+	void redis_async_errors()
+	{
+		RedisAsyncClient redis(REDIS_HOST, REDIS_PORT);
+		redis.start();
+
+		CPPUNIT_ASSERT(redis.command({"SET", "ut_key", "value"}).get() == "OK");
+		std::future<std::string> wrong_type = redis.command({"HGET", "ut_key", "field"});
+		std::future<std::string> after_error = redis.command({"GET", "ut_key"});
+
+		bool error_thrown = false;
+		try {
+			wrong_type.get();
+		}
+		catch (RedisException &e) {
+			error_thrown = std::string(e.what()).compare(0, 9, "WRONGTYPE") == 0;
+		}
+
+		CPPUNIT_ASSERT(error_thrown);
+		CPPUNIT_ASSERT(after_error.get() == "value");
+		CPPUNIT_ASSERT(redis.command({"GET", "ut_missing"}).get().empty());
+	}
+
+	static bool redis_future_failed(std::future<std::string> &f)
+	{
+		if (f.wait_for(std::chrono::seconds(2)) != std::future_status::ready) {
+			return false;
+		}
+
+		try {
+			f.get();
+		}
+		catch (RedisException &) {
+			return true;
+		}
+
+		return false;
+	}
+
+	void redis_async_disconnect()
+	{
+		// No circuit breaker, reconnect immediately
+		RedisAsyncClient redis(REDIS_HOST, REDIS_PORT, 0);
+		redis.start();
+
+		const std::string id = redis.command({"CLIENT", "ID"}).get();
+
+		// Blocking command keeps next ones pending
+		std::future<std::string> blocked = redis.command({"BLPOP", "ut_empty_list", "5"});
+		std::future<std::string> pending = redis.command({"PING"});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		{
+			RedisClient killer(REDIS_HOST, REDIS_PORT);
+			RedisReply killed = killer.command({"CLIENT", "KILL", "ID", id});
+			CPPUNIT_ASSERT(killed && killed->type == REDIS_REPLY_INTEGER &&
+				killed->integer == 1);
+		}
+
+		CPPUNIT_ASSERT(redis_future_failed(blocked));
+		CPPUNIT_ASSERT(redis_future_failed(pending));
+		CPPUNIT_ASSERT(redis.command({"PING"}).get() == "PONG");
+		CPPUNIT_ASSERT(redis.pending_commands() == 0);
+	}
+
+	void redis_async_stop()
+	{
+		RedisAsyncClient redis(REDIS_HOST, REDIS_PORT);
+		redis.start();
+
+		std::future<std::string> blocked = redis.command({"BLPOP", "ut_empty_list", "5"});
+		std::future<std::string> pending = redis.command({"PING"});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		redis.stop_and_wait();
+		CPPUNIT_ASSERT(redis_future_failed(blocked));
+		CPPUNIT_ASSERT(redis_future_failed(pending));
+
+		// Commands sent after stop are rejected, not lost
+		std::future<std::string> rejected = redis.command({"PING"});
+		CPPUNIT_ASSERT(redis_future_failed(rejected));
+		CPPUNIT_ASSERT(redis.pending_commands() == 0);
+	}
+
+	/**
+	 * Wait at most 2 seconds for condition
+	 */
+	static bool redis_wait_for(const std::function<bool()> &condition)
+	{
+		for (uint16_t i = 0; i < 200; i++) {
+			if (condition()) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		return condition();
+	}
+
+	static void redis_near_cache_start(RedisNearCache &cache)
+	{
+		cache.start();
+		CPPUNIT_ASSERT(redis_wait_for([&cache] {
+			return cache.get_invalidation_client_id() != 0;
+		}));
+	}
+
+	void redis_near_cache()
+	{
+		INIT_REDIS_CLIENT;
+		CPPUNIT_ASSERT(redis.set("ut_key", "value"));
+		CPPUNIT_ASSERT(redis.hset("ut_hash", "field", "hvalue"));
+
+		RedisNearCache cache(REDIS_HOST, REDIS_PORT);
+		redis_near_cache_start(cache);
+
+		std::string res;
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && res == "value");
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && res == "value");
+		CPPUNIT_ASSERT(cache.hget("ut_hash", "field", res) && res == "hvalue");
+		CPPUNIT_ASSERT(cache.hget("ut_hash", "field", res) && res == "hvalue");
+		CPPUNIT_ASSERT(!cache.get("ut_missing", res));
+
+		RedisNearCacheMetrics metrics = cache.get_metrics();
+		CPPUNIT_ASSERT(metrics.hits == 2 && metrics.misses == 3 && metrics.entries == 2);
+
+		// Write from another client invalidates cached value
+		CPPUNIT_ASSERT(redis.set("ut_key", "value2"));
+		CPPUNIT_ASSERT(redis_wait_for([&cache] {
+			return cache.get_metrics().invalidations >= 1;
+		}));
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && res == "value2");
+
+		CPPUNIT_ASSERT(redis.hset("ut_hash", "field", "hvalue2"));
+		CPPUNIT_ASSERT(redis_wait_for([&cache] {
+			return cache.get_metrics().invalidations >= 2;
+		}));
+		CPPUNIT_ASSERT(cache.hget("ut_hash", "field", res) && res == "hvalue2");
+
+		metrics = cache.get_metrics();
+		CPPUNIT_ASSERT(metrics.hits == 2 && metrics.misses == 5 && metrics.entries == 2);
+	}
+
+	void redis_near_cache_eviction()
+	{
+		INIT_REDIS_CLIENT;
+		const std::string big_value(400, 'x');
+		CPPUNIT_ASSERT(redis.mset({{"ut_k1", "v1"}, {"ut_k2", "v2"}, {"ut_k3", "v3"},
+			{"ut_big1", big_value}, {"ut_big2", big_value}}));
+
+		std::string res;
+		{
+			RedisNearCacheConfig config;
+			config.max_entries = 2;
+			RedisNearCache cache(REDIS_HOST, REDIS_PORT, config);
+			redis_near_cache_start(cache);
+
+			CPPUNIT_ASSERT(cache.get("ut_k1", res) && cache.get("ut_k2", res));
+			// Least recently used key is evicted
+			CPPUNIT_ASSERT(cache.get("ut_k1", res) && cache.get("ut_k3", res));
+
+			RedisNearCacheMetrics metrics = cache.get_metrics();
+			CPPUNIT_ASSERT(metrics.entries == 2 && metrics.evictions == 1);
+			CPPUNIT_ASSERT(cache.get("ut_k1", res) && cache.get_metrics().hits == 2);
+			CPPUNIT_ASSERT(cache.get("ut_k2", res) && cache.get_metrics().hits == 2);
+		}
+
+		{
+			RedisNearCacheConfig config;
+			config.max_memory = 1000;
+			RedisNearCache cache(REDIS_HOST, REDIS_PORT, config);
+			redis_near_cache_start(cache);
+
+			CPPUNIT_ASSERT(cache.get("ut_big1", res) && res == big_value);
+			CPPUNIT_ASSERT(cache.get("ut_big2", res) && res == big_value);
+
+			RedisNearCacheMetrics metrics = cache.get_metrics();
+			CPPUNIT_ASSERT(metrics.entries == 1 && metrics.evictions == 1);
+			CPPUNIT_ASSERT(metrics.memory > big_value.size() &&
+				metrics.memory <= config.max_memory);
+		}
+	}
+
+	void redis_near_cache_flush()
+	{
+		INIT_REDIS_CLIENT;
+		CPPUNIT_ASSERT(redis.set("ut_key", "value"));
+
+		RedisNearCacheConfig config;
+		config.cb_interval = 0;
+		RedisNearCache cache(REDIS_HOST, REDIS_PORT, config);
+		redis_near_cache_start(cache);
+
+		std::string res;
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && cache.get("ut_key", res));
+		RedisNearCacheMetrics metrics = cache.get_metrics();
+		CPPUNIT_ASSERT(metrics.entries == 1 && metrics.hits == 1);
+
+		// Invalidations can be lost while invalidation connection is down
+		const int64_t redirect = cache.get_invalidation_client_id();
+		RedisReply killed = redis.command({"CLIENT", "KILL", "ID", std::to_string(redirect)});
+		CPPUNIT_ASSERT(killed && killed->type == REDIS_REPLY_INTEGER && killed->integer == 1);
+
+		const uint64_t flushes = metrics.flushes;
+		CPPUNIT_ASSERT(redis_wait_for([&cache, flushes] {
+			return cache.get_metrics().flushes > flushes;
+		}));
+		CPPUNIT_ASSERT(cache.get_metrics().entries == 0);
+
+		// New invalidation connection is redirected to on next read
+		CPPUNIT_ASSERT(redis_wait_for([&cache, redirect] {
+			const int64_t id = cache.get_invalidation_client_id();
+			return id != 0 && id != redirect;
+		}));
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && cache.get("ut_key", res));
+		CPPUNIT_ASSERT(cache.get_metrics().entries == 1);
+
+		CPPUNIT_ASSERT(redis.set("ut_key", "value2"));
+		CPPUNIT_ASSERT(redis_wait_for([&cache] {
+			return cache.get_metrics().entries == 0;
+		}));
+		CPPUNIT_ASSERT(cache.get("ut_key", res) && res == "value2");
+	}
+};
+}
+}